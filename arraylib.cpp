@@ -2,6 +2,7 @@
 
 #include <string>
 #include <iterator>
+#include <exception>
 #include <math.h>
 #include <stdlib.h>
 #include "arraylib.h"
@@ -43,6 +44,140 @@ namespace Bang
                 throw std::runtime_error("Array library does not implement: " + std::string(str));
         }
     }
+
+    namespace
+    {
+        // one run of an array's elements, for one worker
+        class Chunk : public Task
+        {
+        public:
+            enum Op { kMap, kFilter, kReduce };
+        private:
+            const Value* begin_;
+            const Value* end_;
+            Value fun_;
+            const Op op_;
+        public:
+            Chunk( const Value* begin, const Value* end, const Value& fun, Op op )
+            : begin_( begin ), end_( end ), fun_( fun ), op_( op )
+            {}
+
+            virtual void work()
+            {
+                Stack& s = thread_.stack;
+                switch (op_)
+                {
+                    case kMap:
+                        for (const Value* it = begin_; it < end_; ++it)
+                        {
+                            s.push( *it );
+                            call( fun_ );
+                        }
+                        break;
+                    case kFilter:
+                    {
+                        std::vector<Value> kept;
+                        for (const Value* it = begin_; it < end_; ++it)
+                        {
+                            s.push( *it );
+                            call( fun_ );
+                            if (s.size() < 1)
+                                throw std::runtime_error("Array /pfilter function must leave a boolean");
+                            if (s.pop().tobool())
+                                kept.push_back( *it );
+                        }
+                        std::copy( kept.begin(), kept.end(), s.back_inserter() );
+                    }
+                    break;
+                    case kReduce:
+                        s.push( *begin_ );
+                        for (const Value* it = begin_ + 1; it < end_; ++it)
+                        {
+                            s.push( *it );
+                            call( fun_ );
+                        }
+                        break;
+                }
+                fun_ = Value();
+            }
+        };
+    }
+
+    // Splits the array into a few chunks per worker and runs fun over each
+    // on the pool, each in a Bang! thread of its own; results come back in
+    // array order.  /pmap pushes a new array of whatever fun left for each
+    // element, /pfilter a new array of the elements fun left true for, and
+    // /preduce what's left of folding fun (two values in, one out) over
+    // the elements -- chunk by chunk, then over the chunks' results, so fun
+    // has to be associative.  The array and anything fun closes over are
+    // read from several workers at once, so the array has to be frozen, and
+    // fun can't reach an array or hash that isn't (see Bang::shareable).
+    void Array::parallel( const bangstring& op, Stack& s )
+    {
+        const Value& fun = s.pop();
+        if (!fun.isboundfun() && !fun.isfun())
+            throw std::runtime_error("Array " + std::string(op) + " requires a function");
+        if (!this->frozen())
+            throw std::runtime_error("Array " + std::string(op) + " on an array that isn't frozen, see freeze");
+        if (!Bang::shareable( fun ))
+            throw std::runtime_error("Array " + std::string(op) + ": the function can reach an array or hash that isn't frozen, see freeze");
+
+        const Chunk::Op which = op == "/pmap" ? Chunk::kMap : op == "/pfilter" ? Chunk::kFilter : Chunk::kReduce;
+        const size_t n = stack_.size();
+        if (n == 0)
+        {
+            if (which != Chunk::kReduce)
+            {
+                const auto& empty = NEW_BANGFUN(Array);
+                s.push( STATIC_CAST_TO_BANGFUN(empty) );
+            }
+            return;
+        }
+
+        const size_t nchunks = std::min<size_t>( n, 4 * Bang::workers() );
+        const Value* elements = &stack_[0];
+        std::vector< gcptr<Chunk> > chunks;
+        for (size_t i = 0; i < nchunks; ++i)
+        {
+            chunks.push_back( NEW_BANGFUN( Chunk, elements + n * i / nchunks, elements + n * (i + 1) / nchunks, fun, which ) );
+            Bang::spawn( chunks.back().get() );
+        }
+
+        // every chunk is finished with stack_ before anything gets thrown
+        Stack results;
+        std::exception_ptr error;
+        for (auto& chunk : chunks)
+        {
+            try
+            {
+                chunk->join( results );
+            }
+            catch (...)
+            {
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+        if (error)
+            std::rethrow_exception( error );
+
+        if (which == Chunk::kReduce)
+        {
+            std::vector<Value> partials;
+            results.giveTo( partials );
+            if (partials.empty())
+                return;
+            const auto& combine = NEW_BANGFUN( Chunk, &partials[0], &partials[0] + partials.size(), fun, Chunk::kReduce );
+            combine->run();
+            combine->join( s );
+        }
+        else
+        {
+            const auto& array = NEW_BANGFUN(Array);
+            results.giveTo( array->stack_ );
+            s.push( STATIC_CAST_TO_BANGFUN(array) );
+        }
+    }
     
 } // end namespace Arraylib
 
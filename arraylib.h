@@ -31,6 +31,13 @@ namespace Bang
                 stack.push( stack_[int(msg.tonum())] );
             }
         }
+        virtual bool lookup( const Bang::Value& msg, Value& found ) const
+        {
+            if (!msg.isnum())
+                return false;
+            found = stack_[int(msg.tonum())];
+            return true;
+        }
         virtual void apply( Stack& s ) // , CLOSURE_CREF running )
         {
             const Value& msg = s.pop();
@@ -47,6 +54,18 @@ namespace Bang
                 } );
         }
         
+        // fun a/pmap, fun a/pfilter, fun a/preduce: see arraylib.cpp
+        void parallel( const bangstring& op, Stack& s );
+
+        virtual void freeze()
+        {
+            this->immortalize();
+            for (const Value& v : stack_)
+                Bang::freeze( v );
+        }
+        // only once it's frozen, see Bang::shareable
+        virtual bool shareable( std::vector<const Function*>& seen ) const { return false; }
+
         void customOperator( const bangstring& str, Stack& s)
         {
             const static Bang::bangstring opSize("/#");
@@ -59,6 +78,9 @@ namespace Bang
             const static Bang::bangstring opPush("/push");
             const static Bang::bangstring opDequeue("/dequeue");
             const static Bang::bangstring opSort("/sort");
+            const static Bang::bangstring opPmap("/pmap");
+            const static Bang::bangstring opPfilter("/pfilter");
+            const static Bang::bangstring opPreduce("/preduce");
         
             if (str == opSize)
                 s.push( double(stack_.size()) );
@@ -71,6 +93,13 @@ namespace Bang
             // are even more tentative and easier to replace than the core language, does not
             // imply new syntax, and can always be retained as a deprecated library alongside
             // mutation free alternatives or something.
+            else if (this->frozen() &&
+                (  str == opSet || str == opSwap || str == opInsert || str == opErase
+                || str == opAppend || str == opPush || str == opDequeue || str == opSort
+                ))
+            {
+                throw std::runtime_error("Array " + std::string(str) + " on a frozen array");
+            }
             else if (str == opSet)
             {
                 int ndx = int(s.pop().tonum());
@@ -110,6 +139,10 @@ namespace Bang
             {
                 this->sort();
             }
+            else if (str == opPmap || str == opPfilter || str == opPreduce)
+            {
+                this->parallel( str, s );
+            }
         }
     }; // end, Array class
 
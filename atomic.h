@@ -70,6 +70,27 @@ namespace Atomic
 #endif 
    }
 
+   // a plain read of a counter others may be bumping; no ordering implied
+   inline long
+   load( const volatile long& var )
+   {
+#if __GNUC__
+       return __atomic_load_n( &var, __ATOMIC_RELAXED );
+#else
+       return var;
+#endif 
+   }
+
+   inline void
+   store( volatile long& var, long v )
+   {
+#if __GNUC__
+       __atomic_store_n( &var, v, __ATOMIC_RELAXED );
+#else
+       var = v;
+#endif 
+   }
+
    template< typename TVAR, typename TADDEND >
    inline TVAR
    add( volatile TVAR& var, TADDEND addend )
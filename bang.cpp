@@ -20,6 +20,15 @@
 
 #define LCFG_OPTIMIZE_OPVV2V_WITHLIT 1
 #define LCFG_USE_INDEX_OPERATOR 1
+#define LCFG_NUMEXPR 1 // evaluate straight-line arithmetic in unboxed registers, see NumExpr
+#define LCFG_NUMSPEC 1 // unboxed clones of all-number functions, see NumSpec
+#define LCFG_LICM (!HAVE_MUTATION) // hoist loop invariants; only sound while upvalues can't change
+#define LCFG_CSE (!HAVE_MUTATION && DOT_OPERATOR_INLINE) // reuse repeated index reads, see CseRead
+#define LCFG_LEAFCALL 1 // run programs that never replace their frame in the caller's, see LeafReturn
+#define LCFG_BORROWED_ENV (!HAVE_MUTATION) // frames borrow environments kept alive elsewhere, see RunContext::borrowed_
+#define LCFG_LOCALFUN (!HAVE_MUTATION) // call local functions that can't escape without making closures, see CallLocalFunsDirectly
+#define LCFG_INPLACE_PARAMS 1 // tail calls back into the same environment reuse its parameter bindings, see RebindParamsInPlace
+#define LCFG_SHARED_CLOSURES 1 // reuse closures that capture nothing or were just made in the same environment, see Program::run
 
 #define LCFG_HAVE_TAV_SWAP 0
 
@@ -67,6 +76,10 @@ And there are primitives, until a better library / module system is in place.
   Primitives
     drop! swap! dup! nth! save-stack!
     floor! random! -- these really belong in a math library
+    spawn! join! -- run a function on another core, wait for what it left
+    fork! -- run the functions above the bound at once, push what each left
+    channel! -- a queue between coroutines or workers, /send /recv /try-recv /recv-all
+    freeze! -- make a value and everything in it immutable, to share between workers
     
   Literals
     true false
@@ -76,6 +89,7 @@ And there are primitives, until a better library / module system is in place.
 #include <algorithm>
 #include <iterator>
 #include <map>
+#include <unordered_map>
 //#include <mutex> // for threadsafe upvalue allocator
 
 #include <stdio.h>
@@ -107,6 +121,41 @@ And there are primitives, until a better library / module system is in place.
 # include "mathlib.h"
 #endif 
 
+#if HAVE_BUILTIN_NYLON
+# include "bangnylon.h"
+#endif 
+
+// dependency-free baseline JIT, see JitCompiler below; only x86-64 Linux for now
+#ifndef LCFG_X64JIT
+# if defined(__x86_64__) && defined(__linux__) && !LCFG_GCPTR_STD
+#  define LCFG_X64JIT 1
+# else
+#  define LCFG_X64JIT 0
+# endif
+#endif
+
+#if LCFG_X64JIT
+# include <deque>
+# include <exception>
+# include <mutex>
+# include "x64emit.h"
+#endif 
+
+#if LCFG_MT_SAFEISH
+# include <deque>
+# include <mutex>
+# include <thread>
+# include <condition_variable>
+// Lazy bodies, leaf entries, parameter ends and loop traces are worked out
+// the first time they're needed, which can be on several workers at once
+// (see Scheduler); the first one in does it while the rest wait.
+// Recursive, since compiling one body can compile the ones it calls.
+// One per isolate, see Isolate::State.
+# define LATE_COMPILE_LOCK std::lock_guard<std::recursive_mutex> lateCompileLock( isolateState().lateCompile )
+#else
+# define LATE_COMPILE_LOCK
+#endif 
+
 
 //~~~temporary #define for refactoring
 #define TMPFACT_PROG_TO_RUNPROG(p) &((p)->getAst()->front())
@@ -373,15 +422,250 @@ pifi_up_void jitit_increment_uv0_2reg( double constval, Bang::EOperators eop, in
 }
 #endif 
 
-namespace {
-    bool gDumpMode(false);
-}
-
 
 
 namespace Bang {
 
     void OptimizeAst( std::vector<Bang::Ast::Base*>& ast, const Bang::Ast::CloseValue* upvalueChain, bool notco );
+#if LCFG_NUMSPEC
+    void SpecializeNumFun( std::vector<Bang::Ast::Base*>& ast, const Bang::Ast::Program* fun );
+#endif 
+#if LCFG_LICM
+    void HoistLoopInvariants( std::vector<Bang::Ast::Base*>& ast, const Bang::Ast::Program* fun );
+#endif 
+#if LCFG_CSE
+    void ReuseCommonReads( std::vector<Bang::Ast::Base*>& ast );
+#endif 
+#if LCFG_LOCALFUN
+    void CallLocalFunsDirectly( std::vector<Bang::Ast::Base*>& ast );
+#endif 
+
+#if LCFG_X64JIT
+    // One piece of generated code, embedded in whatever runs it (a JitSegment
+    // or a LoopTrace).  Bracket every call with enter() / leave(); once the
+    // cache has evicted the code, enter() fails and the owner goes back to
+    // the interpreter until it compiles the code again, if it's still hot
+    // (see RecompileSegment and RunHotLoop).  Pages are only unmapped after
+    // the last leave(), so eviction is safe while native code is running.
+    class JitCode
+    {
+        friend class JitCodeCache;
+        std::atomic<void*> code_; // stored with release, so a reinstall is seen whole
+        size_t mapped_;
+        size_t bytes_;
+        unsigned module_;
+        std::atomic<uint64_t> lastUse_; // relaxed, see JitCodeCache::clock_
+        volatile long active_;
+        volatile long evicted_;
+    public:
+        JitCode()
+        : code_( nullptr ), mapped_( 0 ), bytes_( 0 ), module_( 0 ),
+          lastUse_( 0 ), active_( 0 ), evicted_( 1 )
+        {}
+        void* code() const { return code_.load( std::memory_order_acquire ); }
+        size_t bytes() const { return bytes_; }
+        inline bool enter();
+        inline void leave();
+        void release();
+    };
+
+    // Owns all native code.  Code is grouped by module, one per top level
+    // ParseToProgram (lazily compiled bodies and traces count towards the
+    // module they were parsed in), so an embedder can drop a module's code
+    // with releaseJitCode(), and whatever is still cached for a module goes
+    // when the Isolate it was parsed in does (Programs are never deleted, so
+    // that's the last anything could run it).
+    // Mapped bytes are capped (-jitcache=<KB>); when full, the least
+    // recently entered code is evicted.
+    class JitCodeCache
+    {
+        std::mutex lock_;
+        std::vector<JitCode*> live_;
+        std::map<const Ast::Program*, unsigned> modules_;
+        unsigned nextModule_;
+        size_t limit_;
+        size_t mapped_, bytes_, peakMapped_;
+        unsigned compiled_, evictions_, released_;
+
+        void evict( JitCode& jc ) // lock_ held
+        {
+            live_.erase( std::find( live_.begin(), live_.end(), &jc ) );
+            MT_SAFEISH_INC( jc.evicted_ );
+            if (MT_SAFEISH_LOAD( jc.active_ ) == 0)
+                unmap( jc );
+        }
+        void unmap( JitCode& jc ) // lock_ held
+        {
+            void* code = jc.code_.load( std::memory_order_relaxed );
+            if (!code)
+                return;
+            munmap( code, jc.mapped_ );
+            mapped_ -= jc.mapped_;
+            bytes_ -= jc.bytes_;
+            jc.code_.store( nullptr, std::memory_order_relaxed );
+        }
+    public:
+        // bumped per install, and by an enter() of code that wasn't the
+        // last to be stamped, so it moves with use and not just with
+        // compiles; an approximate LRU is plenty, but isolates share the
+        // cache, so it's read from any OS thread
+        std::atomic<uint64_t> clock_;
+
+        JitCodeCache()
+        : nextModule_( 1 ), limit_( 64 << 20 ),
+          mapped_( 0 ), bytes_( 0 ), peakMapped_( 0 ),
+          compiled_( 0 ), evictions_( 0 ), released_( 0 ), clock_( 0 )
+        {}
+
+        void setLimit( size_t bytes ) { limit_ = bytes; }
+        unsigned newModule() { std::lock_guard<std::mutex> g( lock_ ); return nextModule_++; }
+        void bindModule( const Ast::Program* prog, unsigned module )
+        {
+            std::lock_guard<std::mutex> g( lock_ );
+            modules_[prog] = module;
+        }
+
+        // false if there's no room even after evicting everything, or no memory
+        bool install( JitCode& jc, const X64::Emitter& e, unsigned module )
+        {
+            std::lock_guard<std::mutex> g( lock_ );
+            return place( jc, e, module );
+        }
+
+        // new code for jc, which was evicted, into the same module; false
+        // as for install, or if something is still running the old code, or
+        // the module's code has been released
+        bool reinstall( JitCode& jc, const X64::Emitter& e )
+        {
+            std::lock_guard<std::mutex> g( lock_ );
+            if (!MT_SAFEISH_LOAD( jc.evicted_ ) || jc.code_.load( std::memory_order_relaxed ))
+                return false;
+            if (std::find_if( modules_.begin(), modules_.end(),
+                    [&]( const std::pair<const Ast::Program* const, unsigned>& m ) { return m.second == jc.module_; } )
+                == modules_.end())
+                return false;
+            return place( jc, e, jc.module_ );
+        }
+
+    private:
+        bool place( JitCode& jc, const X64::Emitter& e, unsigned module ) // lock_ held
+        {
+            const size_t page = sysconf( _SC_PAGESIZE );
+            const size_t want = (e.size() + page - 1) & ~(page - 1);
+            if (limit_ && want > limit_)
+                return false;
+            while (limit_ && mapped_ + want > limit_ && !live_.empty())
+            {
+                auto lru = std::min_element
+                (   live_.begin(), live_.end(),
+                    []( const JitCode* a, const JitCode* b )
+                    {   return a->lastUse_.load( std::memory_order_relaxed ) < b->lastUse_.load( std::memory_order_relaxed ); } );
+                evict( **lru );
+                ++evictions_;
+            }
+            size_t mapped = 0;
+            void* code = e.finalize( &mapped );
+            if (!code)
+                return false;
+            jc.code_.store( code, std::memory_order_release );
+            jc.mapped_ = mapped;
+            jc.bytes_ = e.size();
+            jc.module_ = module;
+            jc.lastUse_.store( ++clock_, std::memory_order_relaxed );
+            MT_SAFEISH_STORE( jc.evicted_, 0 );
+            live_.push_back( &jc );
+            mapped_ += mapped;
+            bytes_ += jc.bytes_;
+            peakMapped_ = std::max( peakMapped_, mapped_ );
+            ++compiled_;
+            return true;
+        }
+
+    public:
+
+        void release( JitCode& jc )
+        {
+            std::lock_guard<std::mutex> g( lock_ );
+            if (!MT_SAFEISH_LOAD( jc.evicted_ ))
+            {
+                evict( jc );
+                ++released_;
+            }
+        }
+
+        void releaseModule( const Ast::Program* prog )
+        {
+            std::lock_guard<std::mutex> g( lock_ );
+            auto it = modules_.find( prog );
+            if (it == modules_.end())
+                return;
+            const unsigned module = it->second;
+            modules_.erase( it );
+            for (unsigned i = live_.size(); i-- > 0; )
+            {
+                if (live_[i]->module_ == module)
+                {
+                    evict( *live_[i] );
+                    ++released_;
+                }
+            }
+        }
+
+        void lastLeave( JitCode& jc ) // an evicted block's last caller is done
+        {
+            std::lock_guard<std::mutex> g( lock_ );
+            if (MT_SAFEISH_LOAD( jc.active_ ) == 0 && MT_SAFEISH_LOAD( jc.evicted_ )) // not if it's been reinstalled meanwhile
+                unmap( jc );
+        }
+
+        void dump( std::ostream& o )
+        {
+            std::lock_guard<std::mutex> g( lock_ );
+            o << "jit: " << live_.size() << " live of " << compiled_ << " compiled, "
+              << bytes_ << " bytes code in " << mapped_ << " mapped (peak " << peakMapped_
+              << ", limit " << limit_ << "), " << evictions_ << " evicted, "
+              << released_ << " released\n";
+        }
+    };
+
+    JitCodeCache gJitCache;
+    thread_local unsigned gJitModule; // module being parsed on this thread
+
+    // everything compiled while one of these is around belongs to module
+    class JitModuleScope
+    {
+        unsigned saved_;
+    public:
+        JitModuleScope( unsigned module ) : saved_( gJitModule ) { gJitModule = module; }
+        ~JitModuleScope() { gJitModule = saved_; }
+    };
+
+    bool JitCode::enter()
+    {
+        MT_SAFEISH_INC( active_ );
+        if (MT_SAFEISH_LOAD( evicted_ ))
+        {
+            leave();
+            return false;
+        }
+        // code entered over and over with nothing else in between leaves
+        // the clock alone
+        if (lastUse_.load( std::memory_order_relaxed ) != gJitCache.clock_.load( std::memory_order_relaxed ))
+            lastUse_.store( gJitCache.clock_.fetch_add( 1, std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+        return true;
+    }
+
+    void JitCode::leave()
+    {
+        if (MT_SAFEISH_DEC( active_ ) && MT_SAFEISH_LOAD( evicted_ ))
+            gJitCache.lastLeave( *this );
+    }
+
+    void JitCode::release()
+    {
+        gJitCache.release( *this );
+    }
+#endif 
 
 
 template< class Tp >    
@@ -475,6 +759,9 @@ struct SimplestAllocator
 };
 #endif
 
+// The free list behind SimpleAllocator is process wide, which is fine with
+// only the one OS thread; with threads (and so isolates running in
+// parallel) upvalues come straight from the heap.
 #if LCFG_MT_SAFEISH    
 SimplestAllocator< Upvalue > gUpvalAlloc;
 #else
@@ -508,33 +795,12 @@ DLLEXPORT void GCDellocator<Upvalue>::freemem(Upvalue* p)
 
     
 
-    std::map<std::string,bangstring> gProgStrings;
-    typedef std::pair<std::string,bangstring> itsval_t;
-    bangstring internstring( const std::string& s )
-    {
-        if (s.length() > 32)
-            return bangstring(s);
-        
-        auto it_interned = gProgStrings.find(s);
-        if (it_interned == gProgStrings.end())
-        {
-            bangstring newbs( s );
-            itsval_t pair( s, newbs );
-            gProgStrings.insert( pair );
-            return newbs;
-        }
-        else
-        {
-            return it_interned->second;
-        }
-    }
-
-
-
     static const NthParent kNoParent=NthParent(INT_MAX);
 
 
     namespace Ast { class CloseValue; }
+    class LazyProgramBody;
+    class LoopTrace;
 
 
 
@@ -603,7 +869,7 @@ void indentlevel( int level, std::ostream& o )
 namespace Ast { class Base; }    
 
     RunContext::RunContext()
-    : thread(nullptr), prev(nullptr), ppInstr(nullptr)
+    : thread(nullptr), prev(nullptr), ppInstr(nullptr), borrowed_(false), leafDepth_(0)
 #if LCFG_HAVE_TRY_CATCH      
     ,catcher(nullptr)
 #endif 
@@ -612,7 +878,15 @@ namespace Ast { class Base; }
     void RunContext::rebind( const Ast::Base* const * inppInstr, SHAREDUPVALUE_CREF uv )
     {
         ppInstr = inppInstr;
-        upvalues_ = uv;
+        if (borrowed_)
+        {
+            SHAREDUPVALUE owned( uv ); // uv may well be upvalues_
+            upvalues_.release();
+            borrowed_ = false;
+            upvalues_ = std::move( owned );
+        }
+        else
+            upvalues_ = uv;
     }
     
     void RunContext::rebind( const Ast::Base* const * inppInstr )
@@ -620,6 +894,16 @@ namespace Ast { class Base; }
         ppInstr = inppInstr;
     }
 
+    // Only for an environment reachable from the one being replaced, and
+    // only while that one is itself borrowed: anything else could be freed
+    // with it.
+    void RunContext::rebindBorrowed( const Ast::Base* const * inppInstr, Upvalue* uv )
+    {
+        ppInstr = inppInstr;
+        upvalues_.release();
+        upvalues_.adopt( uv );
+    }
+
 namespace Primitives
 {
     void stacklen( Stack& s, const RunContext& ctx)
@@ -1058,7 +1342,157 @@ namespace Ast
     }
     
 
-const Ast::Base* gFailedAst = nullptr;
+    // Source locations for instructions, kept on the side so each Ast node
+    // doesn't drag a std::string around.  File names are stored once and
+    // referred to by a small id; the "file:line Ccol" text is only built
+    // when an error message or dump asks for it.  There is one per isolate,
+    // keyed by node; a node forgets its location when it's deleted, so
+    // one allocated at the same address later doesn't inherit it.
+    class SourceMap
+    {
+        std::vector<std::string> files_; // fileid-1 => filename
+        std::unordered_map<const Ast::Base*,SourceLocation> locs_;
+    public:
+        unsigned fileid( const std::string& filename )
+        {
+            auto it = std::find( files_.begin(), files_.end(), filename );
+            if (it != files_.end())
+                return (it - files_.begin()) + 1;
+            files_.push_back( filename );
+            return files_.size();
+        }
+
+        std::string filename( unsigned fileid ) const
+        {
+            return fileid ? files_[fileid-1] : std::string("(unsure where)");
+        }
+
+        void set( const Ast::Base* ast, const SourceLocation& loc )
+        {
+            if (loc.known())
+                locs_[ast] = loc;
+        }
+
+        // an optimization folded "from" into "to"; "to" now answers for it.
+        void move( const Ast::Base* to, const Ast::Base* from )
+        {
+            auto it = locs_.find( from );
+            if (it == locs_.end())
+                locs_.erase( to );
+            else
+            {
+                locs_[to] = it->second;
+                locs_.erase( from );
+            }
+        }
+
+        void forget( const Ast::Base* ast )
+        {
+            if (!locs_.empty())
+                locs_.erase( ast );
+        }
+
+        std::string describe( const Ast::Base* ast ) const
+        {
+            auto it = locs_.find( ast );
+            if (it == locs_.end())
+                return "(unsure where)";
+
+            const SourceLocation& loc = it->second;
+            std::ostringstream oss;
+            oss << files_[loc.fileid_-1] << ":" << loc.lineno_ << " C" << loc.linecol_;
+            return oss.str();
+        }
+    };
+
+    struct Isolate::State
+    {
+        std::map<std::string,bangstring> progStrings; // see internstring
+        SourceMap sourceMap;
+        const Ast::Base* failedAst;
+        bool dumpMode;
+        bool lazyCompile;
+        bool jit;
+        std::map<std::string,const Ast::Program*> stdModules; // see requireStdModule
+#if LCFG_X64JIT
+        std::vector<const Ast::Program*> jitModules; // parsed here, see ParseToProgram
+#endif 
+#if LCFG_MT_SAFEISH
+        std::recursive_mutex lateCompile;
+#endif 
+        Thread nullThread;
+
+        State( Isolate* isolate )
+        : failedAst( nullptr ), dumpMode( false ), lazyCompile( false ), jit( false ),
+          nullThread( isolate )
+        {}
+        ~State()
+        {
+#if LCFG_X64JIT
+            for (const Ast::Program* module : jitModules)
+                gJitCache.releaseModule( module );
+#endif 
+        }
+    };
+
+    namespace {
+        thread_local Isolate* tIsolate = nullptr; // see Isolate::Enter
+    }
+
+    DLLEXPORT Isolate::Isolate() : state_( new State( this ) ) {}
+    DLLEXPORT Isolate::~Isolate() { delete state_; }
+
+    DLLEXPORT Isolate& Isolate::current()
+    {
+        if (tIsolate)
+            return *tIsolate;
+        static Isolate* process = new Isolate; // workers may still be using it at exit
+        return *process;
+    }
+
+    DLLEXPORT Isolate::Enter::Enter( Isolate* isolate )
+    : prev_( tIsolate )
+    {
+        tIsolate = isolate;
+    }
+
+    DLLEXPORT Isolate::Enter::~Enter()
+    {
+        tIsolate = prev_;
+    }
+
+    inline Isolate::State& isolateState() { return Isolate::current().state(); }
+
+    typedef std::pair<std::string,bangstring> itsval_t;
+    bangstring internstring( const std::string& s )
+    {
+        if (s.length() > 32)
+            return bangstring(s);
+        
+        auto& progStrings = isolateState().progStrings;
+        auto it_interned = progStrings.find(s);
+        if (it_interned == progStrings.end())
+        {
+            bangstring newbs( s );
+            itsval_t pair( s, newbs );
+            progStrings.insert( pair );
+            return newbs;
+        }
+        else
+        {
+            return it_interned->second;
+        }
+    }
+
+    std::string Ast::Base::where() const
+    {
+        return isolateState().sourceMap.describe( this );
+    }
+
+    Ast::Base::~Base()
+    {
+        isolateState().sourceMap.forget( this );
+    }
 
 
     class StreamMark;
@@ -1180,7 +1614,7 @@ namespace Ast
 
         virtual void run( Stack& stack, const RunContext& rc ) const
         {
-            rc.thread->altstack.push( stack.pop() );
+            rc.thread->altstack().push( stack.pop() );
         }
     };
 
@@ -1193,6 +1627,7 @@ namespace Ast
         : boolsrc_( kSrcStack )
         {}
         void setSrcRegisterBool() { boolsrc_ = kSrcRegisterBool; }
+        ESourceDest boolSource() const { return boolsrc_; }
     };
 
     class ValueEater
@@ -1330,6 +1765,7 @@ namespace Ast
 
         
         const ValueEater& source() const { return src_; }
+        ValueEater& source() { return src_; }
 
         virtual void dump( int level, std::ostream& o ) const
         {
@@ -1544,6 +1980,206 @@ namespace Ast
             bangerr() << "Increment should not run";
         }
     };
+
+#if LCFG_NUMEXPR
+    // A run of arithmetic moves and operators, rewritten by the optimizer
+    // (see BuildNumExprs) to work on a small file of unboxed double
+    // registers instead of pushing and popping intermediate Values.  Each
+    // leaf is read, checked to be a number, and loaded into a register
+    // right before the first operator that needs it; the operators run
+    // register to register; what's left over at the end is written back to
+    // the stack / r0_ / a new upvalue.  Nothing is written until every leaf
+    // has checked out, so if one isn't a number, origOps_ run instead and
+    // errors and non-number operators behave exactly as before.
+    class NumExpr : public Base
+    {
+    public:
+        enum { kMaxRegs = 14 }; // xmm2..xmm15 when the JIT does it natively
+        struct Leaf { ValueEater src; int reg; int stackIndex; unsigned at; }; // stackIndex from the top, for src == kSrcStack; load before ops_[at]
+        struct Op   { EOperators op; int dst, thing, other; };    // dst = other OP thing
+        struct Out  { ValueMaker dest; int reg; };
+        std::vector<Leaf> leaves_;
+        std::vector<Op>   ops_;
+        std::vector<Out>  outs_;
+        int stackIn_;     // values taken from below
+        std::vector<const Base*> origOps_;
+
+        NumExpr() : Base( kNumExpr ), stackIn_( 0 ) {}
+
+        virtual void dump( int level, std::ostream& o ) const
+        {
+            indentlevel(level, o);
+            o << "NumExpr( in=";
+            for (const Leaf& l : leaves_)
+            {
+                o << 'r' << l.reg << '=';
+                if (l.src.v1src_ == kSrcStack)
+                    o << "$stk[" << l.stackIndex << ']';
+                else
+                    l.src.dump( o );
+                o << ' ';
+            }
+            o << "ops=";
+            for (const Op& op : ops_)
+                o << 'r' << op.dst << "=r" << op.other << op2str(op.op) << 'r' << op.thing << ' ';
+            o << "out=";
+            for (const Out& out : outs_)
+            {
+                o << 'r' << out.reg << "->";
+                out.dest.dump( o );
+            }
+            o << ")\n";
+            std::for_each( origOps_.begin(), origOps_.end(),
+                [&]( const Base* op ) { op->dump( level + 1, o ); } );
+        }
+        virtual void run( Stack& stack, const RunContext& rc ) const {
+            bangerr() << "NumExpr should not run";
+        }
+    };
+#endif 
+
+#if LCFG_NUMSPEC
+    // Put in front of a function body by SpecializeNumFun when the body,
+    // given numbers for its parameters, can only ever compute with numbers
+    // and bools: an unboxed clone of the function as a little register
+    // machine.  Self calls are C++ recursion and self tail calls are jumps,
+    // so nothing is boxed and no upvalues are made.  At run time the
+    // arguments (and any outer upvalues it reads) are checked to be
+    // numbers; if they're not, or the recursion gets too deep, nothing has
+    // been touched and the generic body that follows runs instead.
+    class NumSpecEntry : public Base
+    {
+    public:
+        enum EOp { kConst, kOuter, kMove, kAdd, kSub, kMul, kDiv, kLt, kGt, kEq, kAnd, kOr,
+                   kJumpIfNot, kJump, kLoop, kCall, kReturn };
+        enum { kMaxParams = 8, kMaxOuts = 8, kMaxOuter = 32, kMaxRegs = 256, kMaxCode = 2000, kMaxDepth = 512 };
+        struct Instr { EOp op; int dst, a, b; double k; }; // dst = a OP b; calls and returns use lists_[a...]
+        std::vector<Instr> code_;
+        std::vector<int> lists_;            // argument / result registers
+        std::vector<NthParent> outer_;      // upvalues of the function's environment it reads
+        std::vector<bool> outIsBool_;
+        int nParams_;
+        int nRegs_;
+        int skip_;                          // from the first instruction of the body to its BreakProg
+        mutable std::atomic<bool> disabled_; // gave up on too deep a recursion once; don't try again
+
+        NumSpecEntry() : Base( kNumSpecEntry ), nParams_( 0 ), nRegs_( 0 ), skip_( 0 ), disabled_( false ) {}
+
+        // false if it got too deep; the results are left in regs[base...]
+        bool eval( std::vector<double>& regs, size_t base, const double* outer, int depth ) const;
+
+        virtual void dump( int level, std::ostream& o ) const
+        {
+            static const char* const names[] = { "const", "outer", "mov", "+", "-", "*", "/", "<", ">", "=", "/and", "/or",
+                                                 "jf", "jmp", "loop", "call", "ret" };
+            indentlevel(level, o);
+            o << "NumSpec( params=" << nParams_ << " outs=" << outIsBool_.size() << " regs=" << nRegs_ << " code=";
+            for (const Instr& in : code_)
+            {
+                o << names[in.op];
+                switch (in.op)
+                {
+                    case kConst:     o << " r" << in.dst << '=' << in.k; break;
+                    case kOuter:     o << " r" << in.dst << "=#" << outer_[in.a].toint(); break;
+                    case kMove:      o << " r" << in.dst << "=r" << in.a; break;
+                    case kJumpIfNot: o << " r" << in.a << ' ' << in.dst; break;
+                    case kJump:      o << ' ' << in.dst; break;
+                    case kLoop: case kCall: case kReturn: break;
+                    default:         o << " r" << in.dst << "=r" << in.a << ",r" << in.b; break;
+                }
+                o << "; ";
+            }
+            o << ")\n";
+        }
+        virtual void run( Stack& stack, const RunContext& rc ) const {
+            bangerr() << "NumSpecEntry should not run";
+        }
+    };
+#endif 
+
+#if LCFG_LICM
+    // The preheader HoistLoopInvariants puts in front of a loop is made of
+    // these: each binds what expr_ makes as a new (nameless) upvalue, but
+    // only if all its inputs_ are numbers, so it can't throw.  Otherwise
+    // the binding is an invalid Value and LoopInvariant does the work.
+    class HoistInvariant : public Base
+    {
+    public:
+        const Base* expr_;                // dest_ is cv_
+        std::vector<ValueEater> inputs_;  // the upvalues expr_ reads
+        const CloseValue* cv_;
+        HoistInvariant( const Base* expr, const CloseValue* cv )
+        : Base( kHoistInvariant ), expr_( expr ), cv_( cv )
+        {}
+        virtual void dump( int level, std::ostream& o ) const
+        {
+            indentlevel(level, o);
+            o << "HoistInvariant\n";
+            expr_->dump( level + 1, o );
+        }
+    };
+
+    // Stands where a loop-invariant instruction was; takes the value the
+    // preheader bound for it, or runs the instruction if there's none.
+    class LoopInvariant : public Base, public ValueMaker
+    {
+    public:
+        ValueEater src_;   // the hoisted upvalue
+        const Base* orig_;
+        LoopInvariant( NthParent hoisted, const Base* orig, const ValueMaker& dest )
+        : Base( kLoopInvariant ), ValueMaker( dest ), orig_( orig )
+        {
+            src_.setSrcUpval( "", hoisted );
+        }
+        virtual void dump( int level, std::ostream& o ) const
+        {
+            indentlevel(level, o);
+            o << "LoopInvariant( src=";
+            src_.dump( o );
+            o << " dest=";
+            ValueMaker::dump( o );
+            o << ")\n";
+            orig_->dump( level + 1, o );
+        }
+    };
+#endif 
+    
+#if LCFG_X64JIT
+    // Stands in front of a run of simple instructions that were compiled
+    // into one native function.  The instructions stay in the Ast right
+    // behind it (dump, error locations) and are skipped when it succeeds.
+    class JitSegment : public Base
+    {
+    public:
+        // returns -1 when done, else the index of the instruction which threw
+        typedef int (*tfn_native)( Thread*, RunContext* );
+        mutable JitCode code_; // the tfn_native
+        int length_;
+        int inlined_;
+        // for RecompileSegment: runs turned away since the code was evicted,
+        // and how often it's been compiled again
+        enum { kRecompileAfter = 64, kMaxRecompiles = 4 };
+        mutable std::atomic<int> misses_;
+        mutable std::atomic<int> recompiles_;
+        JitSegment( int length, int inlined )
+        : Base( kJitSegment ),
+          length_( length ),
+          inlined_( inlined ),
+          misses_( 0 ),
+          recompiles_( 0 )
+        {}
+        // only for segments nothing is running yet: a pass that drops them
+        // does so before the Ast it rewrites is published
+        ~JitSegment() { code_.release(); }
+        tfn_native native() const { return reinterpret_cast<tfn_native>(code_.code()); }
+        virtual void dump( int level, std::ostream& o ) const
+        {
+            indentlevel(level, o);
+            o << "JitSegment( next=" << length_ << " inlined=" << inlined_ << " bytes=" << code_.bytes() << ")\n";
+        }
+        static void rethrow();
+    };
+#endif 
     
     class ApplyCustomOperator : public Base, public ValueEater
     {
@@ -1657,7 +2293,7 @@ namespace Ast
 
         virtual void dump( int level, std::ostream& o ) const
         {
-            if (gFailedAst == this)
+            if (isolateState().failedAst == this)
                 o << "FAIL *** ";
             indentlevel(level, o);
             o << (apply_?"Apply":"Push") << "Primitive op='" << desc_ << "'\n";
@@ -1762,10 +2398,10 @@ namespace Ast
             indentlevel(level, o);
             o << "Apply (src=";
             ValueEater::dump(o);
-            o << ") " << where_ ;
+            o << ") " << where() ;
             if (instr_ == kTCOApply)
                 o << " TCO";
-            if (gFailedAst == this)
+            if (isolateState().failedAst == this)
                 o << " ***                                 <== *** FAILED *** ";
             o << std::endl;
         }
@@ -1780,16 +2416,38 @@ namespace Ast
     protected:
         const Program* pParent_;
         astList_t ast_;
+        // set when only the extent of the body was found at parse time; it
+        // gets parsed and optimized the first time someone asks for the Ast
+        mutable std::atomic<LazyProgramBody*> lazy_;
+#if LCFG_SHARED_CLOSURES
+        enum { kCacheGiveUp = 16 };
+        mutable Value shared_;                  // the closure, if the body needs nothing from its environment
+        mutable std::atomic<unsigned char> cacheMisses_{ 0 }; // in a row, see Thread::closures_; only a hint, so relaxed
+#endif 
+#if LCFG_INPLACE_PARAMS
+        // findParamsEnd stores nParams_ and then releases paramsEnd_, so
+        // whoever acquires paramsEnd_ >= 0 sees both
+        mutable std::atomic<short> paramsEnd_{ -1 }; // index of the first instruction past the parameter bindings, 0 if none
+        mutable std::atomic<signed char> nParams_{ 0 };
+#endif 
+#if LCFG_LEAFCALL
+        mutable std::atomic<signed char> leafState_{ 0 }; // 1 runs in the caller's frame, -1 doesn't, 0 don't know yet; release/acquire
+        mutable astList_t leafAst_;                       // ast_ ending in a LeafReturn instead of a BreakProg
+#endif 
 
+        void compileLazyBody() const;
     public:
         Program( const Program* parent, const astList_t& ast )
-        : pParent_(parent), ast_( ast )
+        : pParent_(parent), ast_( ast ), lazy_( nullptr )
         {}
 
         Program( const Program* parent )  // empty program ~~~ who uses this? hmm
-        : pParent_( parent )
+        : pParent_( parent ), lazy_( nullptr )
         {}
 
+        void setLazyBody( LazyProgramBody* lazy ) { lazy_ = lazy; }
+        bool compiled() const { return !lazy_; }
+
 //         void setAst( const astList_t& newast )
 //         {
 //             ast_ = newast;
@@ -1808,16 +2466,72 @@ namespace Ast
             (   ast_.begin(), ast_.end(),
                 [&]( const Ast::Base* ast ) { ast->dump( level+1, o ); }
             );
+            if (lazy_)
+            {
+                indentlevel(level+1, o);
+                o << "(lazy body, not compiled yet)\n";
+            }
         }
 
-        const astList_t* getAst() const { return &ast_; }
-        astList_t& astRef() { return ast_; }
+        const astList_t* getAst() const
+        {
+            if (lazy_)
+                compileLazyBody();
+            return &ast_;
+        }
+        astList_t& astRef() { return ast_; }
+
+#if LCFG_LEAFCALL
+        // where to run this in the caller's frame, or nullptr if it needs its own
+        const Base* const* leafEntry() const
+        {
+            const signed char state = leafState_.load( std::memory_order_acquire );
+            return state > 0 ? &leafAst_.front() : state < 0 ? nullptr : findLeafEntry();
+        }
+        const Base* const* findLeafEntry() const;
+#endif 
+#if LCFG_SHARED_CLOSURES
+        void shareIfClosed( const astList_t& ast ) const;
+#endif 
+#if LCFG_INPLACE_PARAMS
+        // where the body goes on from once its parameters are bound, and how
+        // many there are; nullptr if it doesn't start by binding any
+        const Base* const* paramsEnd( int& nParams ) const
+        {
+            short end = paramsEnd_.load( std::memory_order_acquire );
+            if (end < 0)
+                end = findParamsEnd();
+            nParams = nParams_.load( std::memory_order_relaxed );
+            return end ? &ast_[end] : nullptr;
+        }
+        short findParamsEnd() const;
+#endif 
 
         // 'run' pushes the program onto the stack as a BoundProgram.
         // 
         void run( Stack& stack, const RunContext& ) const;
     }; // end, class Ast::Program
 
+#if LCFG_LEAFCALL
+    // A program that never replaces its frame (no tail calls, no REPL
+    // continuation) can run in its caller's: the call saves the caller's pc
+    // and environment in Thread::leafCallers_ and jumps to leafEntry(), and
+    // the kBreakProg handler, finding this in place of the BreakProg, puts
+    // them back.  Saves allocating and tearing down a RunContext on the calls
+    // that do the least work.
+    class LeafReturn : public BreakProg
+    {
+    public:
+        static const LeafReturn instance;
+        virtual void dump( int level, std::ostream& o ) const
+        {
+            indentlevel(level, o);
+            o << "LeafReturn\n";
+        }
+    };
+    const LeafReturn LeafReturn::instance;
+#endif 
+
     class ApplyIndexOperator : public Base, public ValueEater
     {
         FRIENDOF_RUNPROG
@@ -1845,6 +2559,7 @@ namespace Ast
         void setIndexValueSource( const ValueEater& other ) {
             indexValue_ = other;
         }
+        const ValueEater& indexValue() const { return indexValue_; }
         
         virtual void dump( int level, std::ostream& o ) const
         {
@@ -1858,6 +2573,83 @@ namespace Ast
         virtual void run( Stack& stack, const RunContext& ) const
         { bangerr() <<"ApplyIndexOperator::run should not be called"; }
     }; // end, ApplyIndexOperator class
+
+#if LCFG_CSE
+    // The first of several reads of the same index from the same upvalue,
+    // with nothing in between that could change what they get.  Reads as
+    // usual, and keeps what it read in a thread register for CseReuse.  The
+    // register gets an invalid Value instead when the receiver couldn't
+    // answer without running code (see Function::lookup).
+    class CseRead : public Base
+    {
+    public:
+        enum { kRegs = 8 };
+        const ApplyIndexOperator* read_; // from an upvalue, by upvalue or literal
+        int reg_;
+        CseRead( const ApplyIndexOperator* read, int reg )
+        : read_( read ), reg_( reg )
+        {}
+        static void read( const ApplyIndexOperator& op, Stack& stack, const RunContext& rc )
+        {
+            const Ast::ValueEater& index = op.indexValue();
+            FRVE2UV( rc, op ).applyIndexOperator( index.v1src_ == kSrcUpval ? FRVE2UV( rc, index ) : index.v1literal_, stack, rc );
+        }
+        virtual void run( Stack& stack, const RunContext& rc ) const
+        {
+            std::unique_ptr<Value[]>& regs = rc.thread->cse_;
+            if (!regs)
+                regs.reset( new Value[kRegs] );
+            const Value& owner = FRVE2UV( rc, *read_ );
+            const Ast::ValueEater& index = read_->indexValue();
+            if (owner.isfun() && owner.tofun()->lookup( index.v1src_ == kSrcUpval ? FRVE2UV( rc, index ) : index.v1literal_, regs[reg_] ))
+                stack.push( regs[reg_] );
+            else
+            {
+                regs[reg_] = Value();
+                read( *read_, stack, rc );
+            }
+        }
+        virtual void dump( int level, std::ostream& o ) const
+        {
+            indentlevel(level, o);
+            o << "CseRead( reg=" << reg_ << ")\n";
+            read_->dump( level + 1, o );
+        }
+    };
+
+    // Stands where a repeat of a CseRead was.  Pushes the kept value if it
+    // and every read since are good, otherwise reads again.
+    class CseReuse : public Base
+    {
+    public:
+        const ApplyIndexOperator* orig_;
+        int reg_;
+        std::vector<int> since_; // registers of the reads in between
+        CseReuse( const ApplyIndexOperator* orig, int reg )
+        : orig_( orig ), reg_( reg )
+        {}
+        virtual void run( Stack& stack, const RunContext& rc ) const
+        {
+            const Value* regs = rc.thread->cse_.get();
+            bool kept = regs && regs[reg_].type() != Value::kInvalidUnitialized;
+            for (unsigned i = 0; kept && i < since_.size(); ++i)
+                kept = regs[since_[i]].type() != Value::kInvalidUnitialized;
+            if (kept)
+                stack.push( regs[reg_] );
+            else
+                CseRead::read( *orig_, stack, rc );
+        }
+        virtual void dump( int level, std::ostream& o ) const
+        {
+            indentlevel(level, o);
+            o << "CseReuse( reg=" << reg_ << " since=";
+            for (int r : since_)
+                o << r << ' ';
+            o << ")\n";
+            orig_->dump( level + 1, o );
+        }
+    };
+#endif 
     
     class IfElse : public Base, public BoolEater
     {
@@ -1870,6 +2662,9 @@ namespace Ast
           else_( else__ )
         {}
 
+        const Ast::Program* ifBranch() const   { return if_; }
+        const Ast::Program* elseBranch() const { return else_; }
+
         Ast::Program* branchTaken( Thread& thr ) const
         {
             if (boolsrc_ == kSrcStack)
@@ -1936,10 +2731,33 @@ namespace Ast
         NthParent nthparent_;
     public:
         int skipInstructions;
+#if LCFG_X64JIT
+        // back-edge bookkeeping for the tracing JIT, see RunHotLoop; any
+        // worker may be running the loop, so these are atomic
+        mutable std::atomic<int> hotness_; // negative once the loop has been given up on; only a hint, so relaxed
+        mutable std::atomic<LoopTrace*> trace_; // published with release once recorded
+        mutable std::atomic<LoopTrace*> retired_; // traces whose code was evicted, kept until this goes
+        mutable std::atomic<int> rerecords_;
+        unsigned jitModule_;
+#endif 
         PushFunctionRec( Ast::Program* other, NthParent boundAt )
         : pRecFun_( other ),
           nthparent_(boundAt)
+#if LCFG_X64JIT
+          , hotness_( 0 ),
+          trace_( nullptr ),
+          retired_( nullptr ),
+          rerecords_( 0 ),
+          jitModule_( gJitModule )
+#endif 
         {}
+#if LCFG_X64JIT
+        ~PushFunctionRec();
+#endif 
+
+        const Ast::Program* recFun() const { return pRecFun_; }
+        void setRecFun( Ast::Program* fun ) { pRecFun_ = fun; }
+        NthParent bindingParent() const { return nthparent_; }
 
         void setBindingParent( NthParent n ) {
             nthparent_ = n;
@@ -1967,6 +2785,31 @@ namespace Ast
 
 
 
+// for freeze: the value first, so an upvalue is only ever immortal once
+// what it binds has been frozen
+static void FreezeUpvalue( Upvalue* uv )
+{
+    freeze( uv->v_ );
+    uv->immortalize();
+}
+
+// for freeze, when there's no telling what's read: every value an
+// environment binds
+static void FreezeUpvalues( Upvalue* uv )
+{
+    for ( ; uv; uv = uv->parent_.get())
+        FreezeUpvalue( uv );
+}
+
+// likewise for shareable
+static bool ShareableUpvalues( const Upvalue* uv, std::vector<const Function*>& seen )
+{
+    for ( ; uv; uv = uv->parent_.get())
+        if (!shareable( uv->v_, seen ))
+            return false;
+    return true;
+}
+
 class DynamicLookup : public Function
 {
     SHAREDUPVALUE upvalues_;
@@ -2002,6 +2845,15 @@ public:
     {
         this->indexOperatorNoCtx( s.pop(), s ); // obtain index from stack
     }
+    virtual void freeze()
+    {
+        this->immortalize();
+        FreezeUpvalues( upvalues_.get() );
+    }
+    virtual bool shareable( std::vector<const Function*>& seen ) const
+    {
+        return ShareableUpvalues( upvalues_.get(), seen );
+    }
 };
 
 /*virtual*/ void
@@ -2030,11 +2882,26 @@ public:
     {
         std::copy( stack_.begin(), stack_.end(), std::back_inserter( s.stack_ ) );
     }
+    virtual void freeze()
+    {
+        this->immortalize();
+        for (const Value& v : stack_)
+            Bang::freeze( v );
+    }
+    virtual bool shareable( std::vector<const Function*>& seen ) const
+    {
+        for (const Value& v : stack_)
+            if (!Bang::shareable( v, seen ))
+                return false;
+        return true;
+    }
 };
 
 namespace {
     SHAREDUPVALUE replace_upvalue( SHAREDUPVALUE_CREF tail, const std::string& varname, const Value& newval )
     {
+        if (!tail) // e.g., a closure made without an environment, see Program::shareIfClosed
+            throw std::runtime_error("rebind-fun: could not find upvalue="+varname);
         if (tail->binds(varname))
         {
             return NEW_UPVAL( tail->upvalParseChain(), tail->nthParent(NthParent(1)), newval );
@@ -2118,1570 +2985,6055 @@ namespace Primitives {
     }
 }
 
+#if LCFG_MT_SAFEISH
+namespace {
+    unsigned gWorkers = 0; // see setWorkers
+    thread_local int tWorker = -1; // which worker this OS thread is, if any
+
+    // M:N scheduling of Tasks onto a pool of OS threads, by work stealing.
+    // Each worker has a deque of its own: what it spawns goes on the back,
+    // and it takes from the back as well, so it goes on with what it just
+    // made while that's still in cache.  A worker with nothing to do steals
+    // from the front of another's, where the oldest, and so usually
+    // biggest, pieces are.  Anyone joining a task that isn't done runs other
+    // tasks in the meantime instead of blocking, which is what keeps nested
+    // spawn!/join! (divide and conquer) from running out of workers.
+    class Scheduler
+    {
+        struct Worker
+        {
+            std::mutex lock_;
+            std::deque< gcptr<Task> > tasks_;
+        };
+        std::vector< std::unique_ptr<Worker> > workers_;
+        std::atomic<int> queued_;        // in all the deques together
+        std::atomic<unsigned> next_;     // round robin, for spawns from outside the pool
+        std::atomic<int> sleepers_;
+        std::mutex sleepLock_;
+        std::condition_variable wake_;
 
+        bool take( Worker& w, bool fromBack, gcptr<Task>& task )
+        {
+            std::lock_guard<std::mutex> g( w.lock_ );
+            if (w.tasks_.empty())
+                return false;
+            if (fromBack)
+            {
+                task = w.tasks_.back();
+                w.tasks_.pop_back();
+            }
+            else
+            {
+                task = w.tasks_.front();
+                w.tasks_.pop_front();
+            }
+            --queued_;
+            return true;
+        }
 
-    
-    
+        bool findWork( gcptr<Task>& task )
+        {
+            const int self = tWorker;
+            if (self >= 0 && take( *workers_[self], true, task ))
+                return true;
+            const unsigned n = workers_.size();
+            const unsigned first = self >= 0 ? self + 1 : next_.load();
+            for (unsigned i = 0; i < n && queued_ > 0; ++i)
+            {
+                if (take( *workers_[(first + i) % n], false, task ))
+                    return true;
+            }
+            return false;
+        }
 
+        // until there might be work, or waitingFor is done.  sleepers_ goes
+        // up before looking and is checked after queueing / finishing, so
+        // one side or the other always sees the other's change.
+        void idle( const Task* waitingFor )
+        {
+            std::unique_lock<std::mutex> g( sleepLock_ );
+            ++sleepers_;
+            while (queued_ == 0 && !(waitingFor && waitingFor->done()))
+                wake_.wait( g );
+            --sleepers_;
+        }
 
-        BoundProgram::BoundProgram( const Ast::Program* program, SHAREDUPVALUE_CREF upvalues )
-        : // Function(true),
-          program_( program ), upvalues_( upvalues )
+        void work( int self )
         {
-//             for (int i = 0; i < 16; ++i)
-//                 uvcache[i].v = nullptr;
+            tWorker = self;
+            for (;;)
+            {
+                gcptr<Task> task;
+                if (findWork( task ))
+                    task->run();
+                else
+                    idle( nullptr );
+            }
         }
-    
-        void BoundProgram::dump( std::ostream & out )
+
+    public:
+        Scheduler( unsigned n )
+        : queued_( 0 ), next_( 0 ), sleepers_( 0 )
         {
-            program_->dump( 0, std::cerr );
+            for (unsigned i = 0; i < n; ++i)
+                workers_.emplace_back( new Worker );
+            // detached: they sleep when there's nothing to do, and go when the process does
+            for (unsigned i = 0; i < n; ++i)
+                std::thread( &Scheduler::work, this, int(i) ).detach();
         }
-    
-    void throwNoFunVal( const Ast::Base* pInstr, const Value& v )
-    {
-        std::ostringstream oss;
-        oss << pInstr->where_;
-        oss << ": " << typeid(*pInstr).name() << ": Called apply without function.2; found type=" << v.type() << " V=";
-        v.dump(oss);
-        throw std::runtime_error(oss.str());
-    }
 
-//SimplestAllocator<RunContext> gAllocRc;
+        static Scheduler& pool()
+        {
+            static Scheduler* pool = new Scheduler
+            (   gWorkers ? gWorkers : std::max( 1u, std::thread::hardware_concurrency() ) );
+            return *pool;
+        }
+
+        void spawn( Task* task )
+        {
+            const int self = tWorker;
+            Worker& w = *workers_[self >= 0 ? unsigned(self) : next_++ % workers_.size()];
+            {
+                std::lock_guard<std::mutex> g( w.lock_ );
+                w.tasks_.push_back( gcptr<Task>( task ) );
+                ++queued_;
+            }
+            wakeup( false );
+        }
 
+        unsigned size() const { return workers_.size(); }
 
-    void Thread::setcallin(Thread*caller)
+        void join( const Task& task )
+        {
+            while (!task.done())
+            {
+                gcptr<Task> other;
+                if (findWork( other ))
+                    other->run();
+                else
+                    idle( &task );
+            }
+        }
+
+        void wakeup( bool everyone )
+        {
+            if (sleepers_ == 0)
+                return;
+            std::lock_guard<std::mutex> g( sleepLock_ );
+            if (everyone)
+                wake_.notify_all(); // whoever's joining it
+            else
+                wake_.notify_one();
+        }
+    };
+}
+#endif 
+
+    DLLEXPORT void Task::run()
     {
-        if (!callframe)
+        Isolate::Enter isolate( thread_.isolate_ ); // whoever spawned it
+        try
         {
-            // maybe this should just be done in constructor.
-            
-            // start me off pointing at the BoundProgram, ready to roll
-            // no dynamic cast for quickness. responsibility of caller to insure passed Function is a BoundFunction.
-            BoundProgram* pbound = reinterpret_cast<BoundProgram*>( boundProg_.get() );
+            work();
+            thread_.stack.giveTo( results_ );
+        }
+        catch (...)
+        {
+            error_ = std::current_exception();
+        }
+        done_ = true;
+        finished();
+#if LCFG_MT_SAFEISH
+        Scheduler::pool().wakeup( true );
+#endif 
+    }
 
-            this->callframe =
-                new (this->rcAlloc_.allocate(sizeof(RunContext)))
-                RunContext( this, TMPFACT_PROG_TO_RUNPROG(pbound->program_), pbound->upvalues_ );
+    DLLEXPORT void Task::join( Stack& s )
+    {
+#if LCFG_MT_SAFEISH
+        if (!done())
+            Scheduler::pool().join( *this );
+#endif 
+        if (error_)
+            std::rethrow_exception( error_ );
+        std::copy( results_.begin(), results_.end(), s.back_inserter() );
+    }
+
+    DLLEXPORT void Task::call( const Value& fun )
+    {
+        if (fun.isboundfun())
+        {
+            const BoundProgram* bprog = fun.toboundfun();
+            RunProgram( &thread_, bprog->program_, bprog->upvalues_ );
         }
+        else
+            fun.tofun()->apply( thread_.stack );
+    }
 
-        //~~~ i think this is not quite right.  what if i'm called multiple times from separate threads;
-        // then yield out to intermediate callers; when i'm done, who do i return to?  I shouldn't return
-        // to the last caller (to whom I returned control via yield), but maybe there should be a caller
-        // stack or something, such that when I yield I pop off the last caller.  Or no, maybe it shouldn't
-        // matter; because I always return to the last person who resumed me, so I think this is correct.
-        // perhaps there should be something to e.g., set pCaller to nullptr after I yield back to that
-        // caller at least.
-        pCaller = caller;
+    DLLEXPORT void spawn( Task* task )
+    {
+#if LCFG_MT_SAFEISH
+        Scheduler::pool().spawn( task );
+#else
+        task->run();
+#endif 
     }
-    
-    RunContext::RunContext( Thread* inthread, const Ast::Base* const *inppInstr, SHAREDUPVALUE_CREF uv )
-    :  thread(inthread),
-       prev(inthread->callframe),
-       ppInstr( inppInstr ), // , /*initialupvalues(uv),*/
-       upvalues_( uv )
-#if LCFG_HAVE_TRY_CATCH      
-    ,catcher(nullptr)
+
+    DLLEXPORT void setWorkers( unsigned n )
+    {
+#if LCFG_MT_SAFEISH
+        gWorkers = n;
 #endif 
-     {}
-    
-void RunApplyValue( const Ast::Base* pInstr, const Value& v, Stack& stack, const RunContext& frame )
-{
-    switch (v.type())
+    }
+
+    DLLEXPORT unsigned workers()
     {
-        case Value::kFun: { auto f = v.tofun(); f->apply(stack); } break;
-        case Value::kFunPrimitive: v.tofunprim()( stack, frame ); break;
-        default: throwNoFunVal(pInstr, v);
+#if LCFG_MT_SAFEISH
+        return Scheduler::pool().size();
+#else
+        return 1;
+#endif 
     }
-}
-    
-void xferstack( Thread* from, Thread* to )
-{
-    from->stack.giveTo( to->stack );
+
+namespace {
+    // a function given to spawn!, run with an empty stack
+    class SpawnedFunction : public Task
+    {
+        Value fun_;
+    public:
+        SpawnedFunction( const Value& fun ) : fun_( fun ) {}
+        virtual void work()
+        {
+            call( fun_ );
+            fun_ = Value(); // let go of what it closed over
+            thread_.rcAlloc_.trim(); // the task may be kept a while for its results
+        }
+    };
 }
 
-static Thread gNullThread;
-DLLEXPORT Thread* pNullThread( &gNullThread );
-DLLEXPORT Thread* Thread::nullthread() { return &gNullThread; }
+namespace {
+    class Channel;
 
-    template <ESourceDest esd> struct DestSet {};
-    template <> struct DestSet<kSrcStack>        { static inline void set( const Ast::ValueMaker& pa, Thread* pThread, RunContext& frame, Stack& stack, const Value& vv ) { stack.push(vv); }
-                                                   static inline void set( const Ast::ValueMaker& pa, Thread* pThread, RunContext& frame, Stack& stack, const Value&& vv ) { stack.push(std::move(vv)); }
+    // Thrown by /recv (or c!) on an empty channel, for RunProgram to deal
+    // with between instructions: a coroutine yields to its caller and tries
+    // again when it is resumed (see Thread::recvFrom_), since whoever would
+    // fill the channel may well be on the same OS thread; anything else
+    // just waits.
+    struct ChannelEmpty : public std::runtime_error
+    {
+        gcptr<Function> channel;
+        ChannelEmpty( Function* chan ) : std::runtime_error( "channel is empty" ), channel( chan ) {}
     };
-    template <> struct DestSet<kSrcRegister>     { static inline void set( const Ast::ValueMaker& pa, Thread* pThread, RunContext& frame, Stack& stack, const Value& vv ) { pThread->r0_ = vv; }
-                                                   static inline void set( const Ast::ValueMaker& pa, Thread* pThread, RunContext& frame, Stack& stack, const Value&& vv ) { pThread->r0_ = std::move(vv); }
-    }; 
-    template <> struct DestSet<kSrcRegisterBool> { static inline void set( const Ast::ValueMaker& pa, Thread* pThread, RunContext& frame, Stack& stack, const Value& vv ) { pThread->rb0_ = vv.tobool(); } };
-    template <> struct DestSet<kSrcCloseValue>   { static inline void set( const Ast::ValueMaker& pa, Thread* pThread, RunContext& frame, Stack& stack, const Value& vv ) {
-        frame.upvalues_ = NEW_UPVAL( pa.cv_, frame.upvalues_, vv );
-    } };
 
-    template <ESourceDest esd> struct SrcGet {};
-    template <> struct SrcGet<kSrcLiteral>  { static inline const Bang::Value& get( const Ast::ValueEater& pa, Thread* pThread, RunContext& frame ) { return pa.v1literal_; } };
-    template <> struct SrcGet<kSrcRegister> { static inline const Bang::Value& get( const Ast::ValueEater& pa, Thread* pThread, RunContext& frame ) { return pThread->r0_; }  };
-    template <> struct SrcGet<kSrcUpval>    { static inline const Bang::Value& get( const Ast::ValueEater& pa, Thread* pThread, RunContext& frame ) { return FRVE2UV(frame, pa); } }; // frame.getUpValue( pa.v1uvnumber_ ); } };
-    template <> struct SrcGet<kSrcStack>    { static inline Bang::Value get( const Ast::ValueEater& pa, Thread* pThread, RunContext& frame ) { return pThread->stack.pop(); } };
-    
-    template <ESourceDest esd> struct Invoke2n2OperatorWithThingFrom {
-        static inline Bang::Value getAndCall( const Ast::ApplyThingAndValue2ValueOperator& pa, Thread* pThread, RunContext& frame, Stack& stack ) {
-            switch( pa.secondsrc_.v1src_ ) {
-                case kSrcUpval:    return SrcGet<esd>::get(pa,pThread,frame).applyAndValue2Value( pa.openum_, SrcGet<kSrcUpval>   ::get( pa.secondsrc_, pThread, frame ) );
-                case kSrcRegister: return SrcGet<esd>::get(pa,pThread,frame).applyAndValue2Value( pa.openum_, SrcGet<kSrcRegister>::get( pa.secondsrc_, pThread, frame ) );
-                case kSrcLiteral:  return SrcGet<esd>::get(pa,pThread,frame).applyAndValue2Value( pa.openum_, SrcGet<kSrcLiteral> ::get( pa.secondsrc_, pThread, frame ) );
-                default:           return SrcGet<esd>::get(pa,pThread,frame).applyAndValue2Value( pa.openum_, SrcGet<kSrcStack>   ::get( pa.secondsrc_, pThread, frame ) );
+    // Thrown by /send on a full bounded channel, and dealt with the same
+    // way; the value goes with it, to be sent on resuming (Thread::sendTo_).
+    struct ChannelFull : public std::runtime_error
+    {
+        gcptr<Function> channel;
+        Value v;
+        ChannelFull( Function* chan, const Value& v ) : std::runtime_error( "channel is full" ), channel( chan ), v( v ) {}
+    };
+
+    // Channels pass values between coroutines, and between workers.  The
+    // queue itself is lock free; a lock is only taken to sleep when there's
+    // nothing to take (or, bounded, no room), and by whoever wakes a sleeper.
+    class Channel : public Function
+    {
+        std::atomic<int> waiters_;
+#if LCFG_MT_SAFEISH
+        std::mutex lock_;
+        std::condition_variable wake_;
+#endif 
+        // the other side made progress; a fence on both sides, so either
+        // the sleeper sees the change or the changer sees the sleeper
+        void poke()
+        {
+            std::atomic_thread_fence( std::memory_order_seq_cst );
+#if LCFG_MT_SAFEISH
+            if (waiters_.load( std::memory_order_relaxed ) > 0)
+            {
+                std::lock_guard<std::mutex> g( lock_ );
+                wake_.notify_all();
             }
+#endif 
         }
-    };
-    
-    template <> struct Invoke2n2OperatorWithThingFrom<kSrcStack> {
-        static inline Bang::Value getAndCall( const Ast::ApplyThingAndValue2ValueOperator& pa, Thread* pThread, RunContext& frame, Stack& stack ) {
-            const Bang::Value& owner = stack.pop();
-            switch( pa.secondsrc_.v1src_ ) {
-                case kSrcUpval:    return owner.applyAndValue2Value( pa.openum_, SrcGet<kSrcUpval>   ::get( pa.secondsrc_, pThread, frame ) );
-                case kSrcRegister: return owner.applyAndValue2Value( pa.openum_, SrcGet<kSrcRegister>::get( pa.secondsrc_, pThread, frame ) );
-                case kSrcLiteral:  return owner.applyAndValue2Value( pa.openum_, SrcGet<kSrcLiteral> ::get( pa.secondsrc_, pThread, frame ) );
-                default:           return owner.applyAndValue2Value( pa.openum_, SrcGet<kSrcStack>   ::get( pa.secondsrc_, pThread, frame ) );
+
+        template <class TryIt>
+        void wait( TryIt tryIt, const char* what )
+        {
+#if LCFG_MT_SAFEISH
+            for (int spins = 0; spins < 64; ++spins)
+            {
+                if (tryIt())
+                    return;
+                std::this_thread::yield();
             }
+            std::unique_lock<std::mutex> g( lock_ );
+            ++waiters_;
+            std::atomic_thread_fence( std::memory_order_seq_cst );
+            while (!tryIt())
+                wake_.wait( g );
+            --waiters_;
+#else
+            if (!tryIt())
+                throw std::runtime_error( what ); // there's nobody else to fix it
+#endif 
         }
-    };
-    
-    template <> struct Invoke2n2OperatorWithThingFrom<kSrcLiteral> {
-        static inline Bang::Value getAndCall( const Ast::ApplyThingAndValue2ValueOperator& pa, Thread* pThread, RunContext& frame, Stack& stack ) {
-            switch( pa.secondsrc_.v1src_ ) {
-                case kSrcUpval:    return pa.thingliteralop_( pa.v1literal_, SrcGet<kSrcUpval>   ::get( pa.secondsrc_, pThread, frame ) );
-                case kSrcRegister: return pa.thingliteralop_( pa.v1literal_, SrcGet<kSrcRegister>::get( pa.secondsrc_, pThread, frame ) );
-                case kSrcLiteral:  return pa.thingliteralop_( pa.v1literal_, SrcGet<kSrcLiteral> ::get( pa.secondsrc_, pThread, frame ) );
-                default:           return pa.thingliteralop_( pa.v1literal_, SrcGet<kSrcStack>   ::get( pa.secondsrc_, pThread, frame ) );
-            }
-        }
-    };
 
-#if LCFG_HAVE_TAV_SWAP
-            // i think a better implementation would be to have a distinct Ast::Swap()
-            // instruction, then the optimizer could remove it when followed by a dual ValueEater 
-            // except where both Values are coming from the stack.  if both values come from the stack
-            // then the Ast::Swap() instruction is left in place.
-            if (pa.argSwap_)
-            {
-                switch( pa.secondsrc_.v1src_ ) {
-                    case kSrcUpval:    return FRVE2UV(frame, pa.secondsrc_) .applyAndValue2Value( pa.openum_, FRATAV2VUV(frame,pa) );
-                    case kSrcRegister: return pThread->r0_                  .applyAndValue2Value( pa.openum_, FRATAV2VUV(frame,pa)  );
-                    case kSrcLiteral:  return pa.secondsrc_.v1literal_      .applyAndValue2Value( pa.openum_, FRATAV2VUV(frame,pa) );
-                    default:           return stack.pop()                   .applyAndValue2Value( pa.openum_, FRATAV2VUV(frame,pa) );
-                }
-            }
-            else
-#endif
-    
-    template< ESourceDest eThingSource, ESourceDest eValueDest >
-    struct ThingValueOperatorFetchFromSaveTo
-    {
-        static inline void apply(  Stack& stack, Thread* pThread, RunContext& frame, const Ast::ApplyThingAndValue2ValueOperator& pa )
-        {
-            DestSet<eValueDest>::set( pa, pThread, frame, stack, Invoke2n2OperatorWithThingFrom<eThingSource>::getAndCall( pa, pThread, frame, stack ) );
-        }
-    };
+    protected:
+        virtual bool trySend( const Value& v ) = 0;
+        virtual bool tryRecv( Value& v ) = 0;
 
-    /* this is pretty horribly worse than the plain inline version with MSVC; it's *nearly* as good with GCC, but
-     * still not quite.  I guess I should be happy that it comes anywhere near close. As much as I like the
-     * theory of "use templates, not preprocessor" I guess compilers still aren't quite as smart as human
-     * crafted syntax expansions. */
-    template< ESourceDest edst >
-    struct ApplyThingValueCall
-    {
-        static inline void docall( Stack& stack, Thread* pThread, RunContext& frame, const Ast::ApplyThingAndValue2ValueOperator& pa )
+        // pushes a value if there is one, otherwise throws ChannelEmpty
+        void recvOrThrow( Stack& s )
         {
-            switch (pa.v1src_)
-            {
-                case kSrcUpval:    ThingValueOperatorFetchFromSaveTo<kSrcUpval,edst>   ::apply( stack, pThread, frame, pa ); break;
-                case kSrcStack:    ThingValueOperatorFetchFromSaveTo<kSrcStack,edst>   ::apply( stack, pThread, frame, pa ); break;
-                case kSrcLiteral:  ThingValueOperatorFetchFromSaveTo<kSrcLiteral,edst> ::apply( stack, pThread, frame, pa ); break;
-                case kSrcRegister: ThingValueOperatorFetchFromSaveTo<kSrcRegister,edst>::apply( stack, pThread, frame, pa ); break;
-            }
+            Value v;
+            if (!tryRecv( v ))
+                throw ChannelEmpty( this );
+            poke();
+            s.push( std::move(v) );
         }
-    };
 
-    
-    template <ESourceDest source, ESourceDest dest> struct Mover {
-        static inline void domove( const Ast::ValueMaker& vm, const Ast::ValueEater& ve, Thread* pThread, RunContext& frame, Stack& stack ) { 
-            DestSet<dest>::set( vm, pThread, frame, stack, SrcGet<source>::get( ve, pThread, frame ) );
+        // sends v if there's room, otherwise throws ChannelFull
+        void sendOrThrow( const Value& v )
+        {
+            if (!trySend( v ))
+                throw ChannelFull( this, v );
+            poke();
         }
-    };
-
-//     template <ESourceDest source, ESourceDest dest> struct Incrementer {
-//         static void domove( const Ast::ValueMaker& vm, const Ast::ValueEater& ve, Thread* pThread, RunContext& frame, Stack& stack ) { 
-//             DestSet<dest>::set( vm, pThread, frame, stack, SrcGet<source>::get( ve, pThread, frame ).tonum() + 1 );
-//         }
-//     };
-    
 
-#if __GNUC__
-# define LCFG_COMPUTED_GOTO 1
-#else
-# define LCFG_COMPUTED_GOTO 0
-#endif 
+    public:
+        Channel() : waiters_( 0 ) {}
 
+        // for RunProgram, see ChannelEmpty
+        bool recvNow( Stack& s )
+        {
+            Value v;
+            if (!tryRecv( v ))
+                return false;
+            poke();
+            s.push( std::move(v) );
+            return true;
+        }
 
-    
-DLLEXPORT void RunProgram(   
-    Thread* pThread,
-    const Ast::Program* inprog,
-    SHAREDUPVALUE inupvalues
-)
-{
-// ~~~todo: save initial upvalue, destroy when closing program?
-restartNonTail:
-    pThread->callframe =
-        new (pThread->rcAlloc_.allocate(sizeof(RunContext)))
-        RunContext( pThread, TMPFACT_PROG_TO_RUNPROG(inprog), inupvalues );
-restartThread:
-    pThread->callframe->thread = pThread;
-    Stack& stack = pThread->stack;
-restartReturn:
-    RunContext& frame = *(pThread->callframe);
-restartTco:
+        // for RunProgram, see ChannelFull
+        bool sendNow( const Value& v )
+        {
+            if (!trySend( v ))
+                return false;
+            poke();
+            return true;
+        }
 
-#if LCFG_COMPUTED_GOTO     
-# define OPCODE_LOC(op) OPCODE_START_##op
-# define OPCODE_2LOC(pre,op) OPCODE_START_##pre##op
-# define OPCODE_END() \
-    do { /*std::cerr << "Exec instr=" << (*frame.ppInstr)->instr_ << std::endl; */ \
-            pInstr = *(frame.ppInstr++); \
-            goto *dispatch_table[pInstr->instr_]; } while (0)
-#else
-# define OPCODE_LOC(op) case Ast::Base::op
-# define OPCODE_2LOC(pre,op) OPCODE_START_##pre##op
-# define OPCODE_END() break
-#endif
+        void send( const Value& v )
+        {
+            if (!trySend( v ))
+                wait( [&]() { return trySend( v ); }, "channel is full" );
+            poke();
+        }
 
+        Value recv()
+        {
+            Value v;
+            if (!tryRecv( v ))
+                wait( [&]() { return tryRecv( v ); }, "channel is empty" );
+            poke();
+            return v;
+        }
 
-#if LCFG_COMPUTED_GOTO
+        virtual void apply( Stack& s ) { recvOrThrow( s ); }
 
-    static void* const dispatch_table[] = {
-        &&OPCODE_LOC(kUnk),
-        &&OPCODE_LOC(kBreakProg),
-        &&OPCODE_LOC(kCloseValue),
-        &&OPCODE_LOC(kApply),
-        &&OPCODE_LOC(kMove),
-        &&OPCODE_LOC(kApplyProgram),
-        &&OPCODE_LOC(kApplyFunRec),
-        &&OPCODE_LOC(kApplyThingAndValue2ValueOperator),
-        &&OPCODE_LOC(kApplyIndexOperator),
-        &&OPCODE_LOC(kIncrement),
-        &&OPCODE_LOC(kIncrementReg),
-        &&OPCODE_LOC(kIncrementReg2Reg),
-        &&OPCODE_LOC(kIfElse),
-#if LCFG_HAVE_TRY_CATCH        
-        &&OPCODE_LOC(kTryCatch),
-        &&OPCODE_LOC(kThrow),
-#else
-        0,
-        0,
-#endif 
-        &&OPCODE_LOC(kTCOApply),
-        &&OPCODE_LOC(kTCOApplyProgram),
-        &&OPCODE_LOC(kTCOApplyFunRec),
-        &&OPCODE_LOC(kTCOIfElse),
-        &&OPCODE_LOC(kMakeCoroutine),
-        &&OPCODE_LOC(kYieldCoroutine),
-        &&OPCODE_LOC(kEofMarker)
-    };
-#endif 
-    
-    const Ast::Base* pInstr;
-    try
-    {
-        //const Ast::Base* const ** pppInstr = &(frame.ppInstr);
-        //for ( ;true; ++*pppInstr)
-        while (true)
+        void customOperator( const bangstring& op, Stack& s )
         {
-            pInstr = *(frame.ppInstr++);
-            // std::cerr << "Exec instr=" << pInstr->instr_ << std::endl;
-#if LCFG_COMPUTED_GOTO
-            goto *dispatch_table[pInstr->instr_];
-            do {
-#else
-            switch (pInstr->instr_) {
-#endif 
-            OPCODE_LOC(kUnk):
-                    pInstr->run( stack, frame );
-            OPCODE_END();
+            const static Bang::bangstring opSend("/send");
+            const static Bang::bangstring opRecv("/recv");
+            const static Bang::bangstring opTryRecv("/try-recv");
+            const static Bang::bangstring opRecvAll("/recv-all");
 
-                OPCODE_LOC(kCloseValue):
-                    frame.upvalues_ =
-                        NEW_UPVAL
-                        (   reinterpret_cast<const Ast::CloseValue*>(pInstr),
-                            frame.upvalues_,
-                            stack.pop()
-                        );
-                OPCODE_END();
-            
-//                dobreakprog:
-                OPCODE_LOC(kTCOApplyFunRec):
+            if (op == opSend)
+                sendOrThrow( s.pop() );
+            else if (op == opRecv)
+                recvOrThrow( s );
+            else if (op == opTryRecv)
+            {
+                Value v;
+                if (tryRecv( v ))
                 {
-                    // no dynamic cast, should be safe since we know the type from instr_
-//                    std::cerr << "got kTCOApplyFunRec" << std::endl;
-                    const Ast::PushFunctionRec* afn = reinterpret_cast<const Ast::PushFunctionRec*>(pInstr);
-                    frame.rebind
-                    (  TMPFACT_PROG_TO_RUNPROG(afn->pRecFun_),
-                        (afn->nthparent_ == kNoParent) ? SHAREDUPVALUE() : frame.nthBindingParent( afn->nthparent_ )
-                    );
-                    goto restartTco;
+                    poke();
+                    s.push( std::move(v) );
+                    s.push( true );
                 }
-                OPCODE_END();
-
-            OPCODE_LOC(kMove):
-                {
-                    const Ast::Move& move = *reinterpret_cast<const Ast::Move*>(pInstr);
-                    
-                    switch (move.dest_)
-                    {
-                        case kSrcStack: { switch (move.src_.v1src_) {
-                                case kSrcUpval:   Mover<kSrcUpval,kSrcStack>  ::domove( move, move.src_, pThread, frame, stack ); break;
-                                case kSrcLiteral: Mover<kSrcLiteral,kSrcStack>::domove( move, move.src_, pThread, frame, stack ); break;
-                            } break; } break;
-                        case kSrcRegister: { switch (move.src_.v1src_) {
-                                case kSrcUpval:   Mover<kSrcUpval,kSrcRegister>  ::domove( move, move.src_, pThread, frame, stack ); break;
-                                case kSrcLiteral: Mover<kSrcLiteral,kSrcRegister>::domove( move, move.src_, pThread, frame, stack ); break;
-                            } break; } break;
-                        case kSrcRegisterBool: { switch (move.src_.v1src_) {
-                                case kSrcUpval:   Mover<kSrcUpval,kSrcRegisterBool>  ::domove( move, move.src_, pThread, frame, stack ); break;
-                                case kSrcLiteral: Mover<kSrcLiteral,kSrcRegisterBool>::domove( move, move.src_, pThread, frame, stack ); break;
-                            } break; } break;
-                        case kSrcCloseValue: { switch (move.src_.v1src_) {
-                                case kSrcUpval:   Mover<kSrcUpval,kSrcCloseValue>  ::domove( move, move.src_, pThread, frame, stack ); break;
-                                case kSrcLiteral: Mover<kSrcLiteral,kSrcCloseValue>::domove( move, move.src_, pThread, frame, stack ); break;
-                            } break; } break;
-                    }
+                else
+                    s.push( false );
             }
-            OPCODE_END();
-            
-            OPCODE_LOC(kApplyThingAndValue2ValueOperator):
+            else if (op == opRecvAll)
+            {
+                Value v;
+                bool any = false;
+                while (tryRecv( v ))
                 {
-//                     static void* dispatch_table_tav2v = { &&OPCODE_2LOC(tav2v,kSrcStack), 0, 0, 0,
-//                                          &&OPCODE_2LOC(tav2v,kSrcRegister),
-//                                          &&OPCODE_2LOC(tav2v,kSrcRegisterBool),
-//                                          &&OPCODE_2LOC(tav2v,kSrcCloseValue) };
-                    const Ast::ApplyThingAndValue2ValueOperator& pa = *reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(pInstr);
-//                    goto *dispatch_table_tav2v[pa.dest_];
-                    switch (pa.dest_)
-                    {
-                        case kSrcStack:        ApplyThingValueCall<kSrcStack>       ::docall( stack, pThread, frame, pa ); break;
-                        case kSrcRegister:     ApplyThingValueCall<kSrcRegister>    ::docall( stack, pThread, frame, pa ); break;
-                        case kSrcRegisterBool: ApplyThingValueCall<kSrcRegisterBool>::docall( stack, pThread, frame, pa ); break;
-                        case kSrcCloseValue:   ApplyThingValueCall<kSrcCloseValue>  ::docall( stack, pThread, frame, pa ); break;
-                    }
+                    s.push( std::move(v) );
+                    any = true;
                 }
-            OPCODE_END();
+                if (any)
+                    poke();
+            }
+            else
+                Function::customOperator( op, s );
+        }
+    };
 
-            
-                OPCODE_LOC(kBreakProg):
+    // a ring of cells, each with a sequence number saying whether it's
+    // waiting to be written or read, and on which lap (Vyukov's MPMC queue).
+    // Senders and receivers each claim a position with a compare-exchange.
+    // Sequence numbers count in twos, 2*pos to be written and 2*pos+1 to be
+    // read, so they can't mix up the two even with only the one cell.
+    class BoundedChannel : public Channel
+    {
+        struct Cell
+        {
+            std::atomic<size_t> seq;
+            Value v;
+        };
+        const size_t size_;
+        std::unique_ptr<Cell[]> cells_;
+        std::atomic<size_t> sendPos_;
+        std::atomic<size_t> recvPos_;
+
+    protected:
+        virtual bool trySend( const Value& v )
+        {
+            size_t pos = sendPos_.load( std::memory_order_relaxed );
+            for (;;)
+            {
+                Cell& cell = cells_[pos % size_];
+                const intptr_t lap = intptr_t(cell.seq.load( std::memory_order_acquire )) - intptr_t(2 * pos);
+                if (lap == 0)
                 {
-                    RunContext* prev = frame.prev;
-                    frame.~RunContext();
-                    pThread->rcAlloc_.deallocate( &frame, sizeof(RunContext) );
-                    pThread->callframe = prev;
-                    if (prev)
-                        goto restartReturn;
-                    else if (pThread->pCaller)
-                    {
-                        xferstack( pThread, pThread->pCaller );
-                        pThread = pThread->pCaller;
-                        goto restartThread;
-                    }
-                    else
+                    if (sendPos_.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ))
                     {
-//                        std::cerr << "exiting prog stack=" << &(pThread->stack) <<  " stksize=" << pThread->stack.size() << "\n";
-                        return;
+                        cell.v = v;
+                        cell.seq.store( 2 * pos + 1, std::memory_order_release );
+                        return true;
                     }
                 }
+                else if (lap < 0)
+                    return false; // full
+                else
+                    pos = sendPos_.load( std::memory_order_relaxed );
+            }
+        }
 
-            OPCODE_LOC(kYieldCoroutine):
-                    if (pThread->pCaller)
+        virtual bool tryRecv( Value& v )
+        {
+            size_t pos = recvPos_.load( std::memory_order_relaxed );
+            for (;;)
+            {
+                Cell& cell = cells_[pos % size_];
+                const intptr_t lap = intptr_t(cell.seq.load( std::memory_order_acquire )) - intptr_t(2 * pos + 1);
+                if (lap == 0)
+                {
+                    if (recvPos_.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ))
                     {
-                        if (reinterpret_cast<const Ast::YieldCoroutine*>(pInstr)->shouldXferstack())
-                            xferstack( pThread, pThread->pCaller );
-                        pThread = pThread->pCaller;
-                        goto restartThread;
+                        v = std::move( cell.v );
+                        cell.v = Value();
+                        cell.seq.store( 2 * (pos + size_), std::memory_order_release );
+                        return true;
                     }
-                    else
-                        return; // nowhere to go
+                }
+                else if (lap < 0)
+                    return false; // empty
+                else
+                    pos = recvPos_.load( std::memory_order_relaxed );
+            }
+        }
 
-                
+    public:
+        BoundedChannel( size_t size )
+        : size_( size ), cells_( new Cell[size] ), sendPos_( 0 ), recvPos_( 0 )
+        {
+            for (size_t i = 0; i < size_; ++i)
+                cells_[i].seq.store( 2 * i, std::memory_order_relaxed );
+        }
+    };
 
-        OPCODE_LOC(kEofMarker):
-                {
-                    auto pEof = reinterpret_cast<const Ast::EofMarker*>(pInstr);
-                    pEof->repl_prompt(stack);
+    // a linked list that senders add to by swapping the tail, so sending
+    // never fails or waits (Vyukov's MPSC queue).  That only allows one
+    // receiver at a time, so receivers take the head under a lock.
+    class UnboundedChannel : public Channel
+    {
+        struct Node
+        {
+            std::atomic<Node*> next;
+            Value v;
+            Node() : next( nullptr ) {}
+        };
+        std::atomic<Node*> tail_;
+        Node* head_; // always a node already taken, or the first stub
+#if LCFG_MT_SAFEISH
+        std::mutex receiving_;
+#endif 
+
+    protected:
+        virtual bool trySend( const Value& v )
+        {
+            Node* node = new Node;
+            node->v = v;
+            Node* prev = tail_.exchange( node, std::memory_order_acq_rel );
+            prev->next.store( node, std::memory_order_release );
+            return true;
+        }
+
+        virtual bool tryRecv( Value& v )
+        {
+#if LCFG_MT_SAFEISH
+            std::lock_guard<std::mutex> g( receiving_ );
+#endif 
+            Node* head = head_;
+            // a sender between its swap and its link looks the same as empty
+            Node* next = head->next.load( std::memory_order_acquire );
+            if (!next)
+                return false;
+            v = std::move( next->v );
+            next->v = Value();
+            head_ = next;
+            delete head;
+            return true;
+        }
+
+    public:
+        UnboundedChannel()
+        : tail_( new Node ), head_( tail_.load() )
+        {}
+        ~UnboundedChannel()
+        {
+            while (head_)
+            {
+                Node* next = head_->next.load();
+                delete head_;
+                head_ = next;
+            }
+        }
+    };
+}
+
+namespace Primitives {
+    // fun spawn! -- runs fun on the worker pool, pushing a task; applying
+    // that, or join!ing it, waits and pushes what fun left on its stack
+    void spawn( Stack& s, const RunContext& rc )
+    {
+        const Value& v = s.pop();
+        if (!v.isboundfun() && !v.isfun())
+            throw std::runtime_error("spawn requires a function");
+        const auto& task = NEW_BANGFUN(SpawnedFunction, v);
+        Bang::spawn( task.get() );
+        s.push( STATIC_CAST_TO_BANGFUN(task) );
+    }
+
+    void join( Stack& s, const RunContext& rc )
+    {
+        const Value& v = s.pop();
+        Task* task = v.isfun() ? dynamic_cast<Task*>( v.tofun().get() ) : nullptr;
+        if (!task)
+            throw std::runtime_error("join requires a task, see spawn");
+        task->join( s );
+    }
+
+    // ( fun = ...; fun = ...; fork! ) -- runs every function above the
+    // bound at once on the worker pool, the last one right here, each on an
+    // empty stack of its own; once they've all finished, pushes what each
+    // left, in order.  If any threw, the first one's error is rethrown.
+    // What they close over is shared, not copied, so an array or hash they
+    // can reach has to be frozen first; fork throws otherwise.
+    void fork( Stack& s, const RunContext& rc )
+    {
+        std::vector< gcptr<SpawnedFunction> > tasks( s.size() );
+        std::vector<const Function*> seen;
+        for (size_t i = tasks.size(); i-- > 0; )
+        {
+            const Value& v = s.pop();
+            if (!v.isboundfun() && !v.isfun())
+                throw std::runtime_error("fork requires functions");
+            if (!Bang::shareable( v, seen ))
+                throw std::runtime_error("fork: a function can reach an array or hash that isn't frozen, see freeze");
+            tasks[i] = NEW_BANGFUN(SpawnedFunction, v);
+        }
+        if (tasks.empty())
+            return;
+        // this thread's frames, which earlier work left on its free list,
+        // would otherwise be kept for however long the forks take
+        rc.thread->rcAlloc_.trim();
+
+        for (size_t i = 0; i + 1 < tasks.size(); ++i)
+            Bang::spawn( tasks[i].get() );
+        tasks.back()->run();
+
+        Stack results;
+        std::exception_ptr error;
+        for (const auto& task : tasks)
+        {
+            try
+            {
+                task->join( results );
+            }
+            catch (...)
+            {
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+        if (error)
+            std::rethrow_exception( error );
+        results.giveTo( s );
+    }
+
+    // n channel! -- a channel holding up to n values (/send waits when
+    // it's full), or any number for 0.  v c/send, c/recv (or c!) waits
+    // for a value, c/try-recv pushes v true or just false, c/recv-all
+    // pushes whatever's there
+    void channel( Stack& s, const RunContext& rc )
+    {
+        const Value& v = s.pop();
+        if (!v.isnum() || v.tonum() < 0)
+            throw std::runtime_error("channel requires a size, 0 for unbounded");
+        const size_t size = size_t( v.tonum() );
+        if (size > 0)
+        {
+            const auto& chan = NEW_BANGFUN(BoundedChannel, size);
+            s.push( STATIC_CAST_TO_BANGFUN(chan) );
+        }
+        else
+        {
+            const auto& chan = NEW_BANGFUN(UnboundedChannel);
+            s.push( STATIC_CAST_TO_BANGFUN(chan) );
+        }
+    }
+
+    // v freeze! -- leaves v, made deeply immutable (see Bang::freeze) so
+    // spawned functions and forks can all read it for free.  /set, /push
+    // and the like throw on it from then on.
+    void freeze( Stack& s, const RunContext& rc )
+    {
+        if (s.size() < 1)
+            throw std::runtime_error("freeze requires a value");
+        Bang::freeze( s.loc_top() );
+    }
+}
+
+
+
+    
+    
+
+
+        BoundProgram::BoundProgram( const Ast::Program* program, SHAREDUPVALUE_CREF upvalues )
+        : // Function(true),
+          program_( program ), upvalues_( upvalues )
+        {
+//             for (int i = 0; i < 16; ++i)
+//                 uvcache[i].v = nullptr;
+        }
+    
+        void BoundProgram::dump( std::ostream & out )
+        {
+            program_->dump( 0, std::cerr );
+        }
+    
+    void throwNoFunVal( const Ast::Base* pInstr, const Value& v )
+    {
+        std::ostringstream oss;
+        oss << pInstr->where();
+        oss << ": " << typeid(*pInstr).name() << ": Called apply without function.2; found type=" << v.type() << " V=";
+        v.dump(oss);
+        throw std::runtime_error(oss.str());
+    }
+
+//SimplestAllocator<RunContext> gAllocRc;
+
+
+    void Thread::setcallin(Thread*caller)
+    {
+        if (!callframe)
+        {
+            // maybe this should just be done in constructor.
+            
+            // start me off pointing at the BoundProgram, ready to roll
+            // no dynamic cast for quickness. responsibility of caller to insure passed Function is a BoundFunction.
+            BoundProgram* pbound = reinterpret_cast<BoundProgram*>( boundProg_.get() );
+
+            this->callframe =
+                new (this->rcAlloc_.allocate(sizeof(RunContext)))
+                RunContext( this, TMPFACT_PROG_TO_RUNPROG(pbound->program_), pbound->upvalues_ );
+        }
+
+        //~~~ i think this is not quite right.  what if i'm called multiple times from separate threads;
+        // then yield out to intermediate callers; when i'm done, who do i return to?  I shouldn't return
+        // to the last caller (to whom I returned control via yield), but maybe there should be a caller
+        // stack or something, such that when I yield I pop off the last caller.  Or no, maybe it shouldn't
+        // matter; because I always return to the last person who resumed me, so I think this is correct.
+        // perhaps there should be something to e.g., set pCaller to nullptr after I yield back to that
+        // caller at least.
+        pCaller = caller;
+    }
+    
+    RunContext::RunContext( Thread* inthread, const Ast::Base* const *inppInstr, SHAREDUPVALUE_CREF uv )
+    :  thread(inthread),
+       prev(inthread->callframe),
+       ppInstr( inppInstr ), // , /*initialupvalues(uv),*/
+       upvalues_( uv ),
+       borrowed_( false ),
+       leafDepth_( inthread->leafCallers_.size() )
+#if LCFG_HAVE_TRY_CATCH      
+    ,catcher(nullptr)
+#endif 
+     {}
+
+    RunContext::RunContext( Thread* inthread, const Ast::Base* const *inppInstr, Upvalue* borrowed )
+    :  thread(inthread),
+       prev(inthread->callframe),
+       ppInstr( inppInstr ),
+       borrowed_( true ),
+       leafDepth_( inthread->leafCallers_.size() )
+#if LCFG_HAVE_TRY_CATCH      
+    ,catcher(nullptr)
+#endif 
+     {
+         upvalues_.adopt( borrowed );
+     }
+    
+void RunApplyValue( const Ast::Base* pInstr, const Value& v, Stack& stack, const RunContext& frame )
+{
+    switch (v.type())
+    {
+        case Value::kFun: { auto f = v.tofun(); f->apply(stack); } break;
+        case Value::kFunPrimitive: v.tofunprim()( stack, frame ); break;
+        default: throwNoFunVal(pInstr, v);
+    }
+}
+    
+void xferstack( Thread* from, Thread* to )
+{
+    from->stack.giveTo( to->stack );
+}
+
+DLLEXPORT Thread* Thread::nullthread() { return &isolateState().nullThread; }
+
+    // Threads whose coroutines are done with, kept for the next ones along
+    // with their stacks' and frame allocator's memory, so a program making
+    // lots of short lived coroutines isn't mostly malloc.  One pool per OS
+    // thread, chained through pCaller; a coroutine made on one worker and
+    // dropped on another just changes pools.
+    namespace {
+        class ThreadPool
+        {
+            enum { kKeep = 1024 };     // threads
+            enum { kKeepStack = 256 }; // values of stack capacity
+            Thread* free_;
+            unsigned count_;
+        public:
+            enum { kInitialStack = 8 };
+            static thread_local bool gone_; // past ~ThreadPool at OS thread exit
+
+            ThreadPool() : free_( nullptr ), count_( 0 ) {}
+            ~ThreadPool()
+            {
+                gone_ = true;
+                while (free_)
+                {
+                    Thread* t = free_;
+                    free_ = t->pCaller;
+                    delete t;
+                }
+            }
+
+            static ThreadPool& mine()
+            {
+                static thread_local ThreadPool pool;
+                return pool;
+            }
+
+            Thread* get()
+            {
+                Thread* t = free_;
+                if (t)
+                {
+                    free_ = t->pCaller;
+                    t->pCaller = nullptr;
+                    --count_;
+                }
+                return t;
+            }
+
+            bool put( Thread* t )
+            {
+                if (count_ >= kKeep)
+                    return false;
+                t->stack.recycle( kKeepStack );
+                t->pCaller = free_;
+                free_ = t;
+                ++count_;
+                return true;
+            }
+        };
+        thread_local bool ThreadPool::gone_ = false;
+    }
+
+    DLLEXPORT bangthreadptr_t Thread::make( BANGFUNPTR boundProg )
+    {
+        Thread* t = ThreadPool::gone_ ? nullptr : ThreadPool::mine().get();
+        if (t)
+        {
+            t->isolate_ = &Isolate::current();
+            t->boundProg_ = std::move( boundProg );
+        }
+        else
+        {
+            t = new Thread( std::move( boundProg ) );
+            t->stack.reserve( ThreadPool::kInitialStack );
+        }
+        return bangthreadptr_t( t );
+    }
+
+    // Drops everything the coroutine was holding on to, then pools it.  One
+    // abandoned partway through still has frames out, so it just goes.
+    DLLEXPORT void Thread::recycle()
+    {
+        if (callframe || !leafCallers_.empty() || ThreadPool::gone_)
+        {
+            delete this;
+            return;
+        }
+        if (altstack_)
+            altstack_->recycle( 0 );
+        boundProg_.reset();
+        recvFrom_.reset();
+        sendTo_.reset();
+        sendValue_ = Value();
+        r0_ = Value();
+        rb0_ = false;
+        if (cse_)
+            std::fill( cse_.get(), cse_.get() + Ast::CseRead::kRegs, Value() );
+        if (closures_)
+            std::fill( closures_.get(), closures_.get() + CachedClosure::kSlots, CachedClosure() );
+        if (!ThreadPool::mine().put( this ))
+            delete this;
+    }
+
+    // one dropped partway through a leaf call still holds its callers'
+    // environments, see UnwindLeafCalls
+    DLLEXPORT Thread::~Thread()
+    {
+        for (const LeafCaller& caller : leafCallers_)
+            if (!caller.borrowed && caller.upvalues)
+                caller.upvalues->unref();
+    }
+
+#if !LCFG_GCPTR_STD
+    DLLEXPORT void GCDeleter<Thread>::deleter( Thread* thread )
+    {
+        thread->recycle();
+    }
+#endif 
+
+    template <ESourceDest esd> struct DestSet {};
+    template <> struct DestSet<kSrcStack>        { static inline void set( const Ast::ValueMaker& pa, Thread* pThread, RunContext& frame, Stack& stack, const Value& vv ) { stack.push(vv); }
+                                                   static inline void set( const Ast::ValueMaker& pa, Thread* pThread, RunContext& frame, Stack& stack, const Value&& vv ) { stack.push(std::move(vv)); }
+    };
+    template <> struct DestSet<kSrcRegister>     { static inline void set( const Ast::ValueMaker& pa, Thread* pThread, RunContext& frame, Stack& stack, const Value& vv ) { pThread->r0_ = vv; }
+                                                   static inline void set( const Ast::ValueMaker& pa, Thread* pThread, RunContext& frame, Stack& stack, const Value&& vv ) { pThread->r0_ = std::move(vv); }
+    }; 
+    template <> struct DestSet<kSrcRegisterBool> { static inline void set( const Ast::ValueMaker& pa, Thread* pThread, RunContext& frame, Stack& stack, const Value& vv ) { pThread->rb0_ = vv.tobool(); } };
+    template <> struct DestSet<kSrcCloseValue>   { static inline void set( const Ast::ValueMaker& pa, Thread* pThread, RunContext& frame, Stack& stack, const Value& vv ) {
+        frame.close( NEW_UPVAL( pa.cv_, frame.upvalues_, vv ) );
+    } };
+
+    template <ESourceDest esd> struct SrcGet {};
+    template <> struct SrcGet<kSrcLiteral>  { static inline const Bang::Value& get( const Ast::ValueEater& pa, Thread* pThread, RunContext& frame ) { return pa.v1literal_; } };
+    template <> struct SrcGet<kSrcRegister> { static inline const Bang::Value& get( const Ast::ValueEater& pa, Thread* pThread, RunContext& frame ) { return pThread->r0_; }  };
+    template <> struct SrcGet<kSrcUpval>    { static inline const Bang::Value& get( const Ast::ValueEater& pa, Thread* pThread, RunContext& frame ) { return FRVE2UV(frame, pa); } }; // frame.getUpValue( pa.v1uvnumber_ ); } };
+    template <> struct SrcGet<kSrcStack>    { static inline Bang::Value get( const Ast::ValueEater& pa, Thread* pThread, RunContext& frame ) { return pThread->stack.pop(); } };
+    
+    template <ESourceDest esd> struct Invoke2n2OperatorWithThingFrom {
+        static inline Bang::Value getAndCall( const Ast::ApplyThingAndValue2ValueOperator& pa, Thread* pThread, RunContext& frame, Stack& stack ) {
+            switch( pa.secondsrc_.v1src_ ) {
+                case kSrcUpval:    return SrcGet<esd>::get(pa,pThread,frame).applyAndValue2Value( pa.openum_, SrcGet<kSrcUpval>   ::get( pa.secondsrc_, pThread, frame ) );
+                case kSrcRegister: return SrcGet<esd>::get(pa,pThread,frame).applyAndValue2Value( pa.openum_, SrcGet<kSrcRegister>::get( pa.secondsrc_, pThread, frame ) );
+                case kSrcLiteral:  return SrcGet<esd>::get(pa,pThread,frame).applyAndValue2Value( pa.openum_, SrcGet<kSrcLiteral> ::get( pa.secondsrc_, pThread, frame ) );
+                default:           return SrcGet<esd>::get(pa,pThread,frame).applyAndValue2Value( pa.openum_, SrcGet<kSrcStack>   ::get( pa.secondsrc_, pThread, frame ) );
+            }
+        }
+    };
+    
+    template <> struct Invoke2n2OperatorWithThingFrom<kSrcStack> {
+        static inline Bang::Value getAndCall( const Ast::ApplyThingAndValue2ValueOperator& pa, Thread* pThread, RunContext& frame, Stack& stack ) {
+            const Bang::Value& owner = stack.pop();
+            switch( pa.secondsrc_.v1src_ ) {
+                case kSrcUpval:    return owner.applyAndValue2Value( pa.openum_, SrcGet<kSrcUpval>   ::get( pa.secondsrc_, pThread, frame ) );
+                case kSrcRegister: return owner.applyAndValue2Value( pa.openum_, SrcGet<kSrcRegister>::get( pa.secondsrc_, pThread, frame ) );
+                case kSrcLiteral:  return owner.applyAndValue2Value( pa.openum_, SrcGet<kSrcLiteral> ::get( pa.secondsrc_, pThread, frame ) );
+                default:           return owner.applyAndValue2Value( pa.openum_, SrcGet<kSrcStack>   ::get( pa.secondsrc_, pThread, frame ) );
+            }
+        }
+    };
+    
+    template <> struct Invoke2n2OperatorWithThingFrom<kSrcLiteral> {
+        static inline Bang::Value getAndCall( const Ast::ApplyThingAndValue2ValueOperator& pa, Thread* pThread, RunContext& frame, Stack& stack ) {
+            switch( pa.secondsrc_.v1src_ ) {
+                case kSrcUpval:    return pa.thingliteralop_( pa.v1literal_, SrcGet<kSrcUpval>   ::get( pa.secondsrc_, pThread, frame ) );
+                case kSrcRegister: return pa.thingliteralop_( pa.v1literal_, SrcGet<kSrcRegister>::get( pa.secondsrc_, pThread, frame ) );
+                case kSrcLiteral:  return pa.thingliteralop_( pa.v1literal_, SrcGet<kSrcLiteral> ::get( pa.secondsrc_, pThread, frame ) );
+                default:           return pa.thingliteralop_( pa.v1literal_, SrcGet<kSrcStack>   ::get( pa.secondsrc_, pThread, frame ) );
+            }
+        }
+    };
+
+#if LCFG_HAVE_TAV_SWAP
+            // i think a better implementation would be to have a distinct Ast::Swap()
+            // instruction, then the optimizer could remove it when followed by a dual ValueEater 
+            // except where both Values are coming from the stack.  if both values come from the stack
+            // then the Ast::Swap() instruction is left in place.
+            if (pa.argSwap_)
+            {
+                switch( pa.secondsrc_.v1src_ ) {
+                    case kSrcUpval:    return FRVE2UV(frame, pa.secondsrc_) .applyAndValue2Value( pa.openum_, FRATAV2VUV(frame,pa) );
+                    case kSrcRegister: return pThread->r0_                  .applyAndValue2Value( pa.openum_, FRATAV2VUV(frame,pa)  );
+                    case kSrcLiteral:  return pa.secondsrc_.v1literal_      .applyAndValue2Value( pa.openum_, FRATAV2VUV(frame,pa) );
+                    default:           return stack.pop()                   .applyAndValue2Value( pa.openum_, FRATAV2VUV(frame,pa) );
+                }
+            }
+            else
+#endif
+    
+    template< ESourceDest eThingSource, ESourceDest eValueDest >
+    struct ThingValueOperatorFetchFromSaveTo
+    {
+        static inline void apply(  Stack& stack, Thread* pThread, RunContext& frame, const Ast::ApplyThingAndValue2ValueOperator& pa )
+        {
+            DestSet<eValueDest>::set( pa, pThread, frame, stack, Invoke2n2OperatorWithThingFrom<eThingSource>::getAndCall( pa, pThread, frame, stack ) );
+        }
+    };
+
+    /* this is pretty horribly worse than the plain inline version with MSVC; it's *nearly* as good with GCC, but
+     * still not quite.  I guess I should be happy that it comes anywhere near close. As much as I like the
+     * theory of "use templates, not preprocessor" I guess compilers still aren't quite as smart as human
+     * crafted syntax expansions. */
+    template< ESourceDest edst >
+    struct ApplyThingValueCall
+    {
+        static inline void docall( Stack& stack, Thread* pThread, RunContext& frame, const Ast::ApplyThingAndValue2ValueOperator& pa )
+        {
+            switch (pa.v1src_)
+            {
+                case kSrcUpval:    ThingValueOperatorFetchFromSaveTo<kSrcUpval,edst>   ::apply( stack, pThread, frame, pa ); break;
+                case kSrcStack:    ThingValueOperatorFetchFromSaveTo<kSrcStack,edst>   ::apply( stack, pThread, frame, pa ); break;
+                case kSrcLiteral:  ThingValueOperatorFetchFromSaveTo<kSrcLiteral,edst> ::apply( stack, pThread, frame, pa ); break;
+                case kSrcRegister: ThingValueOperatorFetchFromSaveTo<kSrcRegister,edst>::apply( stack, pThread, frame, pa ); break;
+            }
+        }
+    };
+
+    
+    template <ESourceDest source, ESourceDest dest> struct Mover {
+        static inline void domove( const Ast::ValueMaker& vm, const Ast::ValueEater& ve, Thread* pThread, RunContext& frame, Stack& stack ) { 
+            DestSet<dest>::set( vm, pThread, frame, stack, SrcGet<source>::get( ve, pThread, frame ) );
+        }
+    };
+
+//     template <ESourceDest source, ESourceDest dest> struct Incrementer {
+//         static void domove( const Ast::ValueMaker& vm, const Ast::ValueEater& ve, Thread* pThread, RunContext& frame, Stack& stack ) { 
+//             DestSet<dest>::set( vm, pThread, frame, stack, SrcGet<source>::get( ve, pThread, frame ).tonum() + 1 );
+//         }
+//     };
+    
+
+    // the bodies of the simple (non control-transfer) instructions; shared
+    // between RunProgram and the native code the JIT makes
+    inline void RunMove( const Ast::Move& move, Thread* pThread, RunContext& frame, Stack& stack )
+    {
+        const Ast::ValueEater& src = move.source();
+        switch (move.dest_)
+        {
+            case kSrcStack: { switch (src.v1src_) {
+                    case kSrcUpval:   Mover<kSrcUpval,kSrcStack>  ::domove( move, src, pThread, frame, stack ); break;
+                    case kSrcLiteral: Mover<kSrcLiteral,kSrcStack>::domove( move, src, pThread, frame, stack ); break;
+                } break; } break;
+            case kSrcRegister: { switch (src.v1src_) {
+                    case kSrcUpval:   Mover<kSrcUpval,kSrcRegister>  ::domove( move, src, pThread, frame, stack ); break;
+                    case kSrcLiteral: Mover<kSrcLiteral,kSrcRegister>::domove( move, src, pThread, frame, stack ); break;
+                } break; } break;
+            case kSrcRegisterBool: { switch (src.v1src_) {
+                    case kSrcUpval:   Mover<kSrcUpval,kSrcRegisterBool>  ::domove( move, src, pThread, frame, stack ); break;
+                    case kSrcLiteral: Mover<kSrcLiteral,kSrcRegisterBool>::domove( move, src, pThread, frame, stack ); break;
+                } break; } break;
+            case kSrcCloseValue: { switch (src.v1src_) {
+                    case kSrcUpval:   Mover<kSrcUpval,kSrcCloseValue>  ::domove( move, src, pThread, frame, stack ); break;
+                    case kSrcLiteral: Mover<kSrcLiteral,kSrcCloseValue>::domove( move, src, pThread, frame, stack ); break;
+                } break; } break;
+        }
+    }
+
+    inline void RunThingAndValue2Value( const Ast::ApplyThingAndValue2ValueOperator& pa, Thread* pThread, RunContext& frame, Stack& stack )
+    {
+        switch (pa.dest_)
+        {
+            case kSrcStack:        ApplyThingValueCall<kSrcStack>       ::docall( stack, pThread, frame, pa ); break;
+            case kSrcRegister:     ApplyThingValueCall<kSrcRegister>    ::docall( stack, pThread, frame, pa ); break;
+            case kSrcRegisterBool: ApplyThingValueCall<kSrcRegisterBool>::docall( stack, pThread, frame, pa ); break;
+            case kSrcCloseValue:   ApplyThingValueCall<kSrcCloseValue>  ::docall( stack, pThread, frame, pa ); break;
+        }
+    }
+
+#if LCFG_LICM
+    inline void RunLoopInvariant( const Ast::LoopInvariant& li, Thread* pThread, RunContext& frame, Stack& stack );
+#endif 
+
+#if LCFG_NUMEXPR
+    inline void RunNumExpr( const Ast::NumExpr& ne, Thread* pThread, RunContext& frame, Stack& stack )
+    {
+        double r[Ast::NumExpr::kMaxRegs];
+        bool allnums = stack.size() >= ne.stackIn_;
+        unsigned l = 0;
+        for (unsigned k = 0; allnums && k <= ne.ops_.size(); ++k)
+        {
+            for (; allnums && l < ne.leaves_.size() && ne.leaves_[l].at == k; ++l)
+            {
+                const Ast::NumExpr::Leaf& leaf = ne.leaves_[l];
+                const Value* v;
+                switch (leaf.src.v1src_)
+                {
+                    case kSrcStack:    v = &stack.nth( leaf.stackIndex ); break;
+                    case kSrcUpval:    v = &FRVE2UV( frame, leaf.src ); break;
+                    case kSrcRegister: v = &pThread->r0_; break;
+                    default:           v = &leaf.src.v1literal_; break;
+                }
+                allnums = v->isnum();
+                r[leaf.reg] = v->tonum();
+            }
+            if (!allnums || k == ne.ops_.size())
+                break;
+            const Ast::NumExpr::Op& op = ne.ops_[k];
+            switch (op.op)
+            {
+                case kOpPlus:  r[op.dst] = r[op.other] + r[op.thing]; break;
+                case kOpMinus: r[op.dst] = r[op.other] - r[op.thing]; break;
+                case kOpMult:  r[op.dst] = r[op.other] * r[op.thing]; break;
+                default:       r[op.dst] = r[op.other] / r[op.thing]; break;
+            }
+        }
+        if (!allnums)
+        {
+            for (const Ast::Base* op : ne.origOps_)
+            {
+                if (op->instr_ == Ast::Base::kMove)
+                    RunMove( *reinterpret_cast<const Ast::Move*>(op), pThread, frame, stack );
+#if LCFG_LICM
+                else if (op->instr_ == Ast::Base::kLoopInvariant)
+                    RunLoopInvariant( *reinterpret_cast<const Ast::LoopInvariant*>(op), pThread, frame, stack );
+#endif 
+                else
+                    RunThingAndValue2Value( *reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(op), pThread, frame, stack );
+            }
+            return;
+        }
+
+        for (int i = 0; i < ne.stackIn_; ++i)
+            stack.pop_back();
+        for (const Ast::NumExpr::Out& out : ne.outs_)
+        {
+            switch (out.dest.dest_)
+            {
+                case kSrcStack:      stack.push( r[out.reg] ); break;
+                case kSrcRegister:   pThread->r0_ = r[out.reg]; break;
+                case kSrcCloseValue: DestSet<kSrcCloseValue>::set( out.dest, pThread, frame, stack, Value( r[out.reg] ) ); break;
+                default: break;
+            }
+        }
+    }
+#endif 
+
+#if LCFG_NUMSPEC
+    bool Ast::NumSpecEntry::eval( std::vector<double>& regs, size_t base, const double* outer, int depth ) const
+    {
+        if (depth > kMaxDepth)
+            return false;
+        if (regs.size() < base + 2 * nRegs_)
+            regs.resize( 2 * (base + 2 * nRegs_) ); // room for the callee too
+        double* r = &regs[base];
+        const Instr* const code = &code_[0];
+        for (int pc = 0; ; ++pc)
+        {
+            const Instr& in = code[pc];
+            switch (in.op)
+            {
+                case kConst: r[in.dst] = in.k; break;
+                case kOuter: r[in.dst] = outer[in.a]; break;
+                case kMove:  r[in.dst] = r[in.a]; break;
+                case kAdd:   r[in.dst] = r[in.a] + r[in.b]; break;
+                case kSub:   r[in.dst] = r[in.a] - r[in.b]; break;
+                case kMul:   r[in.dst] = r[in.a] * r[in.b]; break;
+                case kDiv:   r[in.dst] = r[in.a] / r[in.b]; break;
+                case kLt:    r[in.dst] = r[in.a] < r[in.b]; break;
+                case kGt:    r[in.dst] = r[in.a] > r[in.b]; break;
+                case kEq:    r[in.dst] = r[in.a] == r[in.b]; break;
+                case kAnd:   r[in.dst] = r[in.a] != 0 && r[in.b] != 0; break;
+                case kOr:    r[in.dst] = r[in.a] != 0 || r[in.b] != 0; break;
+                case kJumpIfNot:
+                    if (r[in.a] == 0)
+                        pc = in.dst - 1;
+                    break;
+                case kJump:
+                    pc = in.dst - 1;
+                    break;
+                case kLoop:
+                {
+                    double args[kMaxParams];
+                    for (int i = 0; i < nParams_; ++i)
+                        args[i] = r[lists_[in.a + i]];
+                    for (int i = 0; i < nParams_; ++i)
+                        r[i] = args[i];
+                    pc = -1;
+                }
+                break;
+                case kCall:
+                {
+                    const size_t callee = base + nRegs_;
+                    for (int i = 0; i < nParams_; ++i)
+                        regs[callee + i] = r[lists_[in.a + i]];
+                    if (!eval( regs, callee, outer, depth + 1 ))
+                        return false;
+                    r = &regs[base];
+                    for (unsigned i = 0; i < outIsBool_.size(); ++i)
+                        r[lists_[in.a + nParams_ + i]] = regs[callee + i];
+                }
+                break;
+                case kReturn:
+                {
+                    double outs[kMaxOuts];
+                    for (unsigned i = 0; i < outIsBool_.size(); ++i)
+                        outs[i] = r[lists_[in.a + i]];
+                    for (unsigned i = 0; i < outIsBool_.size(); ++i)
+                        r[i] = outs[i];
+                    return true;
+                }
+            }
+        }
+    }
+
+    // true if the specialized clone ran; the generic body is to be skipped
+    inline bool RunNumSpec( const Ast::NumSpecEntry& spec, RunContext& frame, Stack& stack )
+    {
+        static thread_local std::vector<double> regs;
+        const int k = spec.nParams_;
+        if (spec.disabled_.load( std::memory_order_relaxed ) || stack.size() < k)
+            return false;
+        double outer[Ast::NumSpecEntry::kMaxOuter];
+        for (unsigned j = 0; j < spec.outer_.size(); ++j)
+        {
+            const Upvalue* env = frame.upvalues_.get();
+            if (!env)
+                return false;
+            const Value& v = env->getUpValue( spec.outer_[j] );
+            if (!v.isnum())
+                return false;
+            outer[j] = v.tonum();
+        }
+        if (regs.size() < size_t(spec.nRegs_))
+            regs.resize( 2 * spec.nRegs_ );
+        for (int i = 0; i < k; ++i)
+        {
+            const Value& v = stack.nth( k - 1 - i );
+            if (!v.isnum())
+                return false;
+            regs[i] = v.tonum();
+        }
+        if (!spec.eval( regs, 0, outer, 0 ))
+        {
+            spec.disabled_.store( true, std::memory_order_relaxed );
+            return false;
+        }
+        for (int i = 0; i < k; ++i)
+            stack.pop_back();
+        for (unsigned i = 0; i < spec.outIsBool_.size(); ++i)
+        {
+            if (spec.outIsBool_[i])
+                stack.push( regs[i] != 0 );
+            else
+                stack.push( regs[i] );
+        }
+        return true;
+    }
+#endif 
+
+#if LCFG_LICM
+    inline void RunHoistInvariant( const Ast::HoistInvariant& h, Thread* pThread, RunContext& frame, Stack& stack )
+    {
+        for (const Ast::ValueEater& in : h.inputs_)
+        {
+            if (!FRVE2UV( frame, in ).isnum())
+            {
+                frame.close( NEW_UPVAL( h.cv_, frame.upvalues_, Value() ) );
+                return;
+            }
+        }
+#if LCFG_NUMEXPR
+        if (h.expr_->instr_ == Ast::Base::kNumExpr)
+            RunNumExpr( *reinterpret_cast<const Ast::NumExpr*>(h.expr_), pThread, frame, stack );
+        else
+#endif 
+            RunThingAndValue2Value( *reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(h.expr_), pThread, frame, stack );
+    }
+
+    inline void RunLoopInvariant( const Ast::LoopInvariant& li, Thread* pThread, RunContext& frame, Stack& stack )
+    {
+        const Value& v = FRVE2UV( frame, li.src_ );
+        if (v.isnum() || v.isbool())
+        {
+            switch (li.dest_)
+            {
+                case kSrcStack:        stack.push( v ); break;
+                case kSrcRegister:     pThread->r0_ = v; break;
+                case kSrcRegisterBool: pThread->rb0_ = v.tobool(); break;
+                case kSrcCloseValue:   DestSet<kSrcCloseValue>::set( li, pThread, frame, stack, v ); break;
+                default: break;
+            }
+            return;
+        }
+#if LCFG_NUMEXPR
+        if (li.orig_->instr_ == Ast::Base::kNumExpr)
+            RunNumExpr( *reinterpret_cast<const Ast::NumExpr*>(li.orig_), pThread, frame, stack );
+        else
+#endif 
+            RunThingAndValue2Value( *reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(li.orig_), pThread, frame, stack );
+    }
+#endif 
+
+#if DOT_OPERATOR_INLINE
+    inline void RunIndexOperator( const Ast::ApplyIndexOperator& op, Thread* pThread, RunContext& frame, Stack& stack )
+    {
+        const Ast::ValueEater& index = op.indexValue();
+        switch (op.v1src_)
+        {
+            case kSrcUpval:
+            {
+                const Value& owner = FRVE2UV(frame, op); 
+                switch (index.sourceType())
+                {
+                    case kSrcLiteral:  owner.applyIndexOperator( index.v1literal_, stack, frame ); break;
+                    case kSrcStack:    owner.applyIndexOperator( stack.pop(), stack, frame ); break;
+                    case kSrcUpval:    owner.applyIndexOperator( FRVE2UV(frame, index), stack, frame ); break;
+                    case kSrcRegister: owner.applyIndexOperator( frame.thread->r0_, stack, frame ); break;
+                    default: break;
+                }
+            }
+            break;
+                        
+            case kSrcStack:
+            {
+                const Value& owner = stack.pop();
+                switch (index.sourceType())
+                {
+                    case kSrcLiteral:  owner.applyIndexOperator( index.v1literal_, stack, frame ); break;
+                    case kSrcStack:    owner.applyIndexOperator( stack.pop(), stack, frame ); break;
+                    case kSrcUpval:    owner.applyIndexOperator( FRVE2UV(frame, index ), stack, frame ); break;
+                    case kSrcRegister: owner.applyIndexOperator( frame.thread->r0_, stack, frame ); break;
+                    default: break;
+                }
+            }
+            break;
+                        
+            case kSrcAltStack:
+            {
+                const Value& owner = pThread->altstack().pop();
+                switch (index.sourceType())
+                {
+                    case kSrcLiteral:  owner.applyIndexOperator( index.v1literal_, stack, frame ); break;
+                    case kSrcStack:    owner.applyIndexOperator( stack.pop(), stack, frame ); break;
+                    case kSrcUpval:    owner.applyIndexOperator( FRVE2UV(frame, index), stack, frame ); break;
+                    case kSrcRegister: owner.applyIndexOperator( frame.thread->r0_, stack, frame ); break;
+                    default: break;
+                }
+            }
+            break;
+        }
+    }
+#endif
+
+#if LCFG_X64JIT
+    void RunHotLoop( const Ast::PushFunctionRec* afn, Stack& stack, RunContext& frame );
+    void RecompileSegment( const Ast::JitSegment& seg, const Ast::Base* const* instrs );
+#endif 
+
+#if LCFG_INPLACE_PARAMS
+    short Ast::Program::findParamsEnd() const
+    {
+        LATE_COMPILE_LOCK;
+        const short found = paramsEnd_.load( std::memory_order_acquire );
+        if (found >= 0) // another thread got here first
+            return found;
+        const astList_t& ast = *getAst();
+        unsigned i = 0;
+        // NumSpecEntry and JitSegment only speed up what follows them, so
+        // going on past them is fine
+        while (i < ast.size() && (ast[i]->instr_ == kNumSpecEntry || ast[i]->instr_ == kJitSegment))
+            ++i;
+        int n = 0;
+        for (; i < ast.size() && ast[i]->instr_ == kCloseValue; ++i)
+            ++n;
+        const bool fits = n > 0 && n <= 8 && i < ast.size() && i < 0x7fff;
+        const short end = fits ? i : 0;
+        nParams_.store( fits ? n : 0, std::memory_order_relaxed );
+        paramsEnd_.store( end, std::memory_order_release );
+        return end;
+    }
+
+    // A tail call to a function whose environment is the one the frame's
+    // parameter bindings hang off -- a loop calling itself, as range! and
+    // times! do -- would let go of those bindings and make the same ones
+    // with new values.  If nothing else holds on to them (or to the locals
+    // bound after them), the values are just overwritten instead.  False,
+    // with nothing changed, when it can't do that.
+    bool RebindParamsInPlace( const Ast::PushFunctionRec* afn, RunContext& frame, Stack& stack )
+    {
+        if (frame.borrowed_)
+            return false;
+        int k;
+        const Ast::Base* const* resume = afn->recFun()->paramsEnd( k );
+        if (!resume || stack.size() < k)
+            return false;
+        int n = 0; // bindings between here and the callee's environment
+        if (afn->bindingParent() == kNoParent)
+        {
+            for (const Upvalue* uv = frame.upvalues_.get(); uv; uv = uv->parent_.get())
+                ++n;
+        }
+        else
+            n = afn->bindingParent().toint();
+        if (n < k)
+            return false;
+
+        Upvalue* params[8] = {};
+        Upvalue* uv = frame.upvalues_.get();
+        for (int d = 0; d < n; ++d, uv = uv->parent_.get())
+        {
+            if (uv->refcount() != 1)
+                return false;
+            if (d >= n - k)
+            {
+                // made by the callee's own parameter bindings, in order
+                const int j = n - 1 - d;
+                if (uv->upvalParseChain() != resume[j - k])
+                    return false;
+                params[j] = uv;
+            }
+        }
+        if (n > k)
+            frame.upvalues_ = params[k - 1]; // the locals go
+        for (int j = 0; j < k; ++j)
+            params[j]->v_ = stack.pop();
+        frame.ppInstr = resume;
+        return true;
+    }
+#endif 
+
+#if __GNUC__
+# define LCFG_COMPUTED_GOTO 1
+#else
+# define LCFG_COMPUTED_GOTO 0
+#endif 
+
+
+#if LCFG_LEAFCALL
+// runs a leaf program in this frame instead of a new one, see LeafReturn
+#define LEAF_CALL(prog,uv) \
+                if (const Ast::Base* const* leaf = (prog)->leafEntry()) \
+                { \
+                    SHAREDUPVALUE leafuv = (uv); \
+                    pThread->leafCallers_.push_back( LeafCaller{ frame.ppInstr, frame.upvalues_.release(), frame.borrowed_ } ); \
+                    frame.upvalues_ = std::move( leafuv ); \
+                    frame.borrowed_ = false; \
+                    frame.ppInstr = leaf; \
+                    goto restartTco; \
+                }
+
+#if LCFG_HAVE_TRY_CATCH
+// Puts frame back the way it was before the leaf calls still running in it,
+// as their LeafReturns would have, when an exception throws them away.
+static void UnwindLeafCalls( Thread* pThread, RunContext& frame )
+{
+    std::vector<LeafCaller>& callers = pThread->leafCallers_;
+    while (callers.size() > frame.leafDepth_)
+    {
+        const LeafCaller& caller = callers.back();
+        frame.ppInstr = caller.ppInstr;
+        if (frame.borrowed_)
+            frame.upvalues_.release();
+        frame.upvalues_.adopt( caller.upvalues );
+        frame.borrowed_ = caller.borrowed;
+        callers.pop_back();
+    }
+}
+#endif 
+#else
+#define LEAF_CALL(prog,uv)
+#endif 
+
+// Non-tail calls.  CALL_OWNING takes a reference to the callee's
+// environment; CALL_BORROWING is for one the caller keeps alive anyway (its
+// own, a parent of it, or a closure bound in it), which the callee's frame
+// then borrows.
+#define CALL_OWNING(prog,uv) \
+                LEAF_CALL( prog, uv ); \
+                inprog = (prog); \
+                inupvalues = (uv); \
+                goto restartNonTail
+#if LCFG_BORROWED_ENV
+# if LCFG_LEAFCALL
+#  define LEAF_CALL_BORROWING(prog,uv) \
+                if (const Ast::Base* const* leaf = (prog)->leafEntry()) \
+                { \
+                    Upvalue* leafuv = (uv); \
+                    pThread->leafCallers_.push_back( LeafCaller{ frame.ppInstr, frame.upvalues_.release(), frame.borrowed_ } ); \
+                    frame.upvalues_.adopt( leafuv ); \
+                    frame.borrowed_ = true; \
+                    frame.ppInstr = leaf; \
+                    goto restartTco; \
+                }
+# else
+#  define LEAF_CALL_BORROWING(prog,uv)
+# endif 
+# define CALL_BORROWING(prog,uv) \
+                LEAF_CALL_BORROWING( prog, uv ); \
+                inprog = (prog); \
+                inborrowed = (uv); \
+                goto restartBorrowed
+#else
+# define CALL_BORROWING(prog,uv) CALL_OWNING( prog, SHAREDUPVALUE(uv) )
+#endif 
+
+    
+DLLEXPORT void RunProgram(   
+    Thread* pThread,
+    const Ast::Program* inprog,
+    SHAREDUPVALUE inupvalues
+)
+{
+    // coroutines resumed from here are all in the same isolate
+    Isolate::Enter isolate( pThread->isolate_ );
+#if LCFG_BORROWED_ENV
+    Upvalue* inborrowed;
+#endif 
+// ~~~todo: save initial upvalue, destroy when closing program?
+restartNonTail:
+    pThread->callframe =
+        new (pThread->rcAlloc_.allocate(sizeof(RunContext)))
+        RunContext( pThread, TMPFACT_PROG_TO_RUNPROG(inprog), inupvalues );
+#if LCFG_BORROWED_ENV
+    goto restartThread;
+restartBorrowed:
+    pThread->callframe =
+        new (pThread->rcAlloc_.allocate(sizeof(RunContext)))
+        RunContext( pThread, TMPFACT_PROG_TO_RUNPROG(inprog), inborrowed );
+#endif 
+restartThread:
+    pThread->callframe->thread = pThread;
+    Stack& stack = pThread->stack;
+    if (pThread->sendTo_)
+    {
+        // resumed in the middle of a /send, see ChannelFull
+        Channel* chan = static_cast<Channel*>( pThread->sendTo_.get() );
+        if (chan->sendNow( pThread->sendValue_ ))
+            pThread->sendTo_.reset();
+        else if (pThread->pCaller)
+        {
+            pThread = pThread->pCaller;
+            goto restartThread;
+        }
+        else
+        {
+            chan->send( pThread->sendValue_ );
+            pThread->sendTo_.reset();
+        }
+        pThread->sendValue_ = Value();
+    }
+    else if (pThread->recvFrom_)
+    {
+        // resumed in the middle of a /recv, see ChannelEmpty
+        Channel* chan = static_cast<Channel*>( pThread->recvFrom_.get() );
+        if (chan->recvNow( stack ))
+            pThread->recvFrom_.reset();
+        else if (pThread->pCaller)
+        {
+            pThread = pThread->pCaller;
+            goto restartThread;
+        }
+        else
+        {
+            stack.push( chan->recv() );
+            pThread->recvFrom_.reset();
+        }
+    }
+restartReturn:
+    RunContext& frame = *(pThread->callframe);
+restartTco:
+
+#if LCFG_COMPUTED_GOTO     
+# define OPCODE_LOC(op) OPCODE_START_##op
+# define OPCODE_2LOC(pre,op) OPCODE_START_##pre##op
+# define OPCODE_END() \
+    do { /*std::cerr << "Exec instr=" << (*frame.ppInstr)->instr_ << std::endl; */ \
+            pInstr = *(frame.ppInstr++); \
+            goto *dispatch_table[pInstr->instr_]; } while (0)
+#else
+# define OPCODE_LOC(op) case Ast::Base::op
+# define OPCODE_2LOC(pre,op) OPCODE_START_##pre##op
+# define OPCODE_END() break
+#endif
+
+
+#if LCFG_COMPUTED_GOTO
+
+    static void* const dispatch_table[] = {
+        &&OPCODE_LOC(kUnk),
+        &&OPCODE_LOC(kBreakProg),
+        &&OPCODE_LOC(kCloseValue),
+        &&OPCODE_LOC(kApply),
+        &&OPCODE_LOC(kMove),
+        &&OPCODE_LOC(kApplyProgram),
+        &&OPCODE_LOC(kApplyFunRec),
+        &&OPCODE_LOC(kApplyThingAndValue2ValueOperator),
+        &&OPCODE_LOC(kApplyIndexOperator),
+        &&OPCODE_LOC(kIncrement),
+        &&OPCODE_LOC(kIncrementReg),
+        &&OPCODE_LOC(kIncrementReg2Reg),
+        &&OPCODE_LOC(kIfElse),
+#if LCFG_HAVE_TRY_CATCH        
+        &&OPCODE_LOC(kTryCatch),
+        &&OPCODE_LOC(kThrow),
+#else
+        0,
+        0,
+#endif 
+        &&OPCODE_LOC(kTCOApply),
+        &&OPCODE_LOC(kTCOApplyProgram),
+        &&OPCODE_LOC(kTCOApplyFunRec),
+        &&OPCODE_LOC(kTCOIfElse),
+        &&OPCODE_LOC(kMakeCoroutine),
+        &&OPCODE_LOC(kYieldCoroutine),
+#if LCFG_NUMEXPR
+        &&OPCODE_LOC(kNumExpr),
+#else
+        0,
+#endif 
+#if LCFG_NUMSPEC
+        &&OPCODE_LOC(kNumSpecEntry),
+#else
+        0,
+#endif 
+#if LCFG_LICM
+        &&OPCODE_LOC(kHoistInvariant),
+        &&OPCODE_LOC(kLoopInvariant),
+#else
+        0,
+        0,
+#endif 
+#if LCFG_X64JIT
+        &&OPCODE_LOC(kJitSegment),
+#else
+        0,
+#endif 
+        &&OPCODE_LOC(kEofMarker)
+    };
+#endif 
+    
+    const Ast::Base* pInstr;
+    try
+    {
+        //const Ast::Base* const ** pppInstr = &(frame.ppInstr);
+        //for ( ;true; ++*pppInstr)
+        while (true)
+        {
+            pInstr = *(frame.ppInstr++);
+            // std::cerr << "Exec instr=" << pInstr->instr_ << std::endl;
+#if LCFG_COMPUTED_GOTO
+            goto *dispatch_table[pInstr->instr_];
+            do {
+#else
+            switch (pInstr->instr_) {
+#endif 
+            OPCODE_LOC(kUnk):
+                    pInstr->run( stack, frame );
+            OPCODE_END();
+
+                OPCODE_LOC(kCloseValue):
+                    frame.close
+                    (   NEW_UPVAL
+                        (   reinterpret_cast<const Ast::CloseValue*>(pInstr),
+                            frame.upvalues_,
+                            stack.pop()
+                        )
+                    );
+                OPCODE_END();
+            
+//                dobreakprog:
+                OPCODE_LOC(kTCOApplyFunRec):
+                {
+                    // no dynamic cast, should be safe since we know the type from instr_
+//                    std::cerr << "got kTCOApplyFunRec" << std::endl;
+                    const Ast::PushFunctionRec* afn = reinterpret_cast<const Ast::PushFunctionRec*>(pInstr);
+#if LCFG_X64JIT
+                    if (pThread->isolate_->state().jit)
+                        RunHotLoop( afn, stack, frame );
+#endif 
+#if LCFG_INPLACE_PARAMS
+                    if (RebindParamsInPlace( afn, frame, stack ))
+                        goto restartTco;
+#endif 
+#if LCFG_BORROWED_ENV
+                    // a parent of a borrowed environment outlives it
+                    if (frame.borrowed_)
+                    {
+                        frame.rebindBorrowed
+                        (   TMPFACT_PROG_TO_RUNPROG(afn->pRecFun_),
+                            (afn->nthparent_ == kNoParent) ? nullptr : frame.nthBindingParent( afn->nthparent_ ).get()
+                        );
+                        goto restartTco;
+                    }
+#endif 
+                    frame.rebind
+                    (  TMPFACT_PROG_TO_RUNPROG(afn->pRecFun_),
+                        (afn->nthparent_ == kNoParent) ? SHAREDUPVALUE() : frame.nthBindingParent( afn->nthparent_ )
+                    );
+                    goto restartTco;
+                }
+                OPCODE_END();
+
+            OPCODE_LOC(kMove):
+                RunMove( *reinterpret_cast<const Ast::Move*>(pInstr), pThread, frame, stack );
+            OPCODE_END();
+            
+            OPCODE_LOC(kApplyThingAndValue2ValueOperator):
+                RunThingAndValue2Value( *reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(pInstr), pThread, frame, stack );
+            OPCODE_END();
+
+            
+                OPCODE_LOC(kBreakProg):
+                {
+#if LCFG_LEAFCALL
+                    if (pInstr == &Ast::LeafReturn::instance)
+                    {
+                        const LeafCaller& caller = pThread->leafCallers_.back();
+                        frame.ppInstr = caller.ppInstr;
+                        if (frame.borrowed_)
+                            frame.upvalues_.release();
+                        frame.upvalues_.adopt( caller.upvalues );
+                        frame.borrowed_ = caller.borrowed;
+                        pThread->leafCallers_.pop_back();
+                        goto restartTco;
+                    }
+#endif 
+                    RunContext* prev = frame.prev;
+                    frame.~RunContext();
+                    pThread->rcAlloc_.deallocate( &frame, sizeof(RunContext) );
+                    pThread->callframe = prev;
+                    if (prev)
+                        goto restartReturn;
+                    else if (pThread->pCaller)
+                    {
+                        xferstack( pThread, pThread->pCaller );
+                        pThread = pThread->pCaller;
+                        goto restartThread;
+                    }
+                    else
+                    {
+//                        std::cerr << "exiting prog stack=" << &(pThread->stack) <<  " stksize=" << pThread->stack.size() << "\n";
+                        return;
+                    }
+                }
+
+            OPCODE_LOC(kYieldCoroutine):
+                    if (pThread->pCaller)
+                    {
+                        if (reinterpret_cast<const Ast::YieldCoroutine*>(pInstr)->shouldXferstack())
+                            xferstack( pThread, pThread->pCaller );
+                        pThread = pThread->pCaller;
+                        goto restartThread;
+                    }
+                    else
+                        return; // nowhere to go
+
+                
+
+        OPCODE_LOC(kEofMarker):
+                {
+                    auto pEof = reinterpret_cast<const Ast::EofMarker*>(pInstr);
+                    pEof->repl_prompt(stack);
 
                     while (true)
                     {
-                        try
-                        {
-                            SHAREDUPVALUE_CREF uv = frame.upvalues_;
-                            Ast::Program *pProgram = pEof->getNextProgram( uv ); //
-                            if (pProgram)
-                            {
-                                frame.rebind( TMPFACT_PROG_TO_RUNPROG(pProgram) );
-                                //~~~ okay this is tricky, because if there's an execute error on a REPL, I'd
-                                // really like to go back to the same context (preserve upvalues) but I sort
-                                // of lose that information if I'm doing TCO, which I'd like to do because don't
-                                // burn stack frames in the REPL.  I almost have to add the upvalue chain to the
-                                // exception or something.  Or preserve the upvalue prior to reading the
-                                // next line, ie, if I close values in the line, and then it crashes, do I have
-                                // those values in the chain?  I guess I probably should, since the stack is modified.
-                                // so whatever the uv chain is at the time of the crash should be preserved for the
-                                // next statement
-                                goto restartTco;
-                            }
-                            else
-                            {
-                                // std::cerr << "doing break prog\n";
-                                // should i just return here, like yield does?  Does it matter?
-                                // goto dobreakprog;
-                                // return seems to work better, not sure i understand it 100% yay.
-                                // hitting ; to break scope blows up hmm
-                                return;
-                            }
-                        }
-                        catch (const std::exception& ) // parse error
-                        {
-                            //~~~ @todo: shouldn't I dump this here?  reportError or something?
-                            pEof->repl_prompt(stack);
+                        try
+                        {
+                            SHAREDUPVALUE_CREF uv = frame.upvalues_;
+                            Ast::Program *pProgram = pEof->getNextProgram( uv ); //
+                            if (pProgram)
+                            {
+                                frame.rebind( TMPFACT_PROG_TO_RUNPROG(pProgram) );
+                                //~~~ okay this is tricky, because if there's an execute error on a REPL, I'd
+                                // really like to go back to the same context (preserve upvalues) but I sort
+                                // of lose that information if I'm doing TCO, which I'd like to do because don't
+                                // burn stack frames in the REPL.  I almost have to add the upvalue chain to the
+                                // exception or something.  Or preserve the upvalue prior to reading the
+                                // next line, ie, if I close values in the line, and then it crashes, do I have
+                                // those values in the chain?  I guess I probably should, since the stack is modified.
+                                // so whatever the uv chain is at the time of the crash should be preserved for the
+                                // next statement
+                                goto restartTco;
+                            }
+                            else
+                            {
+                                // std::cerr << "doing break prog\n";
+                                // should i just return here, like yield does?  Does it matter?
+                                // goto dobreakprog;
+                                // return seems to work better, not sure i understand it 100% yay.
+                                // hitting ; to break scope blows up hmm
+                                return;
+                            }
+                        }
+                        catch (const std::exception& ) // parse error
+                        {
+                            //~~~ @todo: shouldn't I dump this here?  reportError or something?
+                            pEof->repl_prompt(stack);
+                        }
+                    }
+                }
+        OPCODE_END();
+
+            OPCODE_LOC(kMakeCoroutine):
+                    Ast::MakeCoroutine::go( stack, pThread );
+            OPCODE_END();
+
+#if LCFG_NUMEXPR
+            OPCODE_LOC(kNumExpr):
+                RunNumExpr( *reinterpret_cast<const Ast::NumExpr*>(pInstr), pThread, frame, stack );
+            OPCODE_END();
+#endif 
+
+#if LCFG_NUMSPEC
+            OPCODE_LOC(kNumSpecEntry):
+                {
+                    const Ast::NumSpecEntry* spec = reinterpret_cast<const Ast::NumSpecEntry*>(pInstr);
+                    if (RunNumSpec( *spec, frame, stack ))
+                        frame.ppInstr += spec->skip_; // on to the BreakProg
+                }
+            OPCODE_END();
+#endif 
+
+#if LCFG_LICM
+            OPCODE_LOC(kHoistInvariant):
+                RunHoistInvariant( *reinterpret_cast<const Ast::HoistInvariant*>(pInstr), pThread, frame, stack );
+            OPCODE_END();
+
+            OPCODE_LOC(kLoopInvariant):
+                RunLoopInvariant( *reinterpret_cast<const Ast::LoopInvariant*>(pInstr), pThread, frame, stack );
+            OPCODE_END();
+#endif 
+
+#if LCFG_X64JIT
+            OPCODE_LOC(kJitSegment):
+                {
+                    const Ast::JitSegment* seg = reinterpret_cast<const Ast::JitSegment*>(pInstr);
+                    // if it has been evicted, the instructions it covered follow
+                    if (seg->code_.enter())
+                    {
+                        const int failed = seg->native()( pThread, &frame );
+                        seg->code_.leave();
+                        if (failed < 0)
+                            frame.ppInstr += seg->length_;
+                        else
+                        {
+                            // leave the pc where the interpreter would have it
+                            frame.ppInstr += failed + 1;
+                            Ast::JitSegment::rethrow();
+                        }
+                    }
+                    else if (seg->recompiles_.load( std::memory_order_relaxed ) < Ast::JitSegment::kMaxRecompiles
+                        && seg->misses_.fetch_add( 1, std::memory_order_relaxed ) + 1 == Ast::JitSegment::kRecompileAfter)
+                    {
+                        RecompileSegment( *seg, frame.ppInstr ); // already past seg
+                    }
+                }
+            OPCODE_END();
+#endif 
+
+            OPCODE_LOC(kApplyFunRec):
+                {
+                    const Ast::PushFunctionRec* afn = reinterpret_cast<const Ast::PushFunctionRec*>(pInstr);
+                    CALL_BORROWING( afn->pRecFun_, (afn->nthparent_ == kNoParent) ? nullptr : frame.nthBindingParent( afn->nthparent_ ).get() );
+                }
+                OPCODE_END();
+                
+            OPCODE_LOC(kTCOIfElse):
+                {
+                    const Ast::IfElse* ifelse = reinterpret_cast<const Ast::IfElse*>(pInstr);
+                    const Ast::Program* p = ifelse->branchTaken(*pThread);
+                    if (p)
+                    {
+                        frame.rebind( TMPFACT_PROG_TO_RUNPROG(p) );
+                        goto restartTco;
+                    }
+                }
+                OPCODE_END();
+
+            OPCODE_LOC(kIfElse):
+                {
+                    const Ast::IfElse* ifelse = reinterpret_cast<const Ast::IfElse*>(pInstr);
+                    const Ast::Program* p = ifelse->branchTaken(*pThread);
+                    if (p)
+                    {
+                        CALL_BORROWING( p, frame.upvalues_.get() );
+                    }
+                }
+                OPCODE_END();
+
+#if LCFG_HAVE_TRY_CATCH                
+            OPCODE_LOC(kTryCatch):
+                {
+                    const Ast::TryCatch* trycatch = reinterpret_cast<const Ast::TryCatch*>(pInstr);
+                    const Ast::Program* p = trycatch->try_; 
+                    inprog = p;
+                    inupvalues = frame.upvalues_;
+                    
+                    pThread->callframe =
+                        new (pThread->rcAlloc_.allocate(sizeof(RunContext)))
+                        RunContext( pThread, TMPFACT_PROG_TO_RUNPROG(inprog), inupvalues );
+
+                    pThread->callframe->catcher = trycatch->catch_;
+                    
+                    goto restartThread;
+                }
+                OPCODE_END();
+
+            OPCODE_LOC(kThrow):
+                {
+                    RunContext *pframe = &frame;
+
+                    while (pframe && !pframe->catcher)
+                    {
+                        RunContext* prev = pframe->prev;
+//                        std::cerr << "tossing frame, frame=" << pframe << " prev=" << prev << std::endl;
+#if LCFG_LEAFCALL
+                        UnwindLeafCalls( pThread, *pframe );
+#endif 
+                        pframe->~RunContext();
+                        pThread->rcAlloc_.deallocate( pframe, sizeof(RunContext) );
+                        pframe = prev;
+                    }
+                    
+                    if (pframe && pframe->catcher)
+                    {
+                        pThread->callframe = pframe;
+//                        std::cerr << "running catch block frame, frame=" << pframe << std::endl;
+#if LCFG_LEAFCALL
+                        UnwindLeafCalls( pThread, *pframe );
+#endif 
+                        pframe->rebind( TMPFACT_PROG_TO_RUNPROG(pframe->catcher), inupvalues );
+                        goto restartReturn;
+                    }
+                    else
+                    {
+                        throw AstExecFail( *(frame.ppInstr), "Unhandled exception" ); // ;e.what() );
+//                        bangerr() << 
+                    }
+                }
+                OPCODE_END();
+#endif
+
+            OPCODE_LOC(kIncrement):
+                {
+#if LCFG_TRYJIT
+                    const Ast::Increment& move = *reinterpret_cast<const Ast::Increment*>(pInstr);
+                    double v2 = move.f_op( (void*)frame.upvalues_.get() ); // , (void*)pThread ); //  + 1;
+                    switch (move.dest_)
+                    {
+                        case kSrcStack:      DestSet<kSrcStack>::set( move, pThread, frame, stack, Value( v2 ) ); break;
+                        case kSrcRegister:   DestSet<kSrcRegister>::set( move, pThread, frame, stack, Value( v2 ) ); break;
+                        case kSrcCloseValue: DestSet<kSrcCloseValue>::set( move, pThread, frame, stack, Value( v2 ) ); break;
+                    }
+#endif 
+                }
+                OPCODE_END();
+
+            OPCODE_LOC(kIncrementReg):
+                {
+#if LCFG_TRYJIT
+                    const Ast::Increment& move = *reinterpret_cast<const Ast::Increment*>(pInstr);
+                    double v2 = move.f_op( pThread ); // , (void*)pThread ); //  + 1;v = SrcGet<kSrcUpval>  ::get( move, pThread, frame ).tonum(); break;
+                    switch (move.dest_)
+                    {
+                        case kSrcStack:      DestSet<kSrcStack>::set( move, pThread, frame, stack, Value( v2 ) ); break;
+                        case kSrcRegister:   DestSet<kSrcRegister>::set( move, pThread, frame, stack, Value( v2 ) ); break;
+                        case kSrcCloseValue: DestSet<kSrcCloseValue>::set( move, pThread, frame, stack, Value( v2 ) ); break;
+                    }
+#endif 
+                }
+                OPCODE_END();
+
+            OPCODE_LOC(kIncrementReg2Reg):
+                {
+#if LCFG_TRYJIT
+                    const Ast::Increment& move = *reinterpret_cast<const Ast::Increment*>(pInstr);
+                    move.f_op_void( pThread, frame.upvalues_.get() ); // , (void*)pThread ); //  + 1;v = SrcGet<kSrcUpval>  ::get( move, pThread, frame ).tonum(); break;
+//                     switch (move.dest_)
+//                     {
+//                         case kSrcStack:      DestSet<kSrcStack>::set( move, pThread, frame, stack, Value( v2 ) ); break;
+//                         case kSrcRegister:   DestSet<kSrcRegister>::set( move, pThread, frame, stack, Value( v2 ) ); break;
+//                         case kSrcCloseValue: DestSet<kSrcCloseValue>::set( move, pThread, frame, stack, Value( v2 ) ); break;
+//                     }
+#endif 
+                }
+                OPCODE_END();
+
+                
+        OPCODE_LOC(kTCOApplyProgram):
+                {
+                    const Ast::Program* afn = reinterpret_cast<const Ast::Program*>(pInstr); 
+                    frame.rebind( TMPFACT_PROG_TO_RUNPROG(afn) );
+                    goto restartTco;
+                }
+            OPCODE_END();
+
+            OPCODE_LOC(kApplyProgram):
+                {
+                    const Ast::Program* afn = reinterpret_cast<const Ast::Program*>(pInstr);
+                    CALL_BORROWING( afn, frame.upvalues_.get() );
+                }
+            OPCODE_END();
+
+#define KTHREAD_CASE \
+                case Value::kThread: { auto other = v.tothread().get(); other->setcallin(pThread); xferstack(pThread,other); pThread = other; goto restartThread; }
+                
+                /* 150629 Coroutine issue:  Currently, coroutine yield returns to creating thread, not calling thread. */
+
+#if DOT_OPERATOR_INLINE
+            OPCODE_LOC(kApplyIndexOperator):
+                RunIndexOperator( *reinterpret_cast<const Ast::ApplyIndexOperator*>(pInstr), pThread, frame, stack );
+            OPCODE_END();
+#endif 
+                
+            OPCODE_LOC(kTCOApply):
+                {
+                    auto op = reinterpret_cast<const Ast::Apply*>(pInstr);
+                    switch( op->v1src_ )
+                    {
+                        case kSrcStack:
+                        {
+                            const Value& v = stack.pop();
+                            switch (v.type())
+                            {
+                                default: RunApplyValue( pInstr, v, stack, frame ); break;
+                                    //~~~ should this setcallin? as with KTHREAD_CASE? or is it intentionally different
+                                case Value::kThread: { auto other = v.tothread().get(); xferstack(pThread,other); pThread = other; goto restartThread; }
+                                case Value::kBoundFun:
+                                    auto pbound = v.toboundfunhold();
+                                    frame.rebind( TMPFACT_PROG_TO_RUNPROG(pbound->program_), pbound->upvalues_ );
+                                    goto restartTco;
+                            }
+                        }
+                        break;
+                        case kSrcUpval:
+                        {
+                            const Value& v = FRVE2UV(frame, *op);
+                            switch (v.type())
+                            {
+                                default: RunApplyValue( pInstr, v, stack, frame ); break;
+                                    //~~~ should this setcallin? as with KTHREAD_CASE? or is it intentionally different
+                                case Value::kThread: { auto other = v.tothread().get(); xferstack(pThread,other); pThread = other; goto restartThread; }
+                                case Value::kBoundFun:
+#if LCFG_BORROWED_ENV
+                                    // bound in a borrowed environment, so it outlives this frame
+                                    if (frame.borrowed_)
+                                    {
+                                        auto pbound = v.toboundfun();
+                                        frame.rebindBorrowed( TMPFACT_PROG_TO_RUNPROG(pbound->program_), pbound->upvalues_.get() );
+                                        goto restartTco;
+                                    }
+#endif 
+                                    auto pbound = v.toboundfunhold();
+                                    frame.rebind( TMPFACT_PROG_TO_RUNPROG(pbound->program_), pbound->upvalues_ );
+                                    goto restartTco;
+                            }
+                        }
+                        break;
+                    }
+                }
+            OPCODE_END();
+
+            OPCODE_LOC(kApply):
+                {
+                    auto op = reinterpret_cast<const Ast::Apply*>(pInstr);
+                    switch( op->v1src_ )
+                    {
+                        case kSrcStack:
+                        {
+                            const Value& v = stack.pop();
+                            switch (v.type())
+                            {
+                                default: RunApplyValue( pInstr, v, stack, frame ); break;
+                                    KTHREAD_CASE    
+                                case Value::kBoundFun:
+                                auto pbound = v.toboundfun();
+                                CALL_OWNING( pbound->program_, pbound->upvalues_ );
+                            }
+                        }
+                        break;
+                        case kSrcUpval:
+                        {
+                            const Value& v = FRVE2UV(frame, *op); //
+                            switch (v.type())
+                            {
+                                default: RunApplyValue( pInstr, v, stack, frame ); break;
+                                    KTHREAD_CASE    
+                                case Value::kBoundFun:
+                                auto pbound = v.toboundfun();
+                                CALL_BORROWING( pbound->program_, pbound->upvalues_.get() );
+                            }
+                        }
+                        break;
+                    }
+                }
+            OPCODE_END();
+#if LCFG_COMPUTED_GOTO
+            } while( 0 );
+#else
+            } // end,instr switch
+#endif 
+        } // end, while loop incrementing PC
+
+    }
+    catch (const ChannelEmpty& e)
+    {
+        // the instruction is done but for what it should have pushed
+        pThread->recvFrom_ = e.channel;
+        if (pThread->pCaller)
+            pThread = pThread->pCaller; // yield, as yield-nil! does
+        goto restartThread;
+    }
+    catch (const ChannelFull& e)
+    {
+        // likewise, the instruction is done but for the send
+        pThread->sendTo_ = e.channel;
+        pThread->sendValue_ = e.v;
+        if (pThread->pCaller)
+            pThread = pThread->pCaller;
+        goto restartThread;
+    }
+    catch (const std::runtime_error& e)
+    {
+        // duplicate code from kThrow
+#if LCFG_HAVE_TRY_CATCH        
+                    RunContext *pframe = &frame;
+
+                    while (pframe && !pframe->catcher)
+                    {
+                        RunContext* prev = pframe->prev;
+//                        std::cerr << "tossing frame, frame=" << pframe << " prev=" << prev << std::endl;
+#if LCFG_LEAFCALL
+                        UnwindLeafCalls( pThread, *pframe );
+#endif 
+                        pframe->~RunContext();
+                        pThread->rcAlloc_.deallocate( pframe, sizeof(RunContext) );
+                        pframe = prev;
+                    }
+                    
+                    if (pframe && pframe->catcher)
+                    {
+                        pThread->callframe = pframe;
+//                        std::cerr << "running catch block frame, frame=" << pframe << std::endl;
+#if LCFG_LEAFCALL
+                        UnwindLeafCalls( pThread, *pframe );
+#endif 
+                        pframe->rebind( TMPFACT_PROG_TO_RUNPROG(pframe->catcher), inupvalues );
+                        goto restartReturn;
+                    }
+                    else
+#endif 
+                    {
+        throw AstExecFail( *(frame.ppInstr), e.what() );
+//                        bangerr() << "Unhandled exception";
+                    }
+        
+    }
+}
+
+
+
+
+    DLLEXPORT void CallIntoSuspendedCoroutine( Bang::Thread *bthread, const BoundProgram* bprog )
+    {
+        // this is an awful mess.
+        auto prevcaller = bthread->pCaller;
+        auto prevcf = bthread->callframe;
+        bthread->pCaller = nullptr;
+        bthread->callframe = nullptr;
+        // auto bprog = v->toboundfun(); 
+        Bang::RunProgram( bthread, bprog->program_, bprog->upvalues_ );
+        bthread->pCaller = prevcaller;
+        bthread->callframe = prevcf;
+    }
+
+
+//     DLLEXPORT void FromCStackRunProgramInCurrentContext( const RunContext& rc, const Ast::Program* prog )
+//     {
+//         Bang::Thread* bthread = rc.thread;
+//         // this is an awful mess.
+//         auto prevcaller = bthread->pCaller;
+//         auto prevcf = bthread->callframe;
+//         bthread->pCaller = nullptr;
+//         bthread->callframe = nullptr;
+//         // auto bprog = v->toboundfun(); 
+//         Bang::RunProgram( bthread, prog, rc.upvalues_ );
+//         bthread->pCaller = prevcaller;
+//         bthread->callframe = prevcf;
+//     }
+    
+    
+    void Function::customOperator( const bangstring& theOperator, Stack& s)
+    {
+        bangerr() << "Vanilla Function does not support customOperator=" << theOperator;
+    }
+
+    void Function::indexOperator( const Value& theIndex, Stack& stack, const RunContext& ctx )
+    {
+        stack.push( theIndex );
+        this->apply( stack );
+    }
+
+    void Function::freeze()
+    {
+        throw std::runtime_error("freeze: this object can't be made immutable");
+    }
+
+    bool Function::shareable( std::vector<const Function*>& seen ) const
+    {
+        return true;
+    }
+
+    bool shareable( const Value& v, std::vector<const Function*>& seen )
+    {
+        switch (v.type())
+        {
+            case Value::kFun:
+            case Value::kBoundFun:
+            {
+                const Function* f = v.tofun().get();
+                if (f->frozen() || std::find( seen.begin(), seen.end(), f ) != seen.end())
+                    return true;
+                seen.push_back( f );
+                return f->shareable( seen );
+            }
+            case Value::kThread:
+                return false; // a coroutine can only be running in one place
+            default:
+                return true;
+        }
+    }
+
+    bool shareable( const Value& v )
+    {
+        std::vector<const Function*> seen;
+        return shareable( v, seen );
+    }
+
+    void freeze( const Value& v )
+    {
+        switch (v.type())
+        {
+            case Value::kFun:
+            case Value::kBoundFun:
+            {
+                Function* f = v.tofun().get();
+                if (!f->frozen())
+                    f->freeze();
+                break;
+            }
+#if !LCFG_STD_STRING
+            case Value::kStr:
+                v.tostr().immortalize();
+                break;
+#endif 
+            case Value::kThread:
+                throw std::runtime_error("freeze: a coroutine can't be made immutable");
+            default:
+                break;
+        }
+    }
+
+    void BoundProgram::indexOperator( const Value& theIndex, Stack& stack, const RunContext& ctx )
+    {
+        stack.push( theIndex );
+        CallIntoSuspendedCoroutine( ctx.thread, this );
+    }
+    
+    
+    void BoundProgram::apply( Stack& s )
+    {
+        // this is handled in main RunProgram machine
+        throw std::runtime_error("BoundProgram::Apply should not be called");
+    }
+
+    
+    void Ast::Program::run( Stack& stack, const RunContext& rc ) const
+    {
+#if LCFG_SHARED_CLOSURES
+        // shared_ is set along with compiling a lazy body, maybe on another thread
+        if (compiled() && shared_.isboundfun())
+        {
+            stack.push( shared_ );
+            return;
+        }
+        // the same literal run again in the same environment, as a loop
+        // body with no parameters does, can hand out the closure it made
+        // last time; closures can't be changed.  Literals that keep
+        // missing stop trying.
+        const unsigned char misses = cacheMisses_.load( std::memory_order_relaxed );
+        if (misses < kCacheGiveUp)
+        {
+            std::unique_ptr<CachedClosure[]>& cache = rc.thread->closures_;
+            if (!cache)
+                cache.reset( new CachedClosure[CachedClosure::kSlots] );
+            CachedClosure& slot = cache[(reinterpret_cast<uintptr_t>(this) >> 4) % CachedClosure::kSlots];
+            const Upvalue* env = rc.upvalues().get();
+            if (slot.program == this && slot.env == env)
+            {
+                if (misses)
+                    cacheMisses_.store( 0, std::memory_order_relaxed );
+            }
+            else
+            {
+                cacheMisses_.store( misses + 1, std::memory_order_relaxed );
+                slot.program = this;
+                slot.env = env;
+                slot.closure = Value( NEW_BANGFUN(BoundProgram, this, rc.upvalues()) );
+            }
+            stack.push( slot.closure );
+            return;
+        }
+#endif 
+        stack.push( NEW_BANGFUN(BoundProgram, this, rc.upvalues() ) );
+    }
+
+#if LCFG_LEAFCALL
+    const Ast::Base* const* Ast::Program::findLeafEntry() const
+    {
+        LATE_COMPILE_LOCK;
+        if (leafState_.load( std::memory_order_acquire ) != 0) // another thread got here first
+            return leafEntry();
+        const astList_t& ast = *getAst();
+        bool leaf = !ast.empty() && ast.back()->instr_ == kBreakProg;
+        for (unsigned i = 0; leaf && i + 1 < ast.size(); ++i)
+        {
+            switch (ast[i]->instr_)
+            {
+                case kBreakProg:
+                case kTCOApply:
+                case kTCOApplyProgram:
+                case kTCOApplyFunRec:
+                case kTCOIfElse:
+                case kTryCatch:
+                case kThrow:
+                case kEofMarker:
+                    leaf = false;
+                    break;
+                default:
+                    break;
+            }
+        }
+        if (leaf)
+        {
+            leafAst_ = ast;
+            leafAst_.back() = const_cast<LeafReturn*>( &LeafReturn::instance );
+        }
+        leafState_.store( leaf ? 1 : -1, std::memory_order_release ); // after leafAst_
+        return leaf ? &leafAst_.front() : nullptr;
+    }
+#endif 
+
+
+SHAREDUPVALUE_CREF RunContext::upvalues() const
+{
+    return upvalues_;
+}
+
+SHAREDUPVALUE_CREF RunContext::nthBindingParent( const NthParent n ) const
+{
+    return n == NthParent(0) ? upvalues_ : upvalues_->nthParent( n );
+}
+    
+const Value& RunContext::getUpValue( NthParent uvnumber ) const
+{
+    return upvalues_->getUpValue( uvnumber );
+}
+
+const Value& RunContext::getUpValue( const bangstring& uvName ) const
+{
+    return upvalues_->getUpValue( uvName );
+}
+
+void Ast::PushFunctionRec::run( Stack& stack, const RunContext& rc ) const
+{
+    SHAREDUPVALUE uv =
+        (this->nthparent_ == kNoParent) ? SHAREDUPVALUE() : rc.nthBindingParent( this->nthparent_ );
+    stack.push( NEW_BANGFUN(BoundProgram, pRecFun_, uv ) ); //STATIC_CAST_TO_BANGFUN(newfun) );
+}
+
+void Ast::PushPrimitive::run( Stack& stack, const RunContext& rc ) const
+{
+    if (apply_)
+        primitive_( stack, rc );
+    else
+        stack.push( primitive_ );
+};
+
+void Ast::Move::run( Stack& stack, const RunContext& rc) const
+{
+    bangerr() << "Move::run() should not be called";
+//     if (hasApply())
+//         bangerr() << "should not be calling run for ApplyUpval";
+//     stack.push( rc.getUpValue( uvnumber_ ) );
+};
+
+
+void Ast::MakeCoroutine::go( Stack& stack, Thread* incaller )
+{
+    // virtual void run( Stack& stack, const RunContext& ) const;
+    const Value& v = stack.pop(); // function basis for coroutine
+    
+    if (!v.isboundfun())
+        throw std::runtime_error("MakeCoroutine requires a bound function");
+    
+    auto thread = NEW_BANGTHREAD( v.tofun() );
+
+    stack.push( Value(thread) );
+}
+    
+
+#if HAVE_MUTATION    
+void Ast::SetUpval::run( Stack& stack, const RunContext& rc) const
+{
+    const Value& v = rc.getUpValue( uvnumber_ );
+    const_cast<Value&>(v) = stack.pop(); // see the sort of horrible things mutation forces me to do
+};
+#endif 
+    
+// this nearly lets us create a sort of hash table / record / object system!
+//
+// This is really sort of 'experiment' code to make a quick&dirty object system /
+// immutable record sort of thing
+void Ast::PushUpvalByName::run( Stack& stack, const RunContext& rc) const
+{
+    if (!stack.loc_top().isstr())
+    {
+        throw std::runtime_error("PushUpvalByName (lookup) name is not string" );
+    }
+
+    bangstring uvname = stack.poptostr();
+    stack.push( rc.getUpValue( uvname ) );
+}
+
+
+bool iseof(int c)
+{
+    return c == EOF;
+}
+
+struct ErrorNoMatch
+{
+    ErrorNoMatch() {}
+};
+
+    int RegurgeIo::getcud()
+    {
+        char rv;
+        
+        if (regurg_.empty())
+            return EOF;
+
+        rv = regurg_.back();
+        regurg_.pop_back();
+
+        return rv;
+    }
+    
+
+class StreamMark : public RegurgeStream
+{
+    RegurgeStream& stream_;
+    std::string consumned_;
+    //StreamMark( const StreamMark&  );
+    StreamMark& operator=( const StreamMark& );
+public:
+    StreamMark( RegurgeStream& stream )
+    : stream_( stream )
+    {}
+    StreamMark( StreamMark& stream )
+    : stream_( stream )
+    {}
+
+    virtual std::string sayWhere() const {
+        return stream_.sayWhere();
+    }
+    virtual SourceLocation location() const {
+        return stream_.location();
+    }
+
+    void dump( std::ostream& out, const std::string& context ) const
+    {
+        out << "  {{SM @ " << context << "}}: consumned=[[" << consumned_ << "\n";
+    }
+
+    char getc()
+    {
+        char rv = stream_.getc();
+        consumned_.push_back(rv);
+        return rv;
+    }
+
+    void accept()
+    {
+        consumned_.clear();
+    }
+    void regurg( char c )
+    {
+        char lastc = consumned_.back();
+        if (lastc != c )
+        {
+            std::cerr << "last char=" << lastc << " regurged=" << c << std::endl;
+            throw std::runtime_error("parser regurged char != last");
+        }
+        consumned_.pop_back();
+        stream_.regurg(c);
+    }
+    ~StreamMark()
+    {
+//        std::cerr << "     ~SM: returning(" << consumned_.size() << ") regurg_.size(" << regurg_.size() << ")\n";
+        // consumned stuff is pushed back in reverse
+        std::for_each( consumned_.rbegin(), consumned_.rend(),
+            [&]( char c ) { stream_.regurg(c); } );
+    }
+}; // end, class StreamMark
+
+
+
+// A stream that knows which source file it is reading from and tracks the
+// line / column as characters are consumed and regurgitated.
+class RegurgeSource : public RegurgeIo
+{
+protected:
+    std::string filename_;
+    unsigned fileid_;
+    struct Location {
+        int lineno_;
+        int linecol_;
+        void advance( char c ) {
+//            std::cerr << "ADV: " << c << "\n";
+            if (c=='\n') {
+                ++lineno_;
+                linecol_ = 0;
+            } else {
+                ++linecol_;
+            }
+        }
+        void rewind( char c ) {
+//            std::cerr << "REW: " << c << "\n";
+            if (c=='\n') {
+                --lineno_;
+                linecol_ = -1;
+            } else {
+                --linecol_;
+            }
+
+        }
+        Location() : lineno_(1), linecol_(0) {}
+    } loc_;
+//    Location err_;
+
+    virtual int readc() = 0; // next char from the underlying source, or EOF
+public:
+    RegurgeSource( const std::string& filename, unsigned fileid )
+    : filename_( filename ),
+      fileid_( fileid )
+    {}
+
+    virtual std::string sayWhere() const
+    {
+        std::ostringstream oss;
+        oss << filename_ << ":" << loc_.lineno_ << " C" << loc_.linecol_;
+        return oss.str();
+    }
+    virtual SourceLocation location() const
+    {
+        return SourceLocation( fileid_, loc_.lineno_, loc_.linecol_ );
+    }
+
+    char getc()
+    {
+        int icud = RegurgeIo::getcud();
+
+        if (icud != EOF)
+        {
+            loc_.advance( icud );
+            return icud;
+        }
+        
+        int istream = readc();
+        if (istream==EOF)
+            throw ErrorEof();
+        else
+        {
+            loc_.advance( istream );
+            return istream;
+        }
+    }
+
+    virtual void regurg( char c )
+    {
+        loc_.rewind(c);
+        RegurgeIo::regurg(c);
+    }
+};
+
+class RegurgeFile : public RegurgeSource
+{
+    FILE* f_;
+    int readc() { return fgetc(f_); }
+public:
+    RegurgeFile( const std::string& filename )
+    : RegurgeSource( filename, isolateState().sourceMap.fileid( filename ) )
+    {
+        f_ = fopen( filename.c_str(), "r");
+        if (!f_)
+            bangerr() << "Cannot open file=" << filename;
+    }
+    ~RegurgeFile()
+    {
+        fclose(f_);
+    }
+};
+
+// Source text that was already read once, e.g., a lazily compiled "fun" body;
+// locations continue from where the text was found in its original file.
+class RegurgeText : public RegurgeSource
+{
+    const std::string& text_;
+    std::string::size_type pos_;
+    int readc() { return pos_ < text_.size() ? static_cast<unsigned char>(text_[pos_++]) : EOF; }
+public:
+    RegurgeText( const std::string& text, const SourceLocation& where )
+    : RegurgeSource( isolateState().sourceMap.filename( where.fileid_ ), where.fileid_ ),
+      text_( text ),
+      pos_( 0 )
+    {
+        loc_.lineno_ = where.lineno_;
+        loc_.linecol_ = where.linecol_;
+    }
+};
+    
+
+
+
+bool eatwhitespace( StreamMark& stream )
+{
+    bool bGotAny = false;
+    StreamMark mark( stream );
+    try
+    {
+        while (isspace(mark.getc()))
+        {
+            bGotAny = true;
+            mark.accept();
+        }
+    }
+    catch (const ErrorEof& )
+    {
+        bGotAny = true;
+    }
+
+    return bGotAny;
+}
+
+
+    
+class Parser
+{
+    class Number
+    {
+        double value_;
+    public:
+        Number( StreamMark& stream )
+        {
+            StreamMark mark(stream);
+
+            bool gotDecimal = false;
+            bool gotOne = false;
+            bool isNegative = false;
+            double val = 0;
+            double fractional_adj = 0.1;
+            double base = 10;
+            char c = mark.getc();
+
+            if (c=='-')
+            {
+                c = mark.getc();
+                if (!isdigit(c))
+                    throw ErrorNoMatch();
+                mark.accept();
+                isNegative = true;
+            }
+
+            if (c == '0')
+            {
+                c = mark.getc();
+                if (c == 'x')
+                {
+                    base = 16;
+                    mark.accept();
+                    c = mark.getc();
+                }
+                else
+                {
+                    mark.regurg(c);
+                    c = '0';
+                }
+            }
+
+            while (isdigit(c) || ((base == 16) && tolower(c) >= 'a' && tolower(c) <= 'f'))
+            {
+                gotOne = true;
+                mark.accept();
+                if (gotDecimal)
+                {
+                    val = val + (fractional_adj * (c - '0'));
+                    fractional_adj = fractional_adj / 10;
+                }
+                else    
+                {
+                    val = val * base + (isdigit(c) ? (c - '0') : (10 + tolower(c) - 'a'));
+                }
+                c = mark.getc();
+                if (!gotDecimal)
+                {
+                    if (c=='.')
+                    {
+                        gotDecimal = true;
+                        c = mark.getc(); 
+                        if (!isdigit(c)) // decimal point must be followed by a number
+                            break;
+                    }
+                }
+            }
+
+            if (c == 'e' || c == 'E') // scientific notation
+            {
+                bool negativeExp = false;
+                c = mark.getc();
+
+                if (c == '+')
+                    c = mark.getc();
+
+                if (c == '-')
+                {
+                    c = mark.getc();
+                    if (isdigit(c))
+                    {
+                        negativeExp = true;
+                        mark.accept();
+                    }
+                }
+                double exp = 0;
+                while (isdigit(c))
+                {
+                    exp = exp * 10 + (c - '0');
+                    mark.accept();
+                    c = mark.getc();
+                }
+                if (negativeExp)
+                    exp = exp * -1;
+                
+                val = val * ::pow(10,exp);
+            }
+            
+            value_ = val;
+            if (isNegative)
+                value_ = value_ * -1.0;
+            if (!gotOne)
+                throw ErrorNoMatch();
+        }
+        double value() { return value_; }
+    }; // end, class Number
+
+
+    class Boolean
+    {
+        bool value_;
+    public:
+        Boolean( StreamMark& stream )
+        {
+            StreamMark mark(stream);
+
+            if (eatReservedWord("true", mark))
+                value_ = true;
+            else if (eatReservedWord("false", mark))
+                value_ = false;
+            else
+                throw ErrorNoMatch();
+
+            mark.accept();
+        }
+        bool value() { return value_; }
+    };
+
+
+    struct ParsingRecursiveFunStack;
+    class Program
+    {
+        Ast::Program::astList_t& ast_;
+        bool noTco_; // e.g., when parsed program is going to be pasted into another program
+    public:
+        Program( ParsingContext& pc, StreamMark&, const Ast::Program* parent,
+            const Ast::CloseValue* upvalueChain, const Ast::CloseValue* const entryUvChain,
+            const ParsingRecursiveFunStack* pRecParsing, Ast::Program::astList_t&,
+            bool disableTco = false
+               );
+
+        void noTco() { noTco_ = true; }
+        // const Ast::Program::astList_t& ast() { return ast_; }
+    };
+
+    class Comment
+    {
+    public:
+        Comment( StreamMark& stream )
+        {
+            StreamMark mark(stream);
+            eatwhitespace(stream);
+            if ( '-' == mark.getc() && '-' == mark.getc())
+            {
+                while (mark.getc() != '\n')
+                    mark.accept();
+            }
+            else
+                throw ErrorNoMatch();
+        }
+    };
+
+    class ParseString
+    {
+        std::string content_;
+    public:
+        ParseString( StreamMark& stream )
+        {
+            StreamMark mark(stream);
+            char delim = mark.getc();
+            if (delim == '\'' || delim == '"') // simple strings, no escaping etc
+            {
+                auto bi = std::back_inserter(content_);
+                for (char cstr = mark.getc(); cstr != delim; cstr = mark.getc())
+                {
+                    if (cstr == '\\')
+                    {
+                        char c = mark.getc();
+                        switch (c) {
+                            case 'n':  cstr = '\n'; break;
+                            case '"':  cstr = '"';  break;
+                            case '\'': cstr = '\''; break;
+                            case '\\': cstr = '\\'; break;
+                            case 'r':  cstr = '\r'; break;
+                            default:
+                                //*bi++ = '\\';
+                                cstr = c;
+                                break;
                         }
                     }
+                    *bi++ = cstr;
+                }
+                mark.accept();
+            }
+            else
+                throw ErrorNoMatch();
+        }
+        const std::string& content() { return content_; }
+    };
+
+    class ParseLiteral
+    {
+        Value value_;
+    public:
+        ParseLiteral( StreamMark& mark )
+        {
+            try
+            {
+                value_ = Value(ParseString(mark).content());
+//                std::cerr << "ParseLiteral string:"; value_.tostring(std::cerr); std::cerr << "\n";
+                
+                return;
+            } catch ( const ErrorNoMatch& ) {}
+
+            try
+            {
+                value_ = Value(Number(mark).value());
+                return;
+            } catch ( const ErrorNoMatch& ) {}
+
+            value_ = Value(Boolean(mark).value()); // allow to throw if not found
+        }
+
+        const Value& value() { return value_; }
+    };
+
+    class Identifier
+    {
+        std::string name_;
+    public:
+        Identifier( StreamMark& stream )
+        {
+            bool gotAny = false;
+            StreamMark mark(stream);
+            char c = mark.getc();
+            while (isalpha(c) || c == '_')
+            {
+                name_.push_back(c);
+                mark.accept();
+
+                for (c = mark.getc(); isalpha(c) || isdigit(c) || (c=='_'); c = mark.getc())
+                {
+                    name_.push_back(c);
+                    mark.accept();
+                }
+
+                if (c != '-') // hyphen allowed in identifier if followed by alpha
+                    break;
+                
+                c = mark.getc();
+                if (isalpha(c))
+                    name_.push_back('-');
+            }
+            if (name_.size() < 1)
+                throw ErrorNoMatch();
+        }
+        const std::string& name() { return name_; }
+    };
+
+    static bool isoperatorchar( char c )
+    {
+        auto found = strchr( "+-<>=/*@$%^&~", c );
+        return found ? true : false;
+    }
+
+    static bool operatorterminator( char c )
+    {
+        if (isspace(c))
+            return true;
+        
+        auto found = strchr( "];}).!", c );
+        return found ? true : false;
+    }
+    
+    class OperatorToken
+    {
+        std::string name_;
+    public:
+        OperatorToken( StreamMark& stream )
+        {
+            StreamMark mark(stream);
+            char c = mark.getc();
+            
+            if (!isoperatorchar(c))
+                throw ErrorNoMatch();
+
+            do
+            {
+                name_.push_back(c);
+                mark.accept();
+                c = mark.getc();
+            }
+            while (!operatorterminator(c));
+        }
+        const std::string& name() { return name_; }
+    };
+    
+    static bool eatReservedWord( const std::string& rw, StreamMark& stream )
+    {
+        StreamMark mark(stream);
+
+        for (auto it = rw.begin(); it != rw.end(); ++it)
+        {
+            if (mark.getc() != *it)
+                return false;
+        }
+        mark.accept();
+        return true;
+    }
+
+    // Finds the extent of a "fun" body without building any Ast, reading it
+    // with the same token classes Parser::Program does and following the same
+    // rules to decide where a program ends.  Anything it can't vouch for
+    // (import, try/catch, EOF, malformed input) throws SkimAbort or
+    // ErrorNoMatch and the caller falls back to parsing the body normally.
+    class BodySkimmer
+    {
+        // passes characters through, keeping a copy of what's still consumed
+        class Recorder : public RegurgeStream
+        {
+            StreamMark& mark_;
+        public:
+            std::string text_;
+            Recorder( StreamMark& mark ) : mark_( mark ) {}
+            char getc() { const char c = mark_.getc(); text_.push_back(c); return c; }
+            void accept() {}
+            void regurg( char c ) { text_.pop_back(); mark_.regurg(c); }
+            std::string sayWhere() const { return mark_.sayWhere(); }
+            SourceLocation location() const { return mark_.location(); }
+        };
+        Recorder recorder_;
+        StreamMark stream_;
+
+        void defdef( StreamMark& stream );
+        bool program( StreamMark& stream ); // true if the program's terminator was consumed
+    public:
+        struct SkimAbort {};
+
+        BodySkimmer( StreamMark& mark ) : recorder_( mark ), stream_( recorder_ ) {}
+        bool program() { return program( stream_ ); }
+        // the body's source, which stays consumed from the mark skimmed
+        const std::string& text() { stream_.accept(); return recorder_.text_; }
+    };
+
+    struct ParsingRecursiveFunStack
+    {
+        const ParsingRecursiveFunStack* prev;
+        Ast::Program *parentProgram;
+        const Ast::CloseValue* parentsBinding;
+        std::string progname_;
+//         Ast::Program::astList_t& parentProgramAst() {
+//             return *(parentProgram->getAst());
+//         }
+        std::pair<Ast::Program*,const Ast::CloseValue*> FindProgramForIdent( const std::string& ident ) const
+        {
+            if (progname_ == ident)
+            {
+//                std::cerr << "found parent prog, ident=" << ident << " CloseValue=" << parentsBinding << "\n";
+                return std::pair<Ast::Program*,const Ast::CloseValue*>( parentProgram, parentsBinding );
+            }
+            else if (prev)
+                return prev->FindProgramForIdent( ident );
+            else
+                return std::pair<Ast::Program*,const Ast::CloseValue*>( nullptr, nullptr );
+        }
+        
+        ParsingRecursiveFunStack
+        (   const ParsingRecursiveFunStack* p,
+            Ast::Program* parent,
+            const Ast::CloseValue* binding,
+            const std::string& progname
+//            Ast::CloseValue* upvals
+        )
+        :  prev( p ),
+           parentProgram(parent),
+           parentsBinding( binding ),
+           progname_( progname )
+        {}
+    };
+
+    static const Ast::CloseValue* getParamBindings
+    (   StreamMark& mark,
+        Ast::Program::astList_t& functionAst,
+        const Ast::CloseValue* upvalueChain
+    )
+    {
+        std::vector< std::string > params;
+        while (true)
+        {
+            try
+            {
+                Identifier param(mark);
+                eatwhitespace(mark);
+                params.push_back( param.name() );
+                mark.accept();
+            }
+            catch ( const ErrorNoMatch& ) // identifier is optional
+            {
+                break; 
+            }
+        }
+
+        while (params.size() > 0)
+        {
+            auto cv = new Ast::CloseValue( upvalueChain, internstring(params.back()) );
+            functionAst.push_back( cv );
+            upvalueChain = cv;
+            params.pop_back();
+        }
+            
+
+        char c = mark.getc();
+        if (c != '=') // this seems unneccesary sometimes. therefore "as"
+        {
+            bangerr(ParseFail) << "got '" << c << "', expecting '=' in "
+                               << mark.sayWhere() << ": function def / param list must be followed by '='"; 
+        }
+
+        return upvalueChain;            
+
+    }
+    
+    
+    class Defdef
+    {
+        bool postApply_;
+        Ast::Program* pDefProg_;
+        std::unique_ptr<std::string> defname_;
+    public:
+        ~Defdef() { delete pDefProg_; }
+        Defdef( ParsingContext& parsectx, StreamMark& stream, const Ast::CloseValue* upvalueChain, const ParsingRecursiveFunStack* pRecParsing )
+        : postApply_(false), pDefProg_(nullptr)
+        {
+            const Ast::CloseValue* const lastParentUpvalue = upvalueChain;
+            StreamMark mark(stream);
+
+            eatwhitespace(mark);
+            
+            if (!eatReservedWord( "def", mark ) && !eatReservedWord( "fun", mark ))
+                throw ErrorNoMatch();
+
+            char c = mark.getc();
+            if (c == '!')
+                postApply_ = true;
+            else
+                mark.regurg(c);
+
+            eatwhitespace(mark);
+
+            c = mark.getc();
+            if (c == ':')
+            {
+                try
+                {
+                    Identifier param(mark);
+                    eatwhitespace(mark);
+                    defname_ = std::unique_ptr<std::string>(new std::string(param.name()));
                 }
-        OPCODE_END();
+                catch ( const ErrorNoMatch& )
+                {
+                    bangerr(ParseFail) << "in " << mark.sayWhere() << "identifier must follow \"def :\"";
+                }
+            }
+            else
+                mark.regurg( c );
 
-            OPCODE_LOC(kMakeCoroutine):
-                    Ast::MakeCoroutine::go( stack, pThread );
-            OPCODE_END();
+            pDefProg_ = new Ast::Program(nullptr);
+            const Ast::CloseValue* const entryUvChain = upvalueChain;
+            upvalueChain = getParamBindings( mark, pDefProg_->astRef(), upvalueChain );
+
+            ParsingRecursiveFunStack recursiveStack( pRecParsing, pDefProg_, lastParentUpvalue, defname_ ? *defname_ : "" );
+            const ParsingRecursiveFunStack* bodyRecParsing = defname_ ? &recursiveStack : pRecParsing;
+
+            if (!isolateState().lazyCompile || !skimLazyBody( parsectx, mark, upvalueChain, entryUvChain, bodyRecParsing ))
+            {
+                Program progdef( parsectx, mark, nullptr, upvalueChain, entryUvChain,
+                    bodyRecParsing,
+                    pDefProg_->astRef() );
+#if LCFG_LOCALFUN
+                CallLocalFunsDirectly( pDefProg_->astRef() );
+#endif 
+#if LCFG_NUMSPEC
+                SpecializeNumFun( pDefProg_->astRef(), pDefProg_ );
+#endif 
+#if LCFG_CSE
+                ReuseCommonReads( pDefProg_->astRef() );
+#endif 
+#if LCFG_LICM
+                HoistLoopInvariants( pDefProg_->astRef(), pDefProg_ );
+#endif 
+#if LCFG_SHARED_CLOSURES
+                pDefProg_->shareIfClosed( pDefProg_->astRef() );
+#endif 
+            }
+            
+            mark.accept();
+        }
+
+        bool skimLazyBody
+        (   ParsingContext& parsectx, StreamMark& stream,
+            const Ast::CloseValue* upvalueChain, const Ast::CloseValue* entryUvChain,
+            const ParsingRecursiveFunStack* pRecParsing
+        );
+
+        bool hasPostApply() const { return postApply_; }
+        Ast::Program* stealDefProg() { auto rc = pDefProg_; pDefProg_ = nullptr; return rc; }
+        const std::string& getDefName() { return *defname_; }
+        bool hasDefName() const { return static_cast<bool>(defname_); }
+    }; // end, Defdef class
+    
+    Program* program_;
+    Ast::Program::astList_t programAst_;
+
+    friend class LazyProgramBody;
+public:
+    Parser( ParsingContext& ctx, StreamMark& mark, const Ast::Program* parent )
+    {
+        program_ = new Program( ctx, mark, parent, nullptr, nullptr, nullptr, programAst_ ); // 0,0,0 = no upvalues, no recursive chain
+    }
+
+    Parser( ParsingContext& ctx, StreamMark& mark, const Ast::CloseValue* upvalchain )
+    {
+        program_ = new Program( ctx, mark, nullptr /*parent*/, upvalchain, upvalchain, nullptr, programAst_ ); // 0,0,0 = no upvalues, no recursive chain
+    }
+    
+    const Ast::Program::astList_t& programAst()
+    {
+        return programAst_;
+    }
+};
+
+    Ast::Base* ImportParsingContext::hitEof( const Ast::CloseValue* uvchain )
+    {
+        Parser p( parsecontext_, stream_, uvchain );
+
+        auto prog = new Ast::Program( parent_, p.programAst() );  //~~~todo: refactor me up
+        prog->setApply();
+        return prog;
+    }
+    
+
+#if LCFG_X64JIT
+//////////////////////////////////////////////////////////////////
+// Baseline JIT.
+//
+// Each maximal run of simple instructions (moves, operators, closing values,
+// index operators and plain run() nodes) in an optimized program becomes one
+// native function.  Numeric operators, upvalue/register/literal loads and the
+// register and bool register stores are done inline behind type guards; if a
+// guard fails, or for anything else, the native code calls back into the same
+// code the interpreter runs for that instruction.  Anything that transfers
+// control (apply, if/else, tail calls, coroutines) stays with RunProgram.
+//
+// C++ exceptions can't unwind through the generated code, so helpers catch
+// everything, park it in gJitPendingError, and the native function returns the
+// index of the instruction that failed for RunProgram to rethrow.
+//////////////////////////////////////////////////////////////////
+struct JitLayout
+{
+    static int valueType() { return offsetof( Value, type_ ); }
+    static int valueNum()  { return offsetof( Value, v_ ); }
+
+    // measured on a real object, once
+    template <class T, class M>
+    static int memberOffset( const T& obj, const M& member )
+    {
+        return static_cast<int>( reinterpret_cast<const char*>(&member) - reinterpret_cast<const char*>(&obj) );
+    }
+};
+
+int Upvalue::parentOffset()
+{
+    static const int offset = []{ Upvalue probe( nullptr, SHAREDUPVALUE(), Value() ); return JitLayout::memberOffset( probe, probe.parent_ ); }();
+    return offset;
+}
+
+int Upvalue::valueOffset()
+{
+    static const int offset = []{ Upvalue probe( nullptr, SHAREDUPVALUE(), Value() ); return JitLayout::memberOffset( probe, probe.v_ ); }();
+    return offset;
+}
+
+int Thread::r0Offset()
+{
+    static const int offset = []{ Thread probe( static_cast<Isolate*>(nullptr) ); return JitLayout::memberOffset( probe, probe.r0_ ); }();
+    return offset;
+}
+
+int Thread::rb0Offset()
+{
+    static const int offset = []{ Thread probe( static_cast<Isolate*>(nullptr) ); return JitLayout::memberOffset( probe, probe.rb0_ ); }();
+    return offset;
+}
+
+namespace {
+    thread_local std::exception_ptr gJitPendingError;
+
+    int jitRunOne( Thread* pThread, RunContext* frame, const Ast::Base* pInstr )
+    {
+        try
+        {
+            Stack& stack = pThread->stack;
+            switch (pInstr->instr_)
+            {
+                case Ast::Base::kMove:
+                    RunMove( *reinterpret_cast<const Ast::Move*>(pInstr), pThread, *frame, stack );
+                    break;
+                case Ast::Base::kApplyThingAndValue2ValueOperator:
+                    RunThingAndValue2Value( *reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(pInstr), pThread, *frame, stack );
+                    break;
+#if DOT_OPERATOR_INLINE
+                case Ast::Base::kApplyIndexOperator:
+                    RunIndexOperator( *reinterpret_cast<const Ast::ApplyIndexOperator*>(pInstr), pThread, *frame, stack );
+                    break;
+#endif
+                case Ast::Base::kCloseValue:
+                    frame->close( NEW_UPVAL( reinterpret_cast<const Ast::CloseValue*>(pInstr), frame->upvalues_, stack.pop() ) );
+                    break;
+#if LCFG_NUMEXPR
+                case Ast::Base::kNumExpr:
+                    RunNumExpr( *reinterpret_cast<const Ast::NumExpr*>(pInstr), pThread, *frame, stack );
+                    break;
+#endif 
+                default:
+                    pInstr->run( stack, *frame );
+                    break;
+            }
+            return 0;
+        }
+        catch (...)
+        {
+            gJitPendingError = std::current_exception();
+            return 1;
+        }
+    }
+
+    template <class T> int jitPush( Thread* pThread, T v )
+    {
+        try { pThread->stack.push( v ); return 0; }
+        catch (...) { gJitPendingError = std::current_exception(); return 1; }
+    }
+
+    template <class T> int jitClose( RunContext* frame, const Ast::CloseValue* cv, T v )
+    {
+        try { frame->close( NEW_UPVAL( cv, frame->upvalues_, Value(v) ) ); return 0; }
+        catch (...) { gJitPendingError = std::current_exception(); return 1; }
+    }
+
+    bool isJittable( const Ast::Base* pInstr )
+    {
+        switch (pInstr->instr_)
+        {
+            case Ast::Base::kUnk:
+            case Ast::Base::kMove:
+            case Ast::Base::kApplyThingAndValue2ValueOperator:
+            case Ast::Base::kCloseValue:
+#if DOT_OPERATOR_INLINE
+            case Ast::Base::kApplyIndexOperator:
+#endif
+#if LCFG_NUMEXPR
+            case Ast::Base::kNumExpr:
+#endif 
+                return true;
+            default:
+                return false;
+        }
+    }
+} // end, anonymous namespace
+
+void Ast::JitSegment::rethrow()
+{
+    std::exception_ptr e;
+    std::swap( e, gJitPendingError );
+    std::rethrow_exception( e );
+}
+
+class JitCompiler
+{
+    // rbx = Thread*, r12 = RunContext*, for the whole function
+    X64::Emitter e_;
+    std::deque<X64::Label> labels_; // deque so Labels stay put
+    X64::Label exit_;
+    struct Stub { X64::Label* entry; X64::Label* resume; const Ast::Base* instr; int index; };
+    std::vector<Stub> slow_;
+    std::map<int, X64::Label*> fail_;
+    int inlined_;
+
+    const int offR0_, offRb0_, offFrameUv_, offUvParent_, offUvV_, offType_, offNum_;
+
+    enum { kScratch = 128 }; // at [rsp], for values that have to live across helper calls
+
+    X64::Label& newLabel() { labels_.emplace_back(); return labels_.back(); }
+
+    // eax = index of the instruction whose helper threw
+    X64::Label& failed( int index )
+    {
+        X64::Label*& l = fail_[index];
+        if (!l)
+            l = &newLabel();
+        return *l;
+    }
+
+    Stub& slowPath( const Ast::Base* pInstr, int index )
+    {
+        Stub stub = { &newLabel(), &newLabel(), pInstr, index };
+        slow_.push_back( stub );
+        return slow_.back();
+    }
+
+    void checkHelper( int index )
+    {
+        e_.test32( X64::rax, X64::rax );
+        e_.jcc( X64::kNE, failed( index ) );
+    }
+    
+    void callGeneric( const Ast::Base* pInstr, int index )
+    {
+        e_.mov( X64::rdi, X64::rbx );
+        e_.mov( X64::rsi, X64::r12 );
+        e_.movImm( X64::rdx, reinterpret_cast<uint64_t>(pInstr) );
+        e_.call( reinterpret_cast<const void*>(&jitRunOne) );
+        checkHelper( index );
+    }
+
+    // rax = the Upvalue holding binding #n
+    void loadUpval( NthParent n )
+    {
+        e_.load( X64::rax, X64::r12, offFrameUv_ );
+        for (int i = n.toint(); i > 0; --i)
+            e_.load( X64::rax, X64::rax, offUvParent_ );
+    }
+
+    static bool canLoadNum( const Ast::ValueEater& ve )
+    {
+        switch (ve.v1src_)
+        {
+            case kSrcLiteral:  return ve.v1literal_.isnum();
+            case kSrcUpval:    return true;
+            case kSrcRegister: return true;
+            default:           return false;
+        }
+    }
+
+    void loadNum( const Ast::ValueEater& ve, X64::Xmm x, X64::Label& slow )
+    {
+        switch (ve.v1src_)
+        {
+            case kSrcLiteral:
+            {
+                const double d = ve.v1literal_.tonum();
+                uint64_t bits;
+                memcpy( &bits, &d, sizeof(bits) );
+                e_.movImm( X64::rax, bits );
+                e_.movq( x, X64::rax );
+            }
+            break;
+            case kSrcUpval:
+                loadUpval( ve.v1uvnumber_ );
+                e_.cmp32Imm( X64::rax, offUvV_ + offType_, Value::kNum );
+                e_.jcc( X64::kNE, slow );
+                e_.movsdLoad( x, X64::rax, offUvV_ + offNum_ );
+                break;
+            case kSrcRegister:
+                e_.cmp32Imm( X64::rbx, offR0_ + offType_, Value::kNum );
+                e_.jcc( X64::kNE, slow );
+                e_.movsdLoad( x, X64::rbx, offR0_ + offNum_ );
+                break;
+            default:
+                break;
+        }
+    }
+
+    // r0_ can be overwritten in place as long as it isn't holding a string/fun/thread
+    void guardRegisterIsPlain( X64::Label& slow )
+    {
+        e_.cmp32Imm( X64::rbx, offR0_ + offType_, Value::kNum );
+        e_.jcc( X64::kA, slow );
+    }
+
+    // result in xmm1
+    void storeNum( const Ast::ValueMaker& vm, const Stub& stub )
+    {
+        switch (vm.dest_)
+        {
+            case kSrcRegister:
+                guardRegisterIsPlain( *stub.entry );
+                e_.store32Imm( X64::rbx, offR0_ + offType_, Value::kNum );
+                e_.movsdStore( X64::rbx, offR0_ + offNum_, X64::xmm1 );
+                break;
+            case kSrcStack:
+                e_.mov( X64::rdi, X64::rbx );
+                e_.movsd( X64::xmm0, X64::xmm1 );
+                e_.call( reinterpret_cast<const void*>(&jitPush<double>) );
+                checkHelper( stub.index );
+                break;
+            case kSrcCloseValue:
+                e_.mov( X64::rdi, X64::r12 );
+                e_.movImm( X64::rsi, reinterpret_cast<uint64_t>(vm.cv_) );
+                e_.movsd( X64::xmm0, X64::xmm1 );
+                e_.call( reinterpret_cast<const void*>(&jitClose<double>) );
+                checkHelper( stub.index );
+                break;
+            default:
+                break;
+        }
+    }
+
+    // result in eax, 0 or 1
+    void storeBool( const Ast::ValueMaker& vm, const Stub& stub )
+    {
+        switch (vm.dest_)
+        {
+            case kSrcRegisterBool:
+                e_.store8( X64::rbx, offRb0_, X64::rax );
+                break;
+            case kSrcRegister:
+                guardRegisterIsPlain( *stub.entry );
+                e_.store32Imm( X64::rbx, offR0_ + offType_, Value::kBool );
+                e_.store8( X64::rbx, offR0_ + offNum_, X64::rax );
+                break;
+            case kSrcStack:
+                e_.mov( X64::rsi, X64::rax );
+                e_.mov( X64::rdi, X64::rbx );
+                e_.call( reinterpret_cast<const void*>(&jitPush<bool>) );
+                checkHelper( stub.index );
+                break;
+            case kSrcCloseValue:
+                e_.mov( X64::rdx, X64::rax );
+                e_.mov( X64::rdi, X64::r12 );
+                e_.movImm( X64::rsi, reinterpret_cast<uint64_t>(vm.cv_) );
+                e_.call( reinterpret_cast<const void*>(&jitClose<bool>) );
+                checkHelper( stub.index );
+                break;
+            default:
+                break;
+        }
+    }
+
+    // NumberOps computes (other OP thing); thing decides which operator
+    // table is used, so a non-number in either one goes the slow way
+    bool emitThingAndValue2Value( const Ast::ApplyThingAndValue2ValueOperator& pa, int index )
+    {
+        const EOperators op = pa.openum_;
+        const bool isCompare = (op == kOpLt || op == kOpGt || op == kOpEq);
+        const bool isArith = (op == kOpPlus || op == kOpMinus || op == kOpMult || op == kOpDiv);
+
+        if (pa.argSwap_ || !(isCompare || isArith))
+            return false;
+        if (!canLoadNum( pa ) || !canLoadNum( pa.secondsrc_ ))
+            return false;
+        if (pa.dest_ == kSrcRegisterBool && !isCompare)
+            return false;
+
+        const Stub& stub = slowPath( &pa, index );
+        loadNum( pa, X64::xmm0, *stub.entry );
+        loadNum( pa.secondsrc_, X64::xmm1, *stub.entry );
+        if (isArith)
+        {
+            switch (op)
+            {
+                case kOpPlus:  e_.addsd( X64::xmm1, X64::xmm0 ); break;
+                case kOpMinus: e_.subsd( X64::xmm1, X64::xmm0 ); break;
+                case kOpMult:  e_.mulsd( X64::xmm1, X64::xmm0 ); break;
+                default:       e_.divsd( X64::xmm1, X64::xmm0 ); break;
+            }
+            storeNum( pa, stub );
+        }
+        else
+        {
+            // mov doesn't touch the flags, so clear first and setcc into the low byte
+            e_.movImm32( X64::rax, 0 );
+            e_.movImm32( X64::rcx, 0 );
+            switch (op)
+            {
+                case kOpGt:
+                    e_.ucomisd( X64::xmm1, X64::xmm0 );
+                    e_.setcc( X64::kA, X64::rax );
+                    break;
+                case kOpLt:
+                    e_.ucomisd( X64::xmm0, X64::xmm1 );
+                    e_.setcc( X64::kA, X64::rax );
+                    break;
+                default: // equal, and not unordered
+                    e_.ucomisd( X64::xmm1, X64::xmm0 );
+                    e_.setcc( X64::kE, X64::rax );
+                    e_.setcc( X64::kNP, X64::rcx );
+                    e_.and8( X64::rax, X64::rcx );
+                    break;
+            }
+            storeBool( pa, stub );
+        }
+        e_.bind( *stub.resume );
+        return true;
+    }
 
-            OPCODE_LOC(kApplyFunRec):
-                {
-                    const Ast::PushFunctionRec* afn = reinterpret_cast<const Ast::PushFunctionRec*>(pInstr);
-                    inprog = afn->pRecFun_;
-                    inupvalues = (afn->nthparent_ == kNoParent) ? SHAREDUPVALUE() : frame.nthBindingParent( afn->nthparent_ );
-                    goto restartNonTail;
-                }
-                OPCODE_END();
-                
-            OPCODE_LOC(kTCOIfElse):
+    bool emitMove( const Ast::Move& move, int index )
+    {
+        const Ast::ValueEater& src = move.source();
+        switch (move.dest_)
+        {
+            case kSrcRegister:
+                if (src.v1src_ == kSrcLiteral)
                 {
-                    const Ast::IfElse* ifelse = reinterpret_cast<const Ast::IfElse*>(pInstr);
-                    const Ast::Program* p = ifelse->branchTaken(*pThread);
-                    if (p)
+                    const Value& lit = src.v1literal_;
+                    if (!lit.isnum() && !lit.isbool())
+                        return false;
+                    const Stub& stub = slowPath( &move, index );
+                    guardRegisterIsPlain( *stub.entry );
+                    e_.store32Imm( X64::rbx, offR0_ + offType_, lit.type() );
+                    if (lit.isnum())
                     {
-                        frame.rebind( TMPFACT_PROG_TO_RUNPROG(p) );
-                        goto restartTco;
+                        const double d = lit.tonum();
+                        uint64_t bits;
+                        memcpy( &bits, &d, sizeof(bits) );
+                        e_.movImm( X64::rax, bits );
+                        e_.store( X64::rbx, offR0_ + offNum_, X64::rax );
                     }
+                    else
+                        e_.store8Imm( X64::rbx, offR0_ + offNum_, lit.tobool() );
+                    e_.bind( *stub.resume );
+                    return true;
                 }
-                OPCODE_END();
-
-            OPCODE_LOC(kIfElse):
+                else if (src.v1src_ == kSrcUpval)
                 {
-                    const Ast::IfElse* ifelse = reinterpret_cast<const Ast::IfElse*>(pInstr);
-                    const Ast::Program* p = ifelse->branchTaken(*pThread);
-                    if (p)
-                    {
-                        inprog = p;
-                        inupvalues = frame.upvalues_;
-                        goto restartNonTail;
-                    }
+                    const Stub& stub = slowPath( &move, index );
+                    loadUpval( src.v1uvnumber_ );
+                    e_.cmp32Imm( X64::rax, offUvV_ + offType_, Value::kNum );
+                    e_.jcc( X64::kA, *stub.entry );
+                    guardRegisterIsPlain( *stub.entry );
+                    e_.load( X64::rcx, X64::rax, offUvV_ + offNum_ );
+                    e_.store( X64::rbx, offR0_ + offNum_, X64::rcx );
+                    e_.load32( X64::rdx, X64::rax, offUvV_ + offType_ );
+                    e_.store32( X64::rbx, offR0_ + offType_, X64::rdx );
+                    e_.bind( *stub.resume );
+                    return true;
                 }
-                OPCODE_END();
+                return false;
 
-#if LCFG_HAVE_TRY_CATCH                
-            OPCODE_LOC(kTryCatch):
+            case kSrcRegisterBool:
+                if (src.v1src_ == kSrcLiteral)
                 {
-                    const Ast::TryCatch* trycatch = reinterpret_cast<const Ast::TryCatch*>(pInstr);
-                    const Ast::Program* p = trycatch->try_; 
-                    inprog = p;
-                    inupvalues = frame.upvalues_;
-                    
-                    pThread->callframe =
-                        new (pThread->rcAlloc_.allocate(sizeof(RunContext)))
-                        RunContext( pThread, TMPFACT_PROG_TO_RUNPROG(inprog), inupvalues );
-
-                    pThread->callframe->catcher = trycatch->catch_;
-                    
-                    goto restartThread;
+                    if (!src.v1literal_.isbool())
+                        return false;
+                    e_.store8Imm( X64::rbx, offRb0_, src.v1literal_.tobool() );
+                    return true;
                 }
-                OPCODE_END();
-
-            OPCODE_LOC(kThrow):
+                else if (src.v1src_ == kSrcUpval)
                 {
-                    RunContext *pframe = &frame;
-
-                    while (pframe && !pframe->catcher)
-                    {
-                        RunContext* prev = pframe->prev;
-//                        std::cerr << "tossing frame, frame=" << pframe << " prev=" << prev << std::endl;
-                        pframe->~RunContext();
-                        pThread->rcAlloc_.deallocate( pframe, sizeof(RunContext) );
-                        pframe = prev;
-                    }
-                    
-                    if (pframe && pframe->catcher)
-                    {
-                        pThread->callframe = pframe;
-//                        std::cerr << "running catch block frame, frame=" << pframe << std::endl;
-                        pframe->rebind( TMPFACT_PROG_TO_RUNPROG(pframe->catcher), inupvalues );
-                        goto restartReturn;
-                    }
-                    else
-                    {
-                        throw AstExecFail( *(frame.ppInstr), "Unhandled exception" ); // ;e.what() );
-//                        bangerr() << 
-                    }
+                    const Stub& stub = slowPath( &move, index );
+                    loadUpval( src.v1uvnumber_ );
+                    e_.cmp32Imm( X64::rax, offUvV_ + offType_, Value::kBool );
+                    e_.jcc( X64::kNE, *stub.entry );
+                    e_.loadZx8( X64::rcx, X64::rax, offUvV_ + offNum_ );
+                    e_.store8( X64::rbx, offRb0_, X64::rcx );
+                    e_.bind( *stub.resume );
+                    return true;
                 }
-                OPCODE_END();
-#endif
+                return false;
 
-            OPCODE_LOC(kIncrement):
-                {
-#if LCFG_TRYJIT
-                    const Ast::Increment& move = *reinterpret_cast<const Ast::Increment*>(pInstr);
-                    double v2 = move.f_op( (void*)frame.upvalues_.get() ); // , (void*)pThread ); //  + 1;
-                    switch (move.dest_)
-                    {
-                        case kSrcStack:      DestSet<kSrcStack>::set( move, pThread, frame, stack, Value( v2 ) ); break;
-                        case kSrcRegister:   DestSet<kSrcRegister>::set( move, pThread, frame, stack, Value( v2 ) ); break;
-                        case kSrcCloseValue: DestSet<kSrcCloseValue>::set( move, pThread, frame, stack, Value( v2 ) ); break;
-                    }
-#endif 
-                }
-                OPCODE_END();
+            default:
+                return false;
+        }
+    }
 
-            OPCODE_LOC(kIncrementReg):
-                {
-#if LCFG_TRYJIT
-                    const Ast::Increment& move = *reinterpret_cast<const Ast::Increment*>(pInstr);
-                    double v2 = move.f_op( pThread ); // , (void*)pThread ); //  + 1;v = SrcGet<kSrcUpval>  ::get( move, pThread, frame ).tonum(); break;
-                    switch (move.dest_)
-                    {
-                        case kSrcStack:      DestSet<kSrcStack>::set( move, pThread, frame, stack, Value( v2 ) ); break;
-                        case kSrcRegister:   DestSet<kSrcRegister>::set( move, pThread, frame, stack, Value( v2 ) ); break;
-                        case kSrcCloseValue: DestSet<kSrcCloseValue>::set( move, pThread, frame, stack, Value( v2 ) ); break;
-                    }
+#if LCFG_NUMEXPR
+    static X64::Xmm numReg( int reg ) { return X64::Xmm( X64::xmm2 + reg ); }
+
+    // The NumExpr registers map straight onto xmm2..xmm15.  All the guards
+    // come before anything is written, so the slow path can simply run the
+    // whole NumExpr over again.
+    bool emitNumExpr( const Ast::NumExpr& ne, int index )
+    {
+        static_assert( Ast::NumExpr::kMaxRegs <= 14, "NumExpr registers must fit in xmm2..xmm15" );
+        if (ne.stackIn_ > 0 || ne.outs_.size() * 8 > kScratch)
+            return false;
+        bool setsRegister = false;
+        for (const Ast::NumExpr::Leaf& leaf : ne.leaves_)
+        {
+            if (!canLoadNum( leaf.src ))
+                return false;
+        }
+        for (const Ast::NumExpr::Out& out : ne.outs_)
+            setsRegister = setsRegister || out.dest.dest_ == kSrcRegister;
+
+        const Stub& stub = slowPath( &ne, index );
+        if (setsRegister)
+            guardRegisterIsPlain( *stub.entry );
+        unsigned l = 0;
+        for (unsigned k = 0; k <= ne.ops_.size(); ++k)
+        {
+            for (; l < ne.leaves_.size() && ne.leaves_[l].at == k; ++l)
+                loadNum( ne.leaves_[l].src, numReg( ne.leaves_[l].reg ), *stub.entry );
+            if (k == ne.ops_.size())
+                break;
+            const Ast::NumExpr::Op& op = ne.ops_[k];
+            e_.movsd( X64::xmm1, numReg( op.other ) );
+            switch (op.op)
+            {
+                case kOpPlus:  e_.addsd( X64::xmm1, numReg( op.thing ) ); break;
+                case kOpMinus: e_.subsd( X64::xmm1, numReg( op.thing ) ); break;
+                case kOpMult:  e_.mulsd( X64::xmm1, numReg( op.thing ) ); break;
+                default:       e_.divsd( X64::xmm1, numReg( op.thing ) ); break;
+            }
+            e_.movsd( numReg( op.dst ), X64::xmm1 );
+        }
+
+        // the push / close helpers are free to trash every xmm register
+        for (unsigned k = 0; k < ne.outs_.size(); ++k)
+            e_.movsdStore( X64::rsp, k * 8, numReg( ne.outs_[k].reg ) );
+        for (unsigned k = 0; k < ne.outs_.size(); ++k)
+        {
+            const Ast::ValueMaker& dest = ne.outs_[k].dest;
+            switch (dest.dest_)
+            {
+                case kSrcRegister:
+                    e_.load( X64::rax, X64::rsp, k * 8 );
+                    e_.store32Imm( X64::rbx, offR0_ + offType_, Value::kNum );
+                    e_.store( X64::rbx, offR0_ + offNum_, X64::rax );
+                    break;
+                case kSrcStack:
+                    e_.mov( X64::rdi, X64::rbx );
+                    e_.movsdLoad( X64::xmm0, X64::rsp, k * 8 );
+                    e_.call( reinterpret_cast<const void*>(&jitPush<double>) );
+                    checkHelper( index );
+                    break;
+                case kSrcCloseValue:
+                    e_.mov( X64::rdi, X64::r12 );
+                    e_.movImm( X64::rsi, reinterpret_cast<uint64_t>(dest.cv_) );
+                    e_.movsdLoad( X64::xmm0, X64::rsp, k * 8 );
+                    e_.call( reinterpret_cast<const void*>(&jitClose<double>) );
+                    checkHelper( index );
+                    break;
+                default:
+                    break;
+            }
+        }
+        e_.bind( *stub.resume );
+        return true;
+    }
 #endif 
-                }
-                OPCODE_END();
 
-            OPCODE_LOC(kIncrementReg2Reg):
-                {
-#if LCFG_TRYJIT
-                    const Ast::Increment& move = *reinterpret_cast<const Ast::Increment*>(pInstr);
-                    move.f_op_void( pThread, frame.upvalues_.get() ); // , (void*)pThread ); //  + 1;v = SrcGet<kSrcUpval>  ::get( move, pThread, frame ).tonum(); break;
-//                     switch (move.dest_)
-//                     {
-//                         case kSrcStack:      DestSet<kSrcStack>::set( move, pThread, frame, stack, Value( v2 ) ); break;
-//                         case kSrcRegister:   DestSet<kSrcRegister>::set( move, pThread, frame, stack, Value( v2 ) ); break;
-//                         case kSrcCloseValue: DestSet<kSrcCloseValue>::set( move, pThread, frame, stack, Value( v2 ) ); break;
-//                     }
+public:
+    JitCompiler()
+    : inlined_( 0 ),
+      offR0_( Thread::r0Offset() ),
+      offRb0_( Thread::rb0Offset() ),
+      offFrameUv_( offsetof( RunContext, upvalues_ ) ),
+      offUvParent_( Upvalue::parentOffset() ),
+      offUvV_( Upvalue::valueOffset() ),
+      offType_( JitLayout::valueType() ),
+      offNum_( JitLayout::valueNum() )
+    {}
+
+    // compiles ast[begin..end); nullptr if there's nothing worth doing natively
+    Ast::JitSegment* compile( const std::vector<Ast::Base*>& ast, unsigned begin, unsigned end )
+    {
+        if (!emit( &ast[begin], end - begin ))
+            return nullptr;
+        Ast::JitSegment* seg = new Ast::JitSegment( end - begin, inlined_ );
+        if (!gJitCache.install( seg->code_, e_, gJitModule ))
+        {
+            delete seg;
+            return nullptr;
+        }
+        return seg;
+    }
+
+    // the same again for seg, whose code was evicted; instrs are what it covers
+    bool recompile( const Ast::JitSegment& seg, const Ast::Base* const* instrs )
+    {
+        return emit( instrs, seg.length_ ) && gJitCache.reinstall( seg.code_, e_ );
+    }
+
+private:
+    // false if there's nothing worth doing natively
+    bool emit( const Ast::Base* const* instrs, unsigned n )
+    {
+        e_.push( X64::rbx );
+        e_.push( X64::r12 );
+        e_.subRsp( 8 + kScratch ); // keep calls 16-byte aligned
+        e_.mov( X64::rbx, X64::rdi );
+        e_.mov( X64::r12, X64::rsi );
+
+        for (unsigned i = 0; i < n; ++i)
+        {
+            const int index = i;
+            const Ast::Base* pInstr = instrs[i];
+            bool done = false;
+            switch (pInstr->instr_)
+            {
+                case Ast::Base::kMove:
+                    done = emitMove( *reinterpret_cast<const Ast::Move*>(pInstr), index );
+                    break;
+                case Ast::Base::kApplyThingAndValue2ValueOperator:
+                    done = emitThingAndValue2Value( *reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(pInstr), index );
+                    break;
+#if LCFG_NUMEXPR
+                case Ast::Base::kNumExpr:
+                    done = emitNumExpr( *reinterpret_cast<const Ast::NumExpr*>(pInstr), index );
+                    break;
 #endif 
-                }
-                OPCODE_END();
+                default:
+                    break;
+            }
+            if (done)
+                ++inlined_;
+            else
+                callGeneric( pInstr, index );
+        }
+        
+        if (inlined_ < 1)
+            return false;
 
-                
-        OPCODE_LOC(kTCOApplyProgram):
+        e_.movImm32( X64::rax, -1 );
+        e_.bind( exit_ );
+        e_.addRsp( 8 + kScratch );
+        e_.pop( X64::r12 );
+        e_.pop( X64::rbx );
+        e_.ret();
+
+        for (unsigned i = 0; i < slow_.size(); ++i) // callGeneric may add to fail_, not slow_
+        {
+            e_.bind( *slow_[i].entry );
+            callGeneric( slow_[i].instr, slow_[i].index );
+            e_.jmp( *slow_[i].resume );
+        }
+        for (auto& f : fail_)
+        {
+            e_.bind( *f.second );
+            e_.movImm32( X64::rax, f.first );
+            e_.jmp( exit_ );
+        }
+        return true;
+    }
+};
+
+// A segment whose code was evicted while it was still being run gets
+// compiled again, a few times at most, so a cache too small for what's hot
+// doesn't spend its time compiling.  If something is still running the old
+// code, it's tried again later.
+void RecompileSegment( const Ast::JitSegment& seg, const Ast::Base* const* instrs )
+{
+    seg.recompiles_.fetch_add( 1, std::memory_order_relaxed );
+    JitCompiler().recompile( seg, instrs );
+    seg.misses_.store( 0, std::memory_order_relaxed );
+}
+
+static void JitCompileAst( std::vector<Ast::Base*>& ast )
+{
+    std::vector<Ast::Base*> out;
+    out.reserve( ast.size() + 2 );
+    for (unsigned i = 0; i < ast.size(); )
+    {
+        if (!isJittable( ast[i] ))
+        {
+            out.push_back( ast[i++] );
+            continue;
+        }
+        unsigned end = i;
+        while (end < ast.size() && isJittable( ast[end] ))
+            ++end;
+        Ast::JitSegment* seg = JitCompiler().compile( ast, i, end );
+        if (seg)
+            out.push_back( seg );
+        out.insert( out.end(), ast.begin() + i, ast.begin() + end );
+        i = end;
+    }
+    ast.swap( out );
+}
+
+//////////////////////////////////////////////////////////////////
+// Tracing JIT for loops.
+//
+// All iteration in Bang! is a self tail call, so kTCOApplyFunRec is the
+// back-edge.  Once one gets hot, we walk one iteration of the loop body
+// using the values about to be passed in, following the branches those
+// values take, and emit a native loop for that path.  Loop-carried
+// parameters live in xmm8..xmm15; each branch on the way becomes a guard.
+//
+// An iteration has no side effects we can't redo: it only reads immutable
+// upvalues and computes numbers and bools.  So a failing guard simply puts
+// the parameters of the iteration it was on back on the stack and lets the
+// interpreter run that iteration again from the top.
+//////////////////////////////////////////////////////////////////
+namespace {
+    const int kHotLoop = 64;            // back-edges seen before we try to record
+    const int kMaxTraceLength = 400;    // instructions in one iteration
+    const int kMaxLoopVars = 8;         // one xmm register each
+    const int kMaxOuterUpvals = 32;
+    const int kMaxRerecords = 4;        // traces recorded again after their code was evicted
+}
+
+class LoopTrace
+{
+public:
+    typedef int (*tfn_trace)( double* loopvars, const double* outer );
+    JitCode code_; // the tfn_trace
+    int nLoopVars_;
+    std::vector<NthParent> outer_; // upvalues of the loop's environment that the trace reads
+    LoopTrace* retiredNext_; // see PushFunctionRec::retired_
+
+    LoopTrace() : retiredNext_( nullptr ) {}
+    ~LoopTrace() { code_.release(); }
+
+    // false when the trace can't take these values; nothing was touched
+    bool run( const Upvalue* env, Stack& stack ) const
+    {
+        const int k = nLoopVars_;
+        double vars[kMaxLoopVars];
+        double outer[kMaxOuterUpvals];
+        if (stack.size() < k)
+            return false;
+        for (int i = 0; i < k; ++i)
+        {
+            const Value& v = stack.nth( k - 1 - i );
+            if (!v.isnum())
+                return false;
+            vars[i] = v.tonum();
+        }
+        for (unsigned j = 0; j < outer_.size(); ++j)
+        {
+            const Value& v = env->getUpValue( outer_[j] );
+            if (!v.isnum())
+                return false;
+            outer[j] = v.tonum();
+        }
+        for (int i = 0; i < k; ++i)
+            stack.pop_back();
+        reinterpret_cast<tfn_trace>(code_.code())( vars, outer );
+        for (int i = 0; i < k; ++i)
+            stack.push( vars[i] );
+        return true;
+    }
+};
+
+class TraceRecorder
+{
+    // a value in the trace, along with what it is on the iteration being recorded
+    struct TVal
+    {
+        enum EKind { kNone, kConst, kLoopVar, kSlot, kOuter } kind;
+        bool isnum;
+        int index;
+        double num;
+        bool b;
+        static TVal number( EKind kind, int index, double num ) { TVal v = { kind, true, index, num, false }; return v; }
+        static TVal boolean( EKind kind, int index, bool b ) { TVal v = { kind, false, index, 0, b }; return v; }
+    };
+    typedef std::vector<TVal> env_t; // [0] is the innermost binding
+
+    X64::Emitter e_;
+    X64::Label head_, exit_;
+    const Ast::Program* loop_;
+    const Upvalue* env_; // the loop's environment, null if it has none
+    int nLoopVars_;
+    std::vector<TVal> vstack_;
+    TVal r0_, rb0_;
+    int nSlots_;
+    std::vector<NthParent> outer_;
+    int length_;
+public:
+    bool retryLater_; // the recorded iteration left the loop; try again on another one
+
+private:
+    static X64::Xmm loopReg( int i ) { return X64::Xmm( X64::xmm8 + i ); }
+    int slotOffset( int slot ) const { return slot * 8; }
+
+    void loadNum( const TVal& v, X64::Xmm x )
+    {
+        switch (v.kind)
+        {
+            case TVal::kConst:
+            {
+                uint64_t bits;
+                memcpy( &bits, &v.num, sizeof(bits) );
+                e_.movImm( X64::rax, bits );
+                e_.movq( x, X64::rax );
+            }
+            break;
+            case TVal::kLoopVar: e_.movsd( x, loopReg( v.index ) ); break;
+            case TVal::kSlot:    e_.movsdLoad( x, X64::rsp, slotOffset( v.index ) ); break;
+            case TVal::kOuter:   e_.movsdLoad( x, X64::rsi, v.index * 8 ); break;
+            default: break;
+        }
+    }
+
+    // bools are only ever constants or computed into a slot
+    void loadBool( const TVal& v, X64::Reg r )
+    {
+        if (v.kind == TVal::kConst)
+            e_.movImm32( r, v.b ? 1 : 0 );
+        else
+            e_.load( r, X64::rsp, slotOffset( v.index ) );
+    }
+
+    bool pop( TVal& v )
+    {
+        if (vstack_.empty())
+            return false;
+        v = vstack_.back();
+        vstack_.pop_back();
+        return true;
+    }
+
+    bool upval( NthParent n, const env_t& env, TVal& v )
+    {
+        const unsigned u = n.toint();
+        if (u < env.size())
+        {
+            v = env[u];
+            return true;
+        }
+        if (!env_)
+            return false;
+        const NthParent o( u - env.size() );
+        const Value& outer = env_->getUpValue( o );
+        if (!outer.isnum())
+            return false;
+        unsigned j = 0;
+        while (j < outer_.size() && outer_[j] != o)
+            ++j;
+        if (j == outer_.size())
+        {
+            if (outer_.size() >= unsigned(kMaxOuterUpvals))
+                return false;
+            outer_.push_back( o );
+        }
+        v = TVal::number( TVal::kOuter, j, outer.tonum() );
+        return true;
+    }
+
+    bool fetch( const Ast::ValueEater& ve, const env_t& env, TVal& v )
+    {
+        switch (ve.v1src_)
+        {
+            case kSrcStack:    return pop( v );
+            case kSrcUpval:    return upval( ve.v1uvnumber_, env, v );
+            case kSrcRegister: v = r0_; return v.kind != TVal::kNone;
+            case kSrcLiteral:
+                if (ve.v1literal_.isnum())
+                    v = TVal::number( TVal::kConst, 0, ve.v1literal_.tonum() );
+                else if (ve.v1literal_.isbool())
+                    v = TVal::boolean( TVal::kConst, 0, ve.v1literal_.tobool() );
+                else
+                    return false;
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    bool store( const Ast::ValueMaker& vm, env_t& env, const TVal& v )
+    {
+        switch (vm.dest_)
+        {
+            case kSrcStack:        vstack_.push_back( v ); return true;
+            case kSrcRegister:     r0_ = v; return true;
+            case kSrcRegisterBool: rb0_ = v; return !v.isnum;
+            case kSrcCloseValue:   env.insert( env.begin(), v ); return true;
+            default:               return false;
+        }
+    }
+
+    // (other OP thing), as NumberOps / BoolOps have it
+    bool binop( EOperators op, const TVal& thing, const TVal& other, TVal& result )
+    {
+        const bool bothConst = thing.kind == TVal::kConst && other.kind == TVal::kConst;
+        const int slot = nSlots_;
+        switch (op)
+        {
+            case kOpPlus: case kOpMinus: case kOpMult: case kOpDiv:
+            {
+                if (!thing.isnum || !other.isnum)
+                    return false;
+                const double n
+                = op == kOpPlus  ? other.num + thing.num
+                : op == kOpMinus ? other.num - thing.num
+                : op == kOpMult  ? other.num * thing.num
+                :                  other.num / thing.num;
+                if (bothConst)
                 {
-                    const Ast::Program* afn = reinterpret_cast<const Ast::Program*>(pInstr); 
-                    frame.rebind( TMPFACT_PROG_TO_RUNPROG(afn) );
-                    goto restartTco;
+                    result = TVal::number( TVal::kConst, 0, n );
+                    return true;
                 }
-            OPCODE_END();
-
-            OPCODE_LOC(kApplyProgram):
+                loadNum( thing, X64::xmm0 );
+                loadNum( other, X64::xmm1 );
+                switch (op)
                 {
-                    const Ast::Program* afn = reinterpret_cast<const Ast::Program*>(pInstr);
-                    inprog = afn;
-                    inupvalues = frame.upvalues_;
-                    goto restartNonTail;
+                    case kOpPlus:  e_.addsd( X64::xmm1, X64::xmm0 ); break;
+                    case kOpMinus: e_.subsd( X64::xmm1, X64::xmm0 ); break;
+                    case kOpMult:  e_.mulsd( X64::xmm1, X64::xmm0 ); break;
+                    default:       e_.divsd( X64::xmm1, X64::xmm0 ); break;
                 }
-            OPCODE_END();
-
-#define KTHREAD_CASE \
-                case Value::kThread: { auto other = v.tothread().get(); other->setcallin(pThread); xferstack(pThread,other); pThread = other; goto restartThread; }
-                
-                /* 150629 Coroutine issue:  Currently, coroutine yield returns to creating thread, not calling thread. */
+                e_.movsdStore( X64::rsp, slotOffset( slot ), X64::xmm1 );
+                result = TVal::number( TVal::kSlot, slot, n );
+            }
+            break;
 
-#if DOT_OPERATOR_INLINE
-            OPCODE_LOC(kApplyIndexOperator):
+            case kOpLt: case kOpGt: case kOpEq:
+            {
+                if (!thing.isnum || !other.isnum)
+                    return false;
+                const bool b
+                = op == kOpLt ? other.num < thing.num
+                : op == kOpGt ? other.num > thing.num
+                :               other.num == thing.num;
+                if (bothConst)
                 {
-                    auto op = reinterpret_cast<const Ast::ApplyIndexOperator*>(pInstr);
-                    
-                    // now apply
-                    switch (op->v1src_)
-                    {
-                        case kSrcUpval:
-                        {
-                            const Value& owner = FRVE2UV(frame, *op); 
-//                             std::cerr << "kApplyIndexOperator, owner=";
-//                             owner.dump(std::cerr);
-//                             std::cerr << " indexV st=" << op->indexValue_.sourceType() << std::endl;
-                            switch (op->indexValue_.sourceType())
-                            {
-                                case kSrcLiteral:  owner.applyIndexOperator( op->indexValue_.v1literal_, stack, frame ); break;
-                                case kSrcStack:    owner.applyIndexOperator( stack.pop(), stack, frame ); break;
-                                case kSrcUpval:    owner.applyIndexOperator( FRVE2UV(frame, op->indexValue_), stack, frame ); break;
-                                case kSrcRegister: owner.applyIndexOperator( frame.thread->r0_, stack, frame ); break;
-                                default: break;
-                            }
-                        }
-                        break;
-                        
-                        case kSrcStack:
-                        {
-                            const Value& owner = stack.pop();
-                            switch (op->indexValue_.sourceType())
-                            {
-                                case kSrcLiteral:  owner.applyIndexOperator( op->indexValue_.v1literal_, stack, frame ); break;
-                                case kSrcStack:    owner.applyIndexOperator( stack.pop(), stack, frame ); break;
-                                case kSrcUpval:    owner.applyIndexOperator( FRVE2UV(frame, op->indexValue_ ), stack, frame ); break;
-                                case kSrcRegister: owner.applyIndexOperator( frame.thread->r0_, stack, frame ); break;
-                                default: break;
-                            }
-                        }
-                        break;
-                        
-                        case kSrcAltStack:
-                        {
-                            const Value& owner = pThread->altstack.pop();
-                            switch (op->indexValue_.sourceType())
-                            {
-                                case kSrcLiteral:  owner.applyIndexOperator( op->indexValue_.v1literal_, stack, frame ); break;
-                                case kSrcStack:    owner.applyIndexOperator( stack.pop(), stack, frame ); break;
-                                case kSrcUpval:    owner.applyIndexOperator( FRVE2UV(frame, op->indexValue_), stack, frame ); break;
-                                case kSrcRegister: owner.applyIndexOperator( frame.thread->r0_, stack, frame ); break;
-                                default: break;
-                            }
-                        }
-                        break;
-                    }
+                    result = TVal::boolean( TVal::kConst, 0, b );
+                    return true;
                 }
-            OPCODE_END();
-#endif 
-                
-            OPCODE_LOC(kTCOApply):
+                loadNum( thing, X64::xmm0 );
+                loadNum( other, X64::xmm1 );
+                e_.movImm32( X64::rax, 0 );
+                e_.movImm32( X64::rcx, 0 );
+                switch (op)
                 {
-                    auto op = reinterpret_cast<const Ast::Apply*>(pInstr);
-                    switch( op->v1src_ )
-                    {
-                        case kSrcStack:
-                        {
-                            const Value& v = stack.pop();
-                            switch (v.type())
-                            {
-                                default: RunApplyValue( pInstr, v, stack, frame ); break;
-                                    //~~~ should this setcallin? as with KTHREAD_CASE? or is it intentionally different
-                                case Value::kThread: { auto other = v.tothread().get(); xferstack(pThread,other); pThread = other; goto restartThread; }
-                                case Value::kBoundFun:
-                                    auto pbound = v.toboundfunhold();
-                                    frame.rebind( TMPFACT_PROG_TO_RUNPROG(pbound->program_), pbound->upvalues_ );
-                                    goto restartTco;
-                            }
-                        }
+                    case kOpGt:
+                        e_.ucomisd( X64::xmm1, X64::xmm0 );
+                        e_.setcc( X64::kA, X64::rax );
                         break;
-                        case kSrcUpval:
-                        {
-                            const Value& v = FRVE2UV(frame, *op);
-                            switch (v.type())
-                            {
-                                default: RunApplyValue( pInstr, v, stack, frame ); break;
-                                    //~~~ should this setcallin? as with KTHREAD_CASE? or is it intentionally different
-                                case Value::kThread: { auto other = v.tothread().get(); xferstack(pThread,other); pThread = other; goto restartThread; }
-                                case Value::kBoundFun:
-                                    auto pbound = v.toboundfunhold();
-                                    frame.rebind( TMPFACT_PROG_TO_RUNPROG(pbound->program_), pbound->upvalues_ );
-                                    goto restartTco;
-                            }
-                        }
+                    case kOpLt:
+                        e_.ucomisd( X64::xmm0, X64::xmm1 );
+                        e_.setcc( X64::kA, X64::rax );
+                        break;
+                    default:
+                        e_.ucomisd( X64::xmm1, X64::xmm0 );
+                        e_.setcc( X64::kE, X64::rax );
+                        e_.setcc( X64::kNP, X64::rcx );
+                        e_.and8( X64::rax, X64::rcx );
                         break;
-                    }
                 }
-            OPCODE_END();
+                e_.store( X64::rsp, slotOffset( slot ), X64::rax );
+                result = TVal::boolean( TVal::kSlot, slot, b );
+            }
+            break;
 
-            OPCODE_LOC(kApply):
+            case kOpAnd: case kOpOr:
+            {
+                if (thing.isnum || other.isnum)
+                    return false;
+                const bool b = op == kOpAnd ? (other.b && thing.b) : (other.b || thing.b);
+                if (bothConst)
                 {
-                    auto op = reinterpret_cast<const Ast::Apply*>(pInstr);
-                    switch( op->v1src_ )
-                    {
-                        case kSrcStack:
-                        {
-                            const Value& v = stack.pop();
-                            switch (v.type())
-                            {
-                                default: RunApplyValue( pInstr, v, stack, frame ); break;
-                                    KTHREAD_CASE    
-                                case Value::kBoundFun:
-                                auto pbound = v.toboundfun();
-                                inprog = pbound->program_;
-                                inupvalues = pbound->upvalues_;
-                                goto restartNonTail;
-                            }
-                        }
-                        break;
-                        case kSrcUpval:
-                        {
-                            const Value& v = FRVE2UV(frame, *op); //
-                            switch (v.type())
-                            {
-                                default: RunApplyValue( pInstr, v, stack, frame ); break;
-                                    KTHREAD_CASE    
-                                case Value::kBoundFun:
-                                auto pbound = v.toboundfun();
-                                inprog = pbound->program_;
-                                inupvalues = pbound->upvalues_;
-                                goto restartNonTail;
-                            }
-                        }
-                        break;
-                    }
+                    result = TVal::boolean( TVal::kConst, 0, b );
+                    return true;
                 }
-            OPCODE_END();
-#if LCFG_COMPUTED_GOTO
-            } while( 0 );
-#else
-            } // end,instr switch
-#endif 
-        } // end, while loop incrementing PC
+                loadBool( thing, X64::rax );
+                loadBool( other, X64::rcx );
+                if (op == kOpAnd)
+                    e_.and32( X64::rax, X64::rcx );
+                else
+                    e_.or32( X64::rax, X64::rcx );
+                e_.store( X64::rsp, slotOffset( slot ), X64::rax );
+                result = TVal::boolean( TVal::kSlot, slot, b );
+            }
+            break;
 
+            default:
+                return false;
+        }
+        ++nSlots_;
+        return true;
     }
-    catch (const std::runtime_error& e)
+
+    // does the path leave through a guard here?
+    void guard( const TVal& cond )
     {
-        // duplicate code from kThrow
-#if LCFG_HAVE_TRY_CATCH        
-                    RunContext *pframe = &frame;
+        if (cond.kind == TVal::kConst)
+            return;
+        loadBool( cond, X64::rax );
+        e_.test32( X64::rax, X64::rax );
+        e_.jcc( cond.b ? X64::kE : X64::kNE, exit_ );
+    }
 
-                    while (pframe && !pframe->catcher)
+    bool recordSimple( const Ast::Base* pInstr, env_t& env )
+    {
+        if (pInstr->instr_ == Ast::Base::kMove)
+        {
+            const Ast::Move& move = *reinterpret_cast<const Ast::Move*>(pInstr);
+            TVal v;
+            return fetch( move.source(), env, v ) && store( move, env, v );
+        }
+#if LCFG_LICM
+        if (pInstr->instr_ == Ast::Base::kLoopInvariant)
+        {
+            // the hoisted value is just another number from outside
+            const Ast::LoopInvariant& li = *reinterpret_cast<const Ast::LoopInvariant*>(pInstr);
+            TVal v;
+            return fetch( li.src_, env, v ) && store( li, env, v );
+        }
+#endif 
+        const Ast::ApplyThingAndValue2ValueOperator& pa = *reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(pInstr);
+        TVal thing, other, result;
+        if (pa.argSwap_)
+            return false;
+        if (!fetch( pa, env, thing ) || !fetch( pa.secondsrc_, env, other ))
+            return false;
+        return binop( pa.openum_, thing, other, result ) && store( pa, env, result );
+    }
+
+    enum ERecord { kAbort, kReturned, kClosedLoop };
+
+    // follows p along the path this iteration takes; depth counts the
+    // non-tail if/else frames we're inside of
+    ERecord record( const Ast::Program* p, env_t env, int depth )
+    {
+        const auto& ast = *p->getAst();
+        for (unsigned i = 0; i < ast.size(); ++i)
+        {
+            if (++length_ > kMaxTraceLength)
+                return kAbort;
+            const Ast::Base* pInstr = ast[i];
+            switch (pInstr->instr_)
+            {
+                case Ast::Base::kJitSegment:
+                case Ast::Base::kNumSpecEntry:
+                    break; // the instructions it covers follow
+
+                case Ast::Base::kCloseValue:
+                {
+                    TVal v;
+                    if (!pop( v ))
+                        return kAbort;
+                    env.insert( env.begin(), v );
+                }
+                break;
+
+                case Ast::Base::kMove:
+                case Ast::Base::kApplyThingAndValue2ValueOperator:
+                case Ast::Base::kLoopInvariant:
+                    if (!recordSimple( pInstr, env ))
+                        return kAbort;
+                    break;
+
+#if LCFG_NUMEXPR
+                case Ast::Base::kNumExpr:
+                    // the trace keeps everything in registers anyway
+                    for (const Ast::Base* op : reinterpret_cast<const Ast::NumExpr*>(pInstr)->origOps_)
                     {
-                        RunContext* prev = pframe->prev;
-//                        std::cerr << "tossing frame, frame=" << pframe << " prev=" << prev << std::endl;
-                        pframe->~RunContext();
-                        pThread->rcAlloc_.deallocate( pframe, sizeof(RunContext) );
-                        pframe = prev;
+                        if (!recordSimple( op, env ))
+                            return kAbort;
                     }
-                    
-                    if (pframe && pframe->catcher)
+                    break;
+#endif 
+
+                case Ast::Base::kIfElse:
+                case Ast::Base::kTCOIfElse:
+                {
+                    const Ast::IfElse& ifelse = *reinterpret_cast<const Ast::IfElse*>(pInstr);
+                    TVal cond;
+                    if (ifelse.boolSource() == kSrcStack)
                     {
-                        pThread->callframe = pframe;
-//                        std::cerr << "running catch block frame, frame=" << pframe << std::endl;
-                        pframe->rebind( TMPFACT_PROG_TO_RUNPROG(pframe->catcher), inupvalues );
-                        goto restartReturn;
+                        if (!pop( cond ))
+                            return kAbort;
                     }
                     else
-#endif 
+                        cond = rb0_;
+                    if (cond.kind == TVal::kNone || cond.isnum)
+                        return kAbort;
+                    guard( cond );
+                    const Ast::Program* taken = cond.b ? ifelse.ifBranch() : ifelse.elseBranch();
+                    if (!taken)
+                        break;
+                    if (pInstr->instr_ == Ast::Base::kTCOIfElse)
+                        return record( taken, env, depth ); // same frame, never comes back here
+                    const ERecord r = record( taken, env, depth + 1 );
+                    if (r != kReturned)
+                        return kAbort;
+                }
+                break;
+
+                case Ast::Base::kTCOApplyFunRec:
+                {
+                    const Ast::PushFunctionRec& afn = *reinterpret_cast<const Ast::PushFunctionRec*>(pInstr);
+                    const NthParent nth = afn.bindingParent();
+                    if (depth != 0 || afn.recFun() != loop_)
+                        return kAbort;
+                    if (env_ ? nth != NthParent( env.size() ) : nth != kNoParent)
+                        return kAbort; // not a call back into the same environment
+                    if (int(vstack_.size()) != nLoopVars_)
+                        return kAbort;
+                    for (int n = 0; n < nLoopVars_; ++n)
                     {
-        throw AstExecFail( *(frame.ppInstr), e.what() );
-//                        bangerr() << "Unhandled exception";
+                        if (!vstack_[n].isnum)
+                            return kAbort;
+                        loadNum( vstack_[n], X64::Xmm( X64::xmm0 + n ) );
                     }
-        
-    }
-}
-
+                    for (int n = 0; n < nLoopVars_; ++n)
+                        e_.movsd( loopReg( n ), X64::Xmm( X64::xmm0 + n ) );
+                    e_.jmp( head_ );
+                    return kClosedLoop;
+                }
 
+                case Ast::Base::kBreakProg:
+                    if (depth > 0)
+                        return kReturned;
+                    retryLater_ = true; // this iteration is the one leaving the loop
+                    return kAbort;
 
+                default:
+                    return kAbort;
+            }
+        }
+        return kAbort;
+    }
 
-    DLLEXPORT void CallIntoSuspendedCoroutine( Bang::Thread *bthread, const BoundProgram* bprog )
+public:
+    TraceRecorder( const Ast::Program* loop, const Upvalue* env )
+    : loop_( loop ), env_( env ), nLoopVars_( 0 ), nSlots_( 0 ), length_( 0 ), retryLater_( false )
     {
-        // this is an awful mess.
-        auto prevcaller = bthread->pCaller;
-        auto prevcf = bthread->callframe;
-        bthread->pCaller = nullptr;
-        bthread->callframe = nullptr;
-        // auto bprog = v->toboundfun(); 
-        Bang::RunProgram( bthread, bprog->program_, bprog->upvalues_ );
-        bthread->pCaller = prevcaller;
-        bthread->callframe = prevcf;
+        r0_.kind = rb0_.kind = TVal::kNone;
     }
 
-
-//     DLLEXPORT void FromCStackRunProgramInCurrentContext( const RunContext& rc, const Ast::Program* prog )
-//     {
-//         Bang::Thread* bthread = rc.thread;
-//         // this is an awful mess.
-//         auto prevcaller = bthread->pCaller;
-//         auto prevcf = bthread->callframe;
-//         bthread->pCaller = nullptr;
-//         bthread->callframe = nullptr;
-//         // auto bprog = v->toboundfun(); 
-//         Bang::RunProgram( bthread, prog, rc.upvalues_ );
-//         bthread->pCaller = prevcaller;
-//         bthread->callframe = prevcf;
-//     }
-    
-    
-    void Function::customOperator( const bangstring& theOperator, Stack& s)
+    LoopTrace* record( const Stack& stack, unsigned module )
     {
-        bangerr() << "Vanilla Function does not support customOperator=" << theOperator;
+        const auto& ast = *loop_->getAst();
+        for (unsigned i = 0; i < ast.size(); ++i)
+        {
+            if (ast[i]->instr_ == Ast::Base::kCloseValue)
+                ++nLoopVars_;
+            else if (ast[i]->instr_ != Ast::Base::kJitSegment && ast[i]->instr_ != Ast::Base::kNumSpecEntry)
+                break;
+        }
+        if (nLoopVars_ < 1 || nLoopVars_ > kMaxLoopVars || stack.size() < nLoopVars_)
+            return nullptr;
+
+        for (int i = 0; i < nLoopVars_; ++i)
+        {
+            const Value& v = stack.nth( nLoopVars_ - 1 - i );
+            if (!v.isnum())
+                return nullptr;
+            vstack_.push_back( TVal::number( TVal::kLoopVar, i, v.tonum() ) );
+        }
+
+        e_.push( X64::r12 );
+        e_.mov( X64::r12, X64::rdi );
+        e_.subRsp( kMaxTraceLength * 8 );
+        for (int i = 0; i < nLoopVars_; ++i)
+            e_.movsdLoad( loopReg( i ), X64::r12, i * 8 );
+        e_.bind( head_ );
+
+        if (record( loop_, env_t(), 0 ) != kClosedLoop)
+            return nullptr;
+
+        e_.bind( exit_ );
+        for (int i = 0; i < nLoopVars_; ++i)
+            e_.movsdStore( X64::r12, i * 8, loopReg( i ) );
+        e_.movImm32( X64::rax, 1 );
+        e_.addRsp( kMaxTraceLength * 8 );
+        e_.pop( X64::r12 );
+        e_.ret();
+
+        LoopTrace* trace = new LoopTrace;
+        if (!gJitCache.install( trace->code_, e_, module ))
+        {
+            delete trace;
+            return nullptr;
+        }
+        trace->nLoopVars_ = nLoopVars_;
+        trace->outer_ = outer_;
+        return trace;
     }
+};
 
-    void Function::indexOperator( const Value& theIndex, Stack& stack, const RunContext& ctx )
+// called by RunProgram on every kTCOApplyFunRec with -jit; may run any
+// number of iterations of the loop natively before the interpreter goes on
+void RunHotLoop( const Ast::PushFunctionRec* afn, Stack& stack, RunContext& frame )
+{
+    if (afn->hotness_.load( std::memory_order_relaxed ) < 0)
+        return;
+    const Upvalue* env = (afn->bindingParent() == kNoParent) ? nullptr : frame.nthBindingParent( afn->bindingParent() ).get();
+    LoopTrace* recorded = afn->trace_.load( std::memory_order_acquire );
+    if (!recorded)
     {
-        stack.push( theIndex );
-        this->apply( stack );
+        if (afn->hotness_.fetch_add( 1, std::memory_order_relaxed ) + 1 < kHotLoop)
+            return;
+#if LCFG_MT_SAFEISH
+        // someone else is recording just now; go on interpreting meanwhile
+        std::unique_lock<std::recursive_mutex> lock( isolateState().lateCompile, std::try_to_lock );
+        if (!lock.owns_lock() || afn->trace_.load( std::memory_order_acquire ))
+            return;
+#endif 
+        TraceRecorder recorder( afn->recFun(), env );
+        recorded = recorder.record( stack, afn->jitModule_ );
+        if (!recorded)
+        {
+            afn->hotness_.store( recorder.retryLater_ ? 0 : -1, std::memory_order_relaxed );
+            return;
+        }
+        afn->trace_.store( recorded, std::memory_order_release );
     }
-
-    void BoundProgram::indexOperator( const Value& theIndex, Stack& stack, const RunContext& ctx )
+    LoopTrace& trace = *recorded;
+    if (!trace.code_.enter())
     {
-        stack.push( theIndex );
-        CallIntoSuspendedCoroutine( ctx.thread, this );
+        // evicted; record it again once it's hot again, a few times at most
+        // so a cache too small for what's hot doesn't spend its time
+        // recording.  The old trace is kept in case another thread is still
+        // looking at it.
+        if (afn->trace_.compare_exchange_strong( recorded, nullptr, std::memory_order_acq_rel ))
+        {
+            LoopTrace* head = afn->retired_.load( std::memory_order_relaxed );
+            do
+                recorded->retiredNext_ = head;
+            while (!afn->retired_.compare_exchange_weak( head, recorded, std::memory_order_release ));
+            const bool again = afn->rerecords_.fetch_add( 1, std::memory_order_relaxed ) + 1 < kMaxRerecords;
+            afn->hotness_.store( again ? 0 : -1, std::memory_order_relaxed );
+        }
+        return;
     }
-    
-    
-    void BoundProgram::apply( Stack& s )
+    trace.run( env, stack );
+    trace.code_.leave();
+}
+
+Ast::PushFunctionRec::~PushFunctionRec()
+{
+    delete trace_.load();
+    for (LoopTrace* t = retired_.load(); t; )
     {
-        // this is handled in main RunProgram machine
-        throw std::runtime_error("BoundProgram::Apply should not be called");
+        LoopTrace* next = t->retiredNext_;
+        delete t;
+        t = next;
     }
+}
+#endif // LCFG_X64JIT
 
-    
-    void Ast::Program::run( Stack& stack, const RunContext& rc ) const
+#if LCFG_NUMEXPR
+namespace {
+    // Simulates the stack and r0_ over a run of instructions, handing out
+    // NumExpr registers for the values instead.  add() refuses anything it
+    // can't take without changing what the run does.
+    bool NumExprOperator( EOperators op )
     {
-        stack.push( NEW_BANGFUN(BoundProgram, this, rc.upvalues() ) );
+        return op == kOpPlus || op == kOpMinus || op == kOpMult || op == kOpDiv;
     }
 
+    class NumExprBuilder
+    {
+        Ast::NumExpr ne_;
+        std::vector<int> vstack_;  // registers for what the run has pushed so far
+        std::vector<int> free_;
+        int r0_;                   // register mirroring r0_, -1 if not yet seen
+        bool r0Written_;
+        bool closed_;              // made an upvalue; later upval numbers would be off
+        int nOps_;
 
-SHAREDUPVALUE_CREF RunContext::upvalues() const
-{
-    return upvalues_;
-}
+        int alloc()
+        {
+            if (free_.empty())
+                return -1;
+            const int reg = free_.back();
+            free_.pop_back();
+            return reg;
+        }
 
-SHAREDUPVALUE_CREF RunContext::nthBindingParent( const NthParent n ) const
-{
-    return n == NthParent(0) ? upvalues_ : upvalues_->nthParent( n );
-}
-    
-const Value& RunContext::getUpValue( NthParent uvnumber ) const
-{
-    return upvalues_->getUpValue( uvnumber );
-}
+        // a consumed value's register can go, except r0_'s, which may be read again
+        void release( int reg )
+        {
+            if (reg != r0_)
+                free_.push_back( reg );
+        }
 
-const Value& RunContext::getUpValue( const bangstring& uvName ) const
-{
-    return upvalues_->getUpValue( uvName );
-}
+        bool fetch( const Ast::ValueEater& ve, int& reg )
+        {
+            if (ve.v1src_ == kSrcStack && !vstack_.empty())
+            {
+                reg = vstack_.back();
+                vstack_.pop_back();
+                return true;
+            }
+            if (ve.v1src_ == kSrcRegister && r0_ >= 0)
+            {
+                reg = r0_;
+                return true;
+            }
+            if (ve.v1src_ == kSrcLiteral && !ve.v1literal_.isnum())
+                return false;
+            if (ve.v1src_ != kSrcStack && ve.v1src_ != kSrcUpval && ve.v1src_ != kSrcRegister && ve.v1src_ != kSrcLiteral)
+                return false;
+            reg = alloc();
+            if (reg < 0)
+                return false;
+            Ast::NumExpr::Leaf leaf = { ve, reg, ve.v1src_ == kSrcStack ? ne_.stackIn_++ : 0, unsigned(ne_.ops_.size()) };
+            ne_.leaves_.push_back( leaf );
+            if (ve.v1src_ == kSrcRegister)
+                r0_ = reg;
+            return true;
+        }
 
-void Ast::PushFunctionRec::run( Stack& stack, const RunContext& rc ) const
-{
-    SHAREDUPVALUE uv =
-        (this->nthparent_ == kNoParent) ? SHAREDUPVALUE() : rc.nthBindingParent( this->nthparent_ );
-    stack.push( NEW_BANGFUN(BoundProgram, pRecFun_, uv ) ); //STATIC_CAST_TO_BANGFUN(newfun) );
-}
+        bool store( const Ast::ValueMaker& vm, int reg )
+        {
+            switch (vm.dest_)
+            {
+                case kSrcStack:
+                    vstack_.push_back( reg );
+                    return true;
+                case kSrcRegister:
+                {
+                    const int old = r0_;
+                    r0_ = reg;
+                    if (old >= 0 && old != reg)
+                        free_.push_back( old );
+                    r0Written_ = true;
+                    return true;
+                }
+                case kSrcCloseValue:
+                {
+                    Ast::NumExpr::Out out = { vm, reg };
+                    ne_.outs_.push_back( out );
+                    closed_ = true;
+                    return true;
+                }
+                default:
+                    return false;
+            }
+        }
 
-void Ast::PushPrimitive::run( Stack& stack, const RunContext& rc ) const
-{
-    if (apply_)
-        primitive_( stack, rc );
-    else
-        stack.push( primitive_ );
-};
+    public:
+        NumExprBuilder()
+        : r0_( -1 ), r0Written_( false ), closed_( false ), nOps_( 0 )
+        {
+            for (int reg = Ast::NumExpr::kMaxRegs - 1; reg >= 0; --reg)
+                free_.push_back( reg );
+        }
 
-void Ast::Move::run( Stack& stack, const RunContext& rc) const
-{
-    bangerr() << "Move::run() should not be called";
-//     if (hasApply())
-//         bangerr() << "should not be calling run for ApplyUpval";
-//     stack.push( rc.getUpValue( uvnumber_ ) );
-};
+        bool add( const Ast::Base* pInstr )
+        {
+            if (closed_)
+                return false;
+            switch (pInstr->instr_)
+            {
+                case Ast::Base::kMove:
+                {
+                    const Ast::Move& move = *reinterpret_cast<const Ast::Move*>(pInstr);
+                    if (move.source().v1src_ != kSrcUpval && move.source().v1src_ != kSrcLiteral)
+                        return false;
+                    int reg;
+                    if (!fetch( move.source(), reg ) || !store( move, reg ))
+                        return false;
+                }
+                break;
 
+                case Ast::Base::kApplyThingAndValue2ValueOperator:
+                {
+                    const Ast::ApplyThingAndValue2ValueOperator& pa = *reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(pInstr);
+                    const EOperators op = pa.openum_;
+                    if (pa.argSwap_ || !NumExprOperator( op ))
+                        return false;
+                    int thing, other;
+                    if (!fetch( pa, thing ) || !fetch( pa.secondsrc_, other ))
+                        return false;
+                    release( thing );
+                    if (other != thing)
+                        release( other );
+                    const int dst = alloc();
+                    if (dst < 0)
+                        return false;
+                    Ast::NumExpr::Op o = { op, dst, thing, other };
+                    ne_.ops_.push_back( o );
+                    if (!store( pa, dst ))
+                        return false;
+                    ++nOps_;
+                }
+                break;
 
-void Ast::MakeCoroutine::go( Stack& stack, Thread* incaller )
-{
-    // virtual void run( Stack& stack, const RunContext& ) const;
-    const Value& v = stack.pop(); // function basis for coroutine
-    
-    if (!v.isboundfun())
-        throw std::runtime_error("MakeCoroutine requires a bound function");
-    
-    auto thread = NEW_BANGTHREAD( v.tofun() );
+#if LCFG_LICM
+                case Ast::Base::kLoopInvariant:
+                {
+                    // a move from the value hoisted for it; if that isn't a
+                    // number, origOps_ run and it sorts itself out
+                    const Ast::LoopInvariant& li = *reinterpret_cast<const Ast::LoopInvariant*>(pInstr);
+                    if (li.orig_->instr_ != Ast::Base::kNumExpr
+                        && !NumExprOperator( reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(li.orig_)->openum_ ))
+                        return false;
+                    int reg;
+                    if (li.dest_ == kSrcRegisterBool || !fetch( li.src_, reg ) || !store( li, reg ))
+                        return false;
+                }
+                break;
+#endif 
 
-    stack.push( Value(thread) );
+                default:
+                    return false;
+            }
+            ne_.origOps_.push_back( pInstr );
+            return true;
+        }
+
+        // one operator would just be the original instruction with extra steps
+        bool worthIt() const { return nOps_ >= 2; }
+
+        Ast::NumExpr* make()
+        {
+            Ast::NumExpr* ne = new Ast::NumExpr( ne_ );
+            std::vector<Ast::NumExpr::Out> outs;
+            for (int reg : vstack_)
+            {
+                Ast::ValueMaker vm;
+                Ast::NumExpr::Out out = { vm, reg };
+                outs.push_back( out );
+            }
+            if (r0Written_)
+            {
+                Ast::ValueMaker vm;
+                vm.setDestRegister();
+                Ast::NumExpr::Out out = { vm, r0_ };
+                outs.push_back( out );
+            }
+            outs.insert( outs.end(), ne_.outs_.begin(), ne_.outs_.end() ); // the new upvalue, if any
+            ne->outs_.swap( outs );
+            return ne;
+        }
+    };
 }
-    
 
-#if HAVE_MUTATION    
-void Ast::SetUpval::run( Stack& stack, const RunContext& rc) const
-{
-    const Value& v = rc.getUpValue( uvnumber_ );
-    const_cast<Value&>(v) = stack.pop(); // see the sort of horrible things mutation forces me to do
-};
-#endif 
-    
-// this nearly lets us create a sort of hash table / record / object system!
-//
-// This is really sort of 'experiment' code to make a quick&dirty object system /
-// immutable record sort of thing
-void Ast::PushUpvalByName::run( Stack& stack, const RunContext& rc) const
+// Replaces each run of two or more arithmetic operators (and the moves
+// feeding them) with a NumExpr.
+static void BuildNumExprs( std::vector<Ast::Base*>& ast )
 {
-    if (!stack.loc_top().isstr())
+    for (unsigned i = 0; i < ast.size(); ++i)
     {
-        throw std::runtime_error("PushUpvalByName (lookup) name is not string" );
+        NumExprBuilder builder;
+        unsigned end = i;
+        for (; end < ast.size(); ++end)
+        {
+            NumExprBuilder trial( builder );
+            if (!trial.add( ast[end] ))
+                break;
+            builder = trial;
+        }
+        if (builder.worthIt())
+        {
+            ast[i] = builder.make();
+            ast.erase( ast.begin() + i + 1, ast.begin() + end );
+        }
     }
-
-    bangstring uvname = stack.poptostr();
-    stack.push( rc.getUpValue( uvname ) );
 }
+#endif 
 
+#if LCFG_NUMSPEC
+namespace {
+    // Walks a function body the way the interpreter would, but with types
+    // instead of values, writing the NumSpecEntry code as it goes.  Every
+    // path through the body must end in a return with the same number and
+    // types of values, a self tail call (a loop) or a self call; anything
+    // else (other calls, strings, ...) and the function isn't specialized.
+    class NumSpecCompiler
+    {
+        typedef Ast::NumSpecEntry Spec;
+        struct SVal { int reg; bool isbool; };
+        struct State
+        {
+            std::vector<SVal> vstack;
+            std::vector<SVal> env; // [0] is the innermost binding
+            SVal r0, rb0;          // reg < 0 when not known here
+        };
+        // where the paths out of a non-tail if/else come back together
+        struct Join
+        {
+            bool shaped;
+            std::vector<SVal> vals;
+            std::vector<unsigned> fixups;
+            Join() : shaped( false ) {}
+        };
 
-bool iseof(int c)
-{
-    return c == EOF;
-}
+        const Ast::Program* fun_;
+        Spec& spec_;
+        bool haveSig_;
+        bool outerViaNoParent_; // a self call that drops the environment
+        std::vector<bool> sig_;
 
-struct ErrorNoMatch
-{
-    ErrorNoMatch() {}
-};
+        int newReg() { return spec_.nRegs_++; }
 
-    int RegurgeIo::getcud()
-    {
-        char rv;
-        
-        if (regurg_.empty())
-            return EOF;
+        unsigned emit( Spec::EOp op, int dst, int a = 0, int b = 0, double k = 0 )
+        {
+            Spec::Instr in = { op, dst, a, b, k };
+            spec_.code_.push_back( in );
+            return spec_.code_.size() - 1;
+        }
 
-        rv = regurg_.back();
-        regurg_.pop_back();
+        bool pop( State& s, SVal& v )
+        {
+            if (s.vstack.empty())
+                return false;
+            v = s.vstack.back();
+            s.vstack.pop_back();
+            return true;
+        }
 
-        return rv;
-    }
-    
+        bool fetch( const Ast::ValueEater& ve, State& s, SVal& v )
+        {
+            switch (ve.v1src_)
+            {
+                case kSrcStack:
+                    return pop( s, v );
+                case kSrcUpval:
+                {
+                    const unsigned u = ve.v1uvnumber_.toint();
+                    if (u < s.env.size())
+                    {
+                        v = s.env[u];
+                        return true;
+                    }
+                    const NthParent o( u - s.env.size() );
+                    unsigned j = 0;
+                    while (j < spec_.outer_.size() && spec_.outer_[j] != o)
+                        ++j;
+                    if (j == spec_.outer_.size())
+                    {
+                        if (j >= unsigned(Spec::kMaxOuter))
+                            return false;
+                        spec_.outer_.push_back( o );
+                    }
+                    v.reg = newReg();
+                    v.isbool = false;
+                    emit( Spec::kOuter, v.reg, j );
+                    return true;
+                }
+                case kSrcRegister:
+                    v = s.r0;
+                    return v.reg >= 0;
+                case kSrcLiteral:
+                    if (!ve.v1literal_.isnum() && !ve.v1literal_.isbool())
+                        return false;
+                    v.isbool = ve.v1literal_.isbool();
+                    v.reg = newReg();
+                    emit( Spec::kConst, v.reg, 0, 0, v.isbool ? double(ve.v1literal_.tobool()) : ve.v1literal_.tonum() );
+                    return true;
+                default:
+                    return false;
+            }
+        }
 
-class StreamMark : public RegurgeStream
-{
-    RegurgeStream& stream_;
-    std::string consumned_;
-    //StreamMark( const StreamMark&  );
-    StreamMark& operator=( const StreamMark& );
-public:
-    StreamMark( RegurgeStream& stream )
-    : stream_( stream )
-    {}
-    StreamMark( StreamMark& stream )
-    : stream_( stream )
-    {}
+        bool store( const Ast::ValueMaker& vm, State& s, const SVal& v )
+        {
+            switch (vm.dest_)
+            {
+                case kSrcStack:        s.vstack.push_back( v ); return true;
+                case kSrcRegister:     s.r0 = v; return true;
+                case kSrcRegisterBool: s.rb0 = v; return v.isbool;
+                case kSrcCloseValue:   s.env.insert( s.env.begin(), v ); return true;
+                default:               return false;
+            }
+        }
 
-    virtual std::string sayWhere() const {
-        return stream_.sayWhere();
-    }
+        bool simple( const Ast::Base* pInstr, State& s )
+        {
+            if (pInstr->instr_ == Ast::Base::kMove)
+            {
+                const Ast::Move& move = *reinterpret_cast<const Ast::Move*>(pInstr);
+                SVal v;
+                return fetch( move.source(), s, v ) && store( move, s, v );
+            }
+            if (pInstr->instr_ != Ast::Base::kApplyThingAndValue2ValueOperator)
+                return false;
+            const Ast::ApplyThingAndValue2ValueOperator& pa = *reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(pInstr);
+            SVal thing, other;
+            if (pa.argSwap_ || !fetch( pa, s, thing ) || !fetch( pa.secondsrc_, s, other ))
+                return false;
+            Spec::EOp op;
+            bool wantBools = false, givesBool = true;
+            switch (pa.openum_)
+            {
+                case kOpPlus:  op = Spec::kAdd; givesBool = false; break;
+                case kOpMinus: op = Spec::kSub; givesBool = false; break;
+                case kOpMult:  op = Spec::kMul; givesBool = false; break;
+                case kOpDiv:   op = Spec::kDiv; givesBool = false; break;
+                case kOpLt:    op = Spec::kLt; break;
+                case kOpGt:    op = Spec::kGt; break;
+                case kOpEq:    op = Spec::kEq; break;
+                case kOpAnd:   op = Spec::kAnd; wantBools = true; break;
+                case kOpOr:    op = Spec::kOr;  wantBools = true; break;
+                default: return false;
+            }
+            if (thing.isbool != wantBools || other.isbool != wantBools)
+                return false;
+            SVal result = { newReg(), givesBool };
+            emit( op, result.reg, other.reg, thing.reg );
+            return store( pa, s, result );
+        }
 
-    void dump( std::ostream& out, const std::string& context ) const
-    {
-        out << "  {{SM @ " << context << "}}: consumned=[[" << consumned_ << "\n";
-    }
+        bool checkSig( const std::vector<SVal>& vals )
+        {
+            if (!haveSig_)
+            {
+                if (vals.size() > unsigned(Spec::kMaxOuts))
+                    return false;
+                for (const SVal& v : vals)
+                    sig_.push_back( v.isbool );
+                haveSig_ = true;
+                return true;
+            }
+            if (vals.size() != sig_.size())
+                return false;
+            for (unsigned i = 0; i < vals.size(); ++i)
+            {
+                if (vals[i].isbool != sig_[i])
+                    return false;
+            }
+            return true;
+        }
 
-    char getc()
-    {
-        char rv = stream_.getc();
-        consumned_.push_back(rv);
-        return rv;
-    }
+        // leaving a non-tail if/else branch
+        bool exitTo( const State& s, Join& join )
+        {
+            if (!join.shaped)
+            {
+                for (const SVal& v : s.vstack)
+                {
+                    SVal j = { newReg(), v.isbool };
+                    join.vals.push_back( j );
+                }
+                join.shaped = true;
+            }
+            else if (join.vals.size() != s.vstack.size())
+                return false;
+            for (unsigned i = 0; i < s.vstack.size(); ++i)
+            {
+                if (join.vals[i].isbool != s.vstack[i].isbool)
+                    return false;
+                emit( Spec::kMove, join.vals[i].reg, s.vstack[i].reg );
+            }
+            join.fixups.push_back( emit( Spec::kJump, -1 ) );
+            return true;
+        }
 
-    void accept()
-    {
-        consumned_.clear();
-    }
-    void regurg( char c )
-    {
-        char lastc = consumned_.back();
-        if (lastc != c )
+        bool selfCall( const Ast::PushFunctionRec& afn, State& s, int depth, bool& closedLoop )
+        {
+            const int k = spec_.nParams_;
+            closedLoop = false;
+            if (afn.recFun() != fun_)
+                return false;
+            if (afn.bindingParent() == kNoParent)
+                outerViaNoParent_ = true;
+            else if (afn.bindingParent() != NthParent( s.env.size() ))
+                return false; // not back into the same environment
+            if (int(s.vstack.size()) < k)
+                return false;
+            const unsigned at = spec_.lists_.size();
+            for (unsigned i = s.vstack.size() - k; i < s.vstack.size(); ++i)
+            {
+                if (s.vstack[i].isbool)
+                    return false;
+                spec_.lists_.push_back( s.vstack[i].reg );
+            }
+            s.vstack.resize( s.vstack.size() - k );
+            if (afn.instr_ == Ast::Base::kTCOApplyFunRec && depth == 0 && s.vstack.empty())
+            {
+                emit( Spec::kLoop, -1, at );
+                closedLoop = true;
+                return true;
+            }
+            // we learn what it returns from the first return we get to;
+            // until then, say one number and check that later
+            if (!haveSig_)
+            {
+                sig_.push_back( false );
+                haveSig_ = true;
+            }
+            for (bool isbool : sig_)
+            {
+                SVal v = { newReg(), isbool };
+                spec_.lists_.push_back( v.reg );
+                s.vstack.push_back( v );
+            }
+            emit( Spec::kCall, -1, at );
+            return true;
+        }
+
+        bool branch( const Ast::Program* p, const Ast::Program::astList_t& ast, unsigned next, const State& s, int depth, Join* join )
         {
-            std::cerr << "last char=" << lastc << " regurged=" << c << std::endl;
-            throw std::runtime_error("parser regurged char != last");
+            if (p)
+                return compile( *p->getAst(), 0, s, depth, join );
+            return compile( ast, next, s, depth, join ); // no branch, on with the rest
         }
-        consumned_.pop_back();
-        stream_.regurg(c);
-    }
-    ~StreamMark()
-    {
-//        std::cerr << "     ~SM: returning(" << consumned_.size() << ") regurg_.size(" << regurg_.size() << ")\n";
-        // consumned stuff is pushed back in reverse
-        std::for_each( consumned_.rbegin(), consumned_.rend(),
-            [&]( char c ) { stream_.regurg(c); } );
-    }
-}; // end, class StreamMark
 
+        bool compile( const Ast::Program::astList_t& ast, unsigned i, State s, int depth, Join* join )
+        {
+            for (; i < ast.size(); ++i)
+            {
+                if (spec_.code_.size() > unsigned(Spec::kMaxCode) || spec_.nRegs_ > Spec::kMaxRegs)
+                    return false;
+                const Ast::Base* pInstr = ast[i];
+                switch (pInstr->instr_)
+                {
+                    case Ast::Base::kJitSegment:
+                        break; // the instructions it covers follow
 
+                    case Ast::Base::kCloseValue:
+                    {
+                        SVal v;
+                        if (!pop( s, v ))
+                            return false;
+                        s.env.insert( s.env.begin(), v );
+                    }
+                    break;
 
-class RegurgeFile : public RegurgeIo
-{
-    std::string filename_;
-    FILE* f_;
-    struct Location {
-        int lineno_;
-        int linecol_;
-        void advance( char c ) {
-//            std::cerr << "ADV: " << c << "\n";
-            if (c=='\n') {
-                ++lineno_;
-                linecol_ = 0;
-            } else {
-                ++linecol_;
+                    case Ast::Base::kMove:
+                    case Ast::Base::kApplyThingAndValue2ValueOperator:
+                        if (!simple( pInstr, s ))
+                            return false;
+                        break;
+
+#if LCFG_NUMEXPR
+                    case Ast::Base::kNumExpr:
+                        for (const Ast::Base* op : reinterpret_cast<const Ast::NumExpr*>(pInstr)->origOps_)
+                        {
+                            if (!simple( op, s ))
+                                return false;
+                        }
+                        break;
+#endif 
+
+                    case Ast::Base::kIfElse:
+                    case Ast::Base::kTCOIfElse:
+                    {
+                        const Ast::IfElse& ifelse = *reinterpret_cast<const Ast::IfElse*>(pInstr);
+                        SVal cond;
+                        if (ifelse.boolSource() == kSrcStack)
+                        {
+                            if (!pop( s, cond ))
+                                return false;
+                        }
+                        else
+                            cond = s.rb0;
+                        if (cond.reg < 0 || !cond.isbool)
+                            return false;
+                        const unsigned jf = emit( Spec::kJumpIfNot, -1, cond.reg );
+                        if (pInstr->instr_ == Ast::Base::kTCOIfElse)
+                        {
+                            // same frame, neither branch comes back here
+                            if (!branch( ifelse.ifBranch(), ast, i + 1, s, depth, join ))
+                                return false;
+                            spec_.code_[jf].dst = spec_.code_.size();
+                            return branch( ifelse.elseBranch(), ast, i + 1, s, depth, join );
+                        }
+                        Join here;
+                        if (ifelse.ifBranch()
+                            ? !compile( *ifelse.ifBranch()->getAst(), 0, s, depth + 1, &here )
+                            : !exitTo( s, here ))
+                            return false;
+                        spec_.code_[jf].dst = spec_.code_.size();
+                        if (ifelse.elseBranch()
+                            ? !compile( *ifelse.elseBranch()->getAst(), 0, s, depth + 1, &here )
+                            : !exitTo( s, here ))
+                            return false;
+                        for (unsigned at : here.fixups)
+                            spec_.code_[at].dst = spec_.code_.size();
+                        s.vstack = here.vals;
+                        s.r0.reg = s.rb0.reg = -1;
+                    }
+                    break;
+
+                    case Ast::Base::kApplyFunRec:
+                    case Ast::Base::kTCOApplyFunRec:
+                    {
+                        bool closedLoop;
+                        if (!selfCall( *reinterpret_cast<const Ast::PushFunctionRec*>(pInstr), s, depth, closedLoop ))
+                            return false;
+                        if (closedLoop)
+                            return true;
+                    }
+                    break;
+
+                    case Ast::Base::kBreakProg:
+                        if (depth > 0)
+                            return exitTo( s, *join );
+                        if (!checkSig( s.vstack ))
+                            return false;
+                        {
+                            const unsigned at = spec_.lists_.size();
+                            for (const SVal& v : s.vstack)
+                                spec_.lists_.push_back( v.reg );
+                            emit( Spec::kReturn, -1, at );
+                        }
+                        return true;
+
+                    default:
+                        return false;
+                }
             }
+            return false;
         }
-        void rewind( char c ) {
-//            std::cerr << "REW: " << c << "\n";
-            if (c=='\n') {
-                --lineno_;
-                linecol_ = -1;
-            } else {
-                --linecol_;
-            }
 
+    public:
+        NumSpecCompiler( const Ast::Program* fun, Spec& spec )
+        : fun_( fun ), spec_( spec ), haveSig_( false ), outerViaNoParent_( false )
+        {}
+
+        bool compile( const Ast::Program::astList_t& ast )
+        {
+            int k = 0;
+            for (unsigned i = 0; i < ast.size(); ++i)
+            {
+                if (ast[i]->instr_ == Ast::Base::kCloseValue)
+                    ++k;
+                else if (ast[i]->instr_ != Ast::Base::kJitSegment)
+                    break;
+            }
+            if (k < 1 || k > Spec::kMaxParams || ast.empty() || ast.back()->instr_ != Ast::Base::kBreakProg)
+                return false;
+            spec_.nParams_ = spec_.nRegs_ = k;
+            State s;
+            for (int i = 0; i < k; ++i)
+            {
+                SVal v = { i, false };
+                s.vstack.push_back( v );
+            }
+            s.r0.reg = s.rb0.reg = -1;
+            if (!compile( ast, 0, s, 0, nullptr ))
+                return false;
+            if (outerViaNoParent_ && !spec_.outer_.empty())
+                return false;
+            spec_.outIsBool_ = sig_;
+            return spec_.nRegs_ <= Spec::kMaxRegs;
         }
-        Location() : lineno_(1), linecol_(0) {}
-    } loc_;
-//    Location err_;
-public:
-    RegurgeFile( const std::string& filename )
-    : filename_( filename )
-    {
-        f_ = fopen( filename.c_str(), "r");
-        if (!f_)
-            bangerr() << "Cannot open file=" << filename;
-    }
-    ~RegurgeFile()
-    {
-        fclose(f_);
-    }
-    virtual std::string sayWhere() const
+    };
+}
+
+// Puts a NumSpecEntry in front of the body of fun if it can have one.
+void SpecializeNumFun( std::vector<Ast::Base*>& ast, const Ast::Program* fun )
+{
+    Ast::NumSpecEntry* spec = new Ast::NumSpecEntry;
+    NumSpecCompiler compiler( fun, *spec );
+    if (!compiler.compile( ast ))
     {
-        std::ostringstream oss;
-        oss << filename_ << ":" << loc_.lineno_ << " C" << loc_.linecol_;
-        return oss.str();
+        delete spec;
+        return;
     }
-
-    char getc()
+#if LCFG_X64JIT
+    // plain loops are better off with the tracing JIT
+    if (isolateState().jit)
     {
-        int icud = RegurgeIo::getcud();
-
-        if (icud != EOF)
+        bool calls = false, loops = false;
+        for (const Ast::NumSpecEntry::Instr& in : spec->code_)
         {
-            loc_.advance( icud );
-            return icud;
+            calls = calls || in.op == Ast::NumSpecEntry::kCall;
+            loops = loops || in.op == Ast::NumSpecEntry::kLoop;
         }
-        
-        int istream = fgetc(f_);
-        if (istream==EOF)
-            throw ErrorEof();
-        else
+        if (loops && !calls)
         {
-            loc_.advance( istream );
-            return istream;
+            delete spec;
+            return;
         }
     }
+#endif 
+    spec->skip_ = ast.size() - 1;
+    ast.insert( ast.begin(), spec );
+}
+#endif 
 
-    virtual void regurg( char c )
-    {
-        loc_.rewind(c);
-        RegurgeIo::regurg(c);
+#if LCFG_LICM || LCFG_CSE || LCFG_LOCALFUN || LCFG_SHARED_CLOSURES
+namespace {
+    // new bindings an instruction makes
+    int NewBindings( const Ast::Base* p )
+    {
+        switch (p->instr_)
+        {
+            case Ast::Base::kCloseValue:
+                return 1;
+            case Ast::Base::kMove:
+                return reinterpret_cast<const Ast::Move*>(p)->dest_ == kSrcCloseValue;
+            case Ast::Base::kApplyThingAndValue2ValueOperator:
+                return reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(p)->dest_ == kSrcCloseValue;
+#if LCFG_NUMEXPR
+            case Ast::Base::kNumExpr:
+            {
+                int n = 0;
+                for (const Ast::NumExpr::Out& out : reinterpret_cast<const Ast::NumExpr*>(p)->outs_)
+                    n += out.dest.dest_ == kSrcCloseValue;
+                return n;
+            }
+#endif 
+#if LCFG_LICM
+            case Ast::Base::kHoistInvariant:
+                return 1;
+            case Ast::Base::kLoopInvariant:
+                return reinterpret_cast<const Ast::LoopInvariant*>(p)->dest_ == kSrcCloseValue;
+#endif 
+            default:
+                return 0;
+        }
     }
-};
-    
 
+#if LCFG_LOCALFUN || LCFG_SHARED_CLOSURES
+    // the upvalues an instruction reads, if reading them is all it does
+    // with the environment; false for anything else (programs, calls into
+    // them, lookups by name, ...), which callers look into themselves
+    bool UpvalueReads( const Ast::Base* p, std::vector<const Ast::ValueEater*>& reads )
+    {
+        switch (p->instr_)
+        {
+            case Ast::Base::kBreakProg:
+            case Ast::Base::kCloseValue:
+            case Ast::Base::kThrow:
+            case Ast::Base::kMakeCoroutine:
+            case Ast::Base::kYieldCoroutine:
+            case Ast::Base::kJitSegment:   // what it covers follows
+            case Ast::Base::kNumSpecEntry: // so does the generic body
+                return true;
+
+            case Ast::Base::kApply:
+            case Ast::Base::kTCOApply:
+                reads.push_back( reinterpret_cast<const Ast::Apply*>(p) );
+                return true;
+
+            case Ast::Base::kMove:
+                reads.push_back( &reinterpret_cast<const Ast::Move*>(p)->source() );
+                return true;
+
+            case Ast::Base::kApplyThingAndValue2ValueOperator:
+            {
+                const Ast::ApplyThingAndValue2ValueOperator& pa = *reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(p);
+                reads.push_back( &pa );
+                reads.push_back( &pa.secondsrc_ );
+            }
+            return true;
 
+            case Ast::Base::kApplyIndexOperator:
+            {
+                const Ast::ApplyIndexOperator& op = *reinterpret_cast<const Ast::ApplyIndexOperator*>(p);
+                reads.push_back( &op );
+                reads.push_back( &op.indexValue() );
+            }
+            return true;
 
-bool eatwhitespace( StreamMark& stream )
-{
-    bool bGotAny = false;
-    StreamMark mark( stream );
-    try
-    {
-        while (isspace(mark.getc()))
-        {
-            bGotAny = true;
-            mark.accept();
+#if LCFG_NUMEXPR
+            case Ast::Base::kNumExpr:
+                for (const Ast::NumExpr::Leaf& leaf : reinterpret_cast<const Ast::NumExpr*>(p)->leaves_)
+                    reads.push_back( &leaf.src );
+                return true;
+#endif 
+#if LCFG_LICM
+            case Ast::Base::kHoistInvariant:
+                for (const Ast::ValueEater& in : reinterpret_cast<const Ast::HoistInvariant*>(p)->inputs_)
+                    reads.push_back( &in );
+                return true;
+
+            case Ast::Base::kLoopInvariant: // what orig_ reads, its HoistInvariant did
+                reads.push_back( &reinterpret_cast<const Ast::LoopInvariant*>(p)->src_ );
+                return true;
+#endif 
+
+            case Ast::Base::kUnk:
+                if (const Ast::ApplyCustomOperator* op = dynamic_cast<const Ast::ApplyCustomOperator*>(p))
+                    reads.push_back( op );
+                else if (const Ast::ApplyCustomOperatorDotted* op = dynamic_cast<const Ast::ApplyCustomOperatorDotted*>(p))
+                    reads.push_back( op );
+#if LCFG_CSE
+                else if (const Ast::CseRead* cr = dynamic_cast<const Ast::CseRead*>(p))
+                    return UpvalueReads( cr->read_, reads );
+                else if (const Ast::CseReuse* cr = dynamic_cast<const Ast::CseReuse*>(p))
+                    return UpvalueReads( cr->orig_, reads );
+#endif 
+                else if (!dynamic_cast<const Ast::OperatorNot*>(p)
+                    && !dynamic_cast<const Ast::StackToAltstack*>(p)
+                    && !dynamic_cast<const Ast::PushPrimitive*>(p)
+                    && !dynamic_cast<const Ast::Require*>(p))
+                    return false;
+                return true;
+
+            default:
+                return false;
         }
     }
-    catch (const ErrorEof& )
-    {
-        bGotAny = true;
-    }
+#endif 
 
-    return bGotAny;
+#if LCFG_X64JIT
+    // for passes that change instructions a JitSegment may have compiled;
+    // JitCompileAst the Ast again after
+    void DropJitSegments( Ast::Program::astList_t& ast )
+    {
+        ast.erase
+        (   std::remove_if( ast.begin(), ast.end(),
+                []( const Ast::Base* p ) {
+                    if (p->instr_ != Ast::Base::kJitSegment)
+                        return false;
+                    delete p;
+                    return true;
+                } ),
+            ast.end()
+        );
+    }
+#endif 
 }
+#endif 
 
-
-    
-class Parser
-{
-    class Number
-    {
-        double value_;
-    public:
-        Number( StreamMark& stream )
-        {
-            StreamMark mark(stream);
-
-            bool gotDecimal = false;
-            bool gotOne = false;
-            bool isNegative = false;
-            double val = 0;
-            double fractional_adj = 0.1;
-            double base = 10;
-            char c = mark.getc();
-
-            if (c=='-')
+#if LCFG_LICM
+namespace {
+    // Loop-invariant code motion for functions that loop by calling
+    // themselves in tail position.  An operator (or NumExpr) that only
+    // reads literals and upvalues from outside the function gives the
+    // same result on every iteration, since upvalues never change.  Such
+    // instructions get computed once, by a preheader, and bound as upvalues
+    // sitting between the function's environment and its parameters:
+    //
+    //      fun (preheader):  HoistInvariant...  TCO-> loop
+    //      loop:             the original body; self calls go to loop
+    //
+    // Putting bindings under the parameters moves everything further out
+    // by as many, so every upvalue reference in the body (and its if/else
+    // branches) that reaches past the function's own locals is renumbered.
+    // Bodies holding anything that could capture the environment in a way
+    // we don't follow here (nested functions, programs, try) are left alone.
+    class LoopHoister
+    {
+        enum { kMaxHoisted = 16 };
+        struct Candidate { Ast::Program::astList_t* ast; Ast::Base* instr; int locals; };
+        struct Split { Ast::Program::astList_t* ast; Ast::Base* numexpr; };
+
+        const Ast::Program* fun_;
+        Ast::Program* loop_;
+        std::vector<Candidate> cands_;
+        std::vector<Split> splits_; // NumExprs with invariants inside
+        std::vector<Ast::Program::astList_t*> asts_; // everything walked
+        bool loops_;
+        int m_;
+
+        static bool invariantSrc( const Ast::ValueEater& ve, int locals, bool& upval )
+        {
+            if (ve.v1src_ == kSrcUpval && ve.v1uvnumber_ != kNoParent && ve.v1uvnumber_.toint() >= locals)
             {
-                c = mark.getc();
-                if (!isdigit(c))
-                    throw ErrorNoMatch();
-                mark.accept();
-                isNegative = true;
+                upval = true;
+                return true;
             }
+            return ve.v1src_ == kSrcLiteral && ve.v1literal_.isnum();
+        }
 
-            if (c == '0')
+        static bool isInvariant( const Ast::Base* p, int locals )
+        {
+            bool upval = false;
+            if (p->instr_ == Ast::Base::kApplyThingAndValue2ValueOperator)
             {
-                c = mark.getc();
-                if (c == 'x')
+                const Ast::ApplyThingAndValue2ValueOperator& pa = *reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(p);
+                switch (pa.openum_)
                 {
-                    base = 16;
-                    mark.accept();
-                    c = mark.getc();
+                    case kOpPlus: case kOpMinus: case kOpMult: case kOpDiv: case kOpLt: case kOpGt: case kOpEq:
+                        break;
+                    default:
+                        return false;
                 }
-                else
+                return !pa.argSwap_ && invariantSrc( pa, locals, upval ) && invariantSrc( pa.secondsrc_, locals, upval ) && upval;
+            }
+#if LCFG_NUMEXPR
+            if (p->instr_ == Ast::Base::kNumExpr)
+            {
+                const Ast::NumExpr& ne = *reinterpret_cast<const Ast::NumExpr*>(p);
+                if (ne.stackIn_ != 0 || ne.outs_.size() != 1)
+                    return false;
+                for (const Ast::NumExpr::Leaf& leaf : ne.leaves_)
                 {
-                    mark.regurg(c);
-                    c = '0';
+                    if (!invariantSrc( leaf.src, locals, upval ))
+                        return false;
                 }
+                return upval;
             }
+#endif 
+            return false;
+        }
 
-            while (isdigit(c) || ((base == 16) && tolower(c) >= 'a' && tolower(c) <= 'f'))
+#if LCFG_NUMEXPR
+        static bool hasInvariantOp( const Ast::NumExpr& ne, int locals )
+        {
+            for (const Ast::Base* op : ne.origOps_)
             {
-                gotOne = true;
-                mark.accept();
-                if (gotDecimal)
-                {
-                    val = val + (fractional_adj * (c - '0'));
-                    fractional_adj = fractional_adj / 10;
-                }
-                else    
-                {
-                    val = val * base + (isdigit(c) ? (c - '0') : (10 + tolower(c) - 'a'));
-                }
-                c = mark.getc();
-                if (!gotDecimal)
+                if (isInvariant( op, locals ))
+                    return true;
+                locals += NewBindings( op );
+            }
+            return false;
+        }
+#endif 
+
+        static Ast::Program::astList_t& astOf( const Ast::Program* p )
+        {
+            return const_cast<Ast::Program*>( p )->astRef();
+        }
+
+        // can we follow everything this Ast does with the environment?
+        bool scan( Ast::Program::astList_t& ast, int locals, int depth )
+        {
+            asts_.push_back( &ast );
+            for (Ast::Base* p : ast)
+            {
+                switch (p->instr_)
                 {
-                    if (c=='.')
+                    case Ast::Base::kBreakProg:
+                    case Ast::Base::kCloseValue:
+                    case Ast::Base::kMove:
+                    case Ast::Base::kApplyThingAndValue2ValueOperator:
+                    case Ast::Base::kApply:
+                    case Ast::Base::kTCOApply:
+                    case Ast::Base::kApplyIndexOperator:
+                    case Ast::Base::kThrow:
+                    case Ast::Base::kNumExpr:
+                    case Ast::Base::kJitSegment:
+                        break;
+
+                    case Ast::Base::kIfElse:
+                    case Ast::Base::kTCOIfElse:
                     {
-                        gotDecimal = true;
-                        c = mark.getc(); 
-                        if (!isdigit(c)) // decimal point must be followed by a number
-                            break;
+                        const Ast::IfElse& ifelse = *reinterpret_cast<const Ast::IfElse*>(p);
+                        const int d = p->instr_ == Ast::Base::kIfElse ? depth + 1 : depth;
+                        if (ifelse.ifBranch() && !scan( astOf( ifelse.ifBranch() ), locals, d ))
+                            return false;
+                        if (ifelse.elseBranch() && !scan( astOf( ifelse.elseBranch() ), locals, d ))
+                            return false;
                     }
-                }
-            }
+                    break;
 
-            if (c == 'e' || c == 'E') // scientific notation
-            {
-                bool negativeExp = false;
-                c = mark.getc();
+                    case Ast::Base::kApplyFunRec:
+                    case Ast::Base::kTCOApplyFunRec:
+                    {
+                        const Ast::PushFunctionRec& afn = *reinterpret_cast<const Ast::PushFunctionRec*>(p);
+                        if (afn.recFun() == fun_)
+                        {
+                            if (afn.bindingParent() != NthParent( locals ))
+                                return false;
+                            loops_ = loops_ || (p->instr_ == Ast::Base::kTCOApplyFunRec && depth == 0);
+                        }
+                        else if (afn.bindingParent().toint() < locals)
+                            return false; // a local function, see CallLocalFunsDirectly; its body would need renumbering too
+                    }
+                    break;
 
-                if (c == '+')
-                    c = mark.getc();
+                    case Ast::Base::kUnk:
+                        if (!dynamic_cast<const Ast::ApplyCustomOperator*>(p)
+                            && !dynamic_cast<const Ast::ApplyCustomOperatorDotted*>(p)
+                            && !dynamic_cast<const Ast::OperatorNot*>(p)
+                            && !dynamic_cast<const Ast::StackToAltstack*>(p)
+                            && !dynamic_cast<const Ast::PushPrimitive*>(p)
+#if LCFG_CSE
+                            && !dynamic_cast<const Ast::CseRead*>(p)
+                            && !dynamic_cast<const Ast::CseReuse*>(p)
+#endif 
+                            )
+                            return false;
+                        break;
 
-                if (c == '-')
+                    default:
+                        return false;
+                }
+                if (isInvariant( p, locals ))
                 {
-                    c = mark.getc();
-                    if (isdigit(c))
+                    if (cands_.size() < unsigned(kMaxHoisted))
                     {
-                        negativeExp = true;
-                        mark.accept();
+                        Candidate cand = { &ast, p, locals };
+                        cands_.push_back( cand );
                     }
                 }
-                double exp = 0;
-                while (isdigit(c))
+#if LCFG_NUMEXPR
+                else if (p->instr_ == Ast::Base::kNumExpr && hasInvariantOp( *reinterpret_cast<const Ast::NumExpr*>(p), locals ))
                 {
-                    exp = exp * 10 + (c - '0');
-                    mark.accept();
-                    c = mark.getc();
+                    Split split = { &ast, p };
+                    splits_.push_back( split );
                 }
-                if (negativeExp)
-                    exp = exp * -1;
-                
-                val = val * ::pow(10,exp);
+#endif 
+                locals += NewBindings( p );
             }
-            
-            value_ = val;
-            if (isNegative)
-                value_ = value_ * -1.0;
-            if (!gotOne)
-                throw ErrorNoMatch();
+            return true;
         }
-        double value() { return value_; }
-    }; // end, class Number
 
-
-    class Boolean
-    {
-        bool value_;
-    public:
-        Boolean( StreamMark& stream )
+        void shift( Ast::ValueEater& ve, int locals ) const
         {
-            StreamMark mark(stream);
-
-            if (eatReservedWord("true", mark))
-                value_ = true;
-            else if (eatReservedWord("false", mark))
-                value_ = false;
-            else
-                throw ErrorNoMatch();
-
-            mark.accept();
+            if (ve.v1src_ == kSrcUpval && ve.v1uvnumber_ != kNoParent && ve.v1uvnumber_.toint() >= locals)
+                ve.v1uvnumber_ = NthParent( ve.v1uvnumber_.toint() + m_ );
         }
-        bool value() { return value_; }
-    };
-
-
-    struct ParsingRecursiveFunStack;
-    class Program
-    {
-        Ast::Program::astList_t& ast_;
-        bool noTco_; // e.g., when parsed program is going to be pasted into another program
-    public:
-        Program( ParsingContext& pc, StreamMark&, const Ast::Program* parent,
-            const Ast::CloseValue* upvalueChain, const Ast::CloseValue* const entryUvChain,
-            const ParsingRecursiveFunStack* pRecParsing, Ast::Program::astList_t&,
-            bool disableTco = false
-               );
-
-        void noTco() { noTco_ = true; }
-        // const Ast::Program::astList_t& ast() { return ast_; }
-    };
 
-    class Comment
-    {
-    public:
-        Comment( StreamMark& stream )
+        void shiftInstr( Ast::Base* p, int locals ) const
         {
-            StreamMark mark(stream);
-            eatwhitespace(stream);
-            if ( '-' == mark.getc() && '-' == mark.getc())
+            switch (p->instr_)
             {
-                while (mark.getc() != '\n')
-                    mark.accept();
+                case Ast::Base::kMove:
+                    shift( reinterpret_cast<Ast::Move*>(p)->source(), locals );
+                    break;
+                case Ast::Base::kApplyThingAndValue2ValueOperator:
+                {
+                    Ast::ApplyThingAndValue2ValueOperator& pa = *reinterpret_cast<Ast::ApplyThingAndValue2ValueOperator*>(p);
+                    shift( pa, locals );
+                    shift( pa.secondsrc_, locals );
+                }
+                break;
+                case Ast::Base::kApply:
+                case Ast::Base::kTCOApply:
+                    shift( *reinterpret_cast<Ast::Apply*>(p), locals );
+                    break;
+                case Ast::Base::kApplyIndexOperator:
+                {
+                    Ast::ApplyIndexOperator& op = *reinterpret_cast<Ast::ApplyIndexOperator*>(p);
+                    Ast::ValueEater index( op.indexValue() );
+                    shift( op, locals );
+                    shift( index, locals );
+                    op.setIndexValueSource( index );
+                }
+                break;
+#if LCFG_NUMEXPR
+                case Ast::Base::kNumExpr:
+                {
+                    Ast::NumExpr& ne = *reinterpret_cast<Ast::NumExpr*>(p);
+                    for (Ast::NumExpr::Leaf& leaf : ne.leaves_)
+                        shift( leaf.src, locals );
+                    // they run in sequence, so later ones see what earlier ones bound
+                    int l = locals;
+                    for (const Ast::Base* op : ne.origOps_)
+                    {
+                        shiftInstr( const_cast<Ast::Base*>( op ), l );
+                        l += NewBindings( op );
+                    }
+                }
+                break;
+#endif 
+                case Ast::Base::kApplyFunRec:
+                case Ast::Base::kTCOApplyFunRec:
+                {
+                    Ast::PushFunctionRec& afn = *reinterpret_cast<Ast::PushFunctionRec*>(p);
+                    if (afn.recFun() == fun_)
+                        afn.setRecFun( loop_ ); // nthparent still lands on the hoisted values
+                    else if (afn.bindingParent() != kNoParent && afn.bindingParent().toint() >= locals)
+                        afn.setBindingParent( NthParent( afn.bindingParent().toint() + m_ ) );
+                }
+                break;
+                case Ast::Base::kUnk:
+                    if (Ast::ApplyCustomOperator* op = dynamic_cast<Ast::ApplyCustomOperator*>(p))
+                        shift( *op, locals );
+                    else if (Ast::ApplyCustomOperatorDotted* op = dynamic_cast<Ast::ApplyCustomOperatorDotted*>(p))
+                        shift( *op, locals );
+#if LCFG_CSE
+                    else if (Ast::CseRead* cr = dynamic_cast<Ast::CseRead*>(p))
+                        shiftInstr( const_cast<Ast::ApplyIndexOperator*>( cr->read_ ), locals );
+                    else if (Ast::CseReuse* cr = dynamic_cast<Ast::CseReuse*>(p))
+                        shiftInstr( const_cast<Ast::ApplyIndexOperator*>( cr->orig_ ), locals );
+#endif 
+                    break;
+                default:
+                    break;
             }
-            else
-                throw ErrorNoMatch();
         }
-    };
 
-    class ParseString
-    {
-        std::string content_;
-    public:
-        ParseString( StreamMark& stream )
+        void rewrite( Ast::Program::astList_t& ast, int locals ) const
         {
-            StreamMark mark(stream);
-            char delim = mark.getc();
-            if (delim == '\'' || delim == '"') // simple strings, no escaping etc
+#if LCFG_X64JIT
+            // native segments have the old upvalue numbers built in
+            DropJitSegments( ast );
+#endif 
+            for (Ast::Base* p : ast)
             {
-                auto bi = std::back_inserter(content_);
-                for (char cstr = mark.getc(); cstr != delim; cstr = mark.getc())
+                if (p->instr_ == Ast::Base::kIfElse || p->instr_ == Ast::Base::kTCOIfElse)
                 {
-                    if (cstr == '\\')
-                    {
-                        char c = mark.getc();
-                        switch (c) {
-                            case 'n':  cstr = '\n'; break;
-                            case '"':  cstr = '"';  break;
-                            case '\'': cstr = '\''; break;
-                            case '\\': cstr = '\\'; break;
-                            case 'r':  cstr = '\r'; break;
-                            default:
-                                //*bi++ = '\\';
-                                cstr = c;
-                                break;
-                        }
-                    }
-                    *bi++ = cstr;
+                    const Ast::IfElse& ifelse = *reinterpret_cast<const Ast::IfElse*>(p);
+                    if (ifelse.ifBranch())
+                        rewrite( astOf( ifelse.ifBranch() ), locals );
+                    if (ifelse.elseBranch())
+                        rewrite( astOf( ifelse.elseBranch() ), locals );
                 }
-                mark.accept();
+                else
+                    shiftInstr( p, locals );
+                locals += NewBindings( p );
+            }
+        }
+
+        // a copy of the candidate for the preheader, where j values are
+        // already hoisted and there are no locals
+        Ast::HoistInvariant* preheaderCopy( const Candidate& cand, int j ) const
+        {
+            const Ast::CloseValue* cv = new Ast::CloseValue( nullptr, bangstring( std::string() ) );
+            auto rebase = [&]( Ast::ValueEater& ve, std::vector<Ast::ValueEater>& inputs ) {
+                if (ve.v1src_ != kSrcUpval)
+                    return;
+                ve.v1uvnumber_ = NthParent( ve.v1uvnumber_.toint() - cand.locals + j );
+                inputs.push_back( ve );
+            };
+            Ast::HoistInvariant* h;
+            std::vector<Ast::ValueEater> inputs;
+#if LCFG_NUMEXPR
+            if (cand.instr->instr_ == Ast::Base::kNumExpr)
+            {
+                Ast::NumExpr* ne = new Ast::NumExpr( *reinterpret_cast<const Ast::NumExpr*>(cand.instr) );
+                for (Ast::NumExpr::Leaf& leaf : ne->leaves_)
+                    rebase( leaf.src, inputs );
+                ne->origOps_.clear(); // never needed, the inputs are checked first
+                ne->outs_[0].dest.setDestCloseValue( cv );
+                h = new Ast::HoistInvariant( ne, cv );
             }
             else
-                throw ErrorNoMatch();
+#endif 
+            {
+                Ast::ApplyThingAndValue2ValueOperator* pa =
+                    new Ast::ApplyThingAndValue2ValueOperator( *reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(cand.instr) );
+                rebase( *pa, inputs );
+                rebase( pa->secondsrc_, inputs );
+                pa->setDestCloseValue( cv );
+                h = new Ast::HoistInvariant( pa, cv );
+            }
+            h->inputs_ = inputs;
+            return h;
+        }
+
+        static const Ast::ValueMaker& destOf( const Ast::Base* p )
+        {
+#if LCFG_NUMEXPR
+            if (p->instr_ == Ast::Base::kNumExpr)
+                return reinterpret_cast<const Ast::NumExpr*>(p)->outs_[0].dest;
+#endif 
+            return *reinterpret_cast<const Ast::ApplyThingAndValue2ValueOperator*>(p);
         }
-        const std::string& content() { return content_; }
-    };
 
-    class ParseLiteral
-    {
-        Value value_;
     public:
-        ParseLiteral( StreamMark& mark )
+        LoopHoister( const Ast::Program* fun )
+        : fun_( fun ), loop_( nullptr ), loops_( false ), m_( 0 )
+        {}
+
+        void hoist( Ast::Program::astList_t& ast )
         {
-            try
-            {
-                value_ = Value(ParseString(mark).content());
-//                std::cerr << "ParseLiteral string:"; value_.tostring(std::cerr); std::cerr << "\n";
-                
+            if (ast.empty() || ast[0]->instr_ == Ast::Base::kNumSpecEntry)
                 return;
-            } catch ( const ErrorNoMatch& ) {}
+            if (!scan( ast, 0, 0 ) || !loops_ || (cands_.empty() && splits_.empty()))
+                return;
+#if LCFG_NUMEXPR
+            if (!splits_.empty())
+            {
+                // put the instructions back so the invariant ones can go;
+                // what's left gets rebuilt into NumExprs below
+                for (const Split& split : splits_)
+                {
+                    const auto& ops = reinterpret_cast<const Ast::NumExpr*>(split.numexpr)->origOps_;
+                    auto at = std::find( split.ast->begin(), split.ast->end(), split.numexpr );
+                    at = split.ast->erase( at );
+                    for (auto op = ops.rbegin(); op != ops.rend(); ++op)
+                        at = split.ast->insert( at, const_cast<Ast::Base*>( *op ) );
+                }
+                cands_.clear();
+                splits_.clear();
+                asts_.clear();
+                scan( ast, 0, 0 );
+            }
+#endif 
+            m_ = cands_.size();
 
-            try
+            Ast::Program::astList_t preheader;
+            for (int j = 0; j < m_; ++j)
+                preheader.push_back( preheaderCopy( cands_[j], j ) );
+
+            loop_ = new Ast::Program( nullptr );
+            loop_->astRef().swap( ast );
+            rewrite( loop_->astRef(), 0 );
+            for (int j = 0; j < m_; ++j)
             {
-                value_ = Value(Number(mark).value());
-                return;
-            } catch ( const ErrorNoMatch& ) {}
+                const Candidate& cand = cands_[j];
+                Ast::Program::astList_t& in = cand.ast == &ast ? loop_->astRef() : *cand.ast;
+                auto at = std::find( in.begin(), in.end(), cand.instr );
+                *at = new Ast::LoopInvariant( NthParent( cand.locals + m_ - 1 - j ), cand.instr, destOf( cand.instr ) );
+            }
+            for (Ast::Program::astList_t*& walked : asts_)
+            {
+                if (walked == &ast)
+                    walked = &loop_->astRef();
+#if LCFG_NUMEXPR
+                BuildNumExprs( *walked );
+#endif 
+#if LCFG_X64JIT
+                if (isolateState().jit)
+                    JitCompileAst( *walked );
+#endif 
+            }
 
-            value_ = Value(Boolean(mark).value()); // allow to throw if not found
+            Ast::PushFunctionRec* enter = new Ast::PushFunctionRec( loop_, NthParent( 0 ) );
+            enter->setApply();
+            enter->convertToTailCall();
+            preheader.push_back( enter );
+            preheader.push_back( new Ast::BreakProg() );
+            ast.swap( preheader );
         }
-
-        const Value& value() { return value_; }
     };
+}
 
-    class Identifier
-    {
-        std::string name_;
-    public:
-        Identifier( StreamMark& stream )
+// Splits a self-tail-recursive function into a preheader that computes its
+// loop invariants once and the loop proper, if it has any.
+void HoistLoopInvariants( std::vector<Ast::Base*>& ast, const Ast::Program* fun )
+{
+    LoopHoister hoister( fun );
+    hoister.hoist( ast );
+}
+#endif 
+
+#if LCFG_CSE
+namespace {
+    // Common subexpression elimination for index reads.  Along any path
+    // through a function body, a read like left[il] that repeats an earlier
+    // one -- same receiver, same index upvalue or literal, and nothing in
+    // between but arithmetic, bindings, branching and other such reads --
+    // takes the value the first read kept (see CseRead).  Whether reads are
+    // pure can't be known when compiling, since any function can answer an
+    // index, so that gets checked as they run.
+    //
+    // Arithmetic and plain upvalue loads are left alone: a NumExpr or a
+    // Move is already cheaper than keeping and checking a copy would be.
+    class CommonReads
+    {
+        // a binding is known by locals-nthparent, which stays the same as
+        // more locals get bound after it
+        struct Key
+        {
+            int recv;
+            int index;     // unless literal
+            bool isliteral;
+            Value literal;
+            bool operator==( const Key& k ) const
+            {
+                if (recv != k.recv || isliteral != k.isliteral)
+                    return false;
+                if (!isliteral)
+                    return index == k.index;
+                if (literal.isnum())
+                    return k.literal.isnum() && literal.tonum() == k.literal.tonum();
+                return k.literal.isstr() && literal.tostr() == k.literal.tostr();
+            }
+        };
+        typedef const Ast::ApplyIndexOperator* read_t;
+        struct Read
         {
-            bool gotAny = false;
-            StreamMark mark(stream);
-            char c = mark.getc();
-            while (isalpha(c) || c == '_')
+            Key key;
+            Ast::Program::astList_t* ast;
+            read_t first;
+            unsigned trailAt;
+        };
+        struct Repeat
+        {
+            Ast::Program::astList_t* ast;
+            read_t instr;
+            read_t first;
+            std::vector<read_t> since;
+        };
+        struct Path
+        {
+            std::vector<Read> avail;
+            std::vector<read_t> trail; // for each read done, the first of its kind
+        };
+
+        std::vector<read_t> barriers_; // reads not worth keeping
+        std::vector<Read> firsts_;
+        std::vector<Repeat> repeats_;
+        std::vector<Ast::Program::astList_t*> asts_;
+
+        static bool keyOf( const Ast::ApplyIndexOperator& op, int locals, Key& key )
+        {
+            if (op.v1src_ != kSrcUpval || op.v1uvnumber_ == kNoParent)
+                return false;
+            key.recv = locals - op.v1uvnumber_.toint();
+            const Ast::ValueEater& index = op.indexValue();
+            if (index.v1src_ == kSrcUpval && index.v1uvnumber_ != kNoParent)
             {
-                name_.push_back(c);
-                mark.accept();
+                key.isliteral = false;
+                key.index = locals - index.v1uvnumber_.toint();
+                return true;
+            }
+            if (index.v1src_ == kSrcLiteral && (index.v1literal_.isnum() || index.v1literal_.isstr()))
+            {
+                key.isliteral = true;
+                key.literal = index.v1literal_;
+                return true;
+            }
+            return false;
+        }
 
-                for (c = mark.getc(); isalpha(c) || isdigit(c) || (c=='_'); c = mark.getc())
+        bool isBarrier( read_t op ) const
+        {
+            return std::find( barriers_.begin(), barriers_.end(), op ) != barriers_.end();
+        }
+
+        void read( Ast::Program::astList_t& ast, read_t op, int locals, Path& path )
+        {
+            Key key;
+            if (isBarrier( op ) || !keyOf( *op, locals, key ))
+            {
+                path.avail.clear();
+                return;
+            }
+            for (const Read& av : path.avail)
+            {
+                if (av.key == key)
                 {
-                    name_.push_back(c);
-                    mark.accept();
+                    Repeat rep = { &ast, op, av.first, std::vector<read_t>() };
+                    for (unsigned i = av.trailAt + 1; i < path.trail.size(); ++i)
+                    {
+                        read_t r = path.trail[i];
+                        if (r != av.first && std::find( rep.since.begin(), rep.since.end(), r ) == rep.since.end())
+                            rep.since.push_back( r );
+                    }
+                    repeats_.push_back( rep );
+                    path.trail.push_back( av.first );
+                    return;
                 }
-
-                if (c != '-') // hyphen allowed in identifier if followed by alpha
-                    break;
-                
-                c = mark.getc();
-                if (isalpha(c))
-                    name_.push_back('-');
             }
-            if (name_.size() < 1)
-                throw ErrorNoMatch();
+            Read first = { key, &ast, op, unsigned(path.trail.size()) };
+            path.avail.push_back( first );
+            path.trail.push_back( op );
+            firsts_.push_back( first );
         }
-        const std::string& name() { return name_; }
-    };
 
-    static bool isoperatorchar( char c )
-    {
-        auto found = strchr( "+-<>=/*@$%^&~", c );
-        return found ? true : false;
-    }
-
-    static bool operatorterminator( char c )
-    {
-        if (isspace(c))
-            return true;
-        
-        auto found = strchr( "];}).!", c );
-        return found ? true : false;
-    }
-    
-    class OperatorToken
-    {
-        std::string name_;
-    public:
-        OperatorToken( StreamMark& stream )
+        void scan( Ast::Program::astList_t& ast, int locals, Path path )
         {
-            StreamMark mark(stream);
-            char c = mark.getc();
-            
-            if (!isoperatorchar(c))
-                throw ErrorNoMatch();
+            asts_.push_back( &ast );
+            for (const Ast::Base* p : ast)
+            {
+                switch (p->instr_)
+                {
+                    case Ast::Base::kBreakProg:
+                    case Ast::Base::kCloseValue:
+                    case Ast::Base::kMove:
+                    case Ast::Base::kApplyThingAndValue2ValueOperator:
+                    case Ast::Base::kNumExpr:
+                    case Ast::Base::kJitSegment: // what it covers follows
+                        break;
+
+                    case Ast::Base::kApplyIndexOperator:
+                        read( ast, reinterpret_cast<read_t>(p), locals, path );
+                        break;
+
+                    case Ast::Base::kIfElse:
+                    case Ast::Base::kTCOIfElse:
+                    {
+                        const Ast::IfElse& ifelse = *reinterpret_cast<const Ast::IfElse*>(p);
+                        if (ifelse.ifBranch())
+                            scan( const_cast<Ast::Program*>( ifelse.ifBranch() )->astRef(), locals, path );
+                        if (ifelse.elseBranch())
+                            scan( const_cast<Ast::Program*>( ifelse.elseBranch() )->astRef(), locals, path );
+                        path.avail.clear(); // either may have called something
+                    }
+                    break;
 
-            do
-            {
-                name_.push_back(c);
-                mark.accept();
-                c = mark.getc();
+                    case Ast::Base::kUnk:
+                        if (!dynamic_cast<const Ast::OperatorNot*>(p))
+                            path.avail.clear();
+                        break;
+
+                    default:
+                        path.avail.clear();
+                        break;
+                }
+                locals += NewBindings( p );
             }
-            while (!operatorterminator(c));
         }
-        const std::string& name() { return name_; }
-    };
-    
-    static bool eatReservedWord( const std::string& rw, StreamMark& stream )
-    {
-        StreamMark mark(stream);
 
-        for (auto it = rw.begin(); it != rw.end(); ++it)
+        bool repeated( read_t op ) const
         {
-            if (mark.getc() != *it)
-                return false;
+            for (const Repeat& rep : repeats_)
+            {
+                if (rep.first == op)
+                    return true;
+            }
+            return false;
         }
-        mark.accept();
-        return true;
-    }
 
-    struct ParsingRecursiveFunStack
-    {
-        const ParsingRecursiveFunStack* prev;
-        Ast::Program *parentProgram;
-        const Ast::CloseValue* parentsBinding;
-        std::string progname_;
-//         Ast::Program::astList_t& parentProgramAst() {
-//             return *(parentProgram->getAst());
-//         }
-        std::pair<Ast::Program*,const Ast::CloseValue*> FindProgramForIdent( const std::string& ident ) const
+        int regOf( read_t op ) const
         {
-            if (progname_ == ident)
+            for (unsigned i = 0; i < firsts_.size(); ++i)
             {
-//                std::cerr << "found parent prog, ident=" << ident << " CloseValue=" << parentsBinding << "\n";
-                return std::pair<Ast::Program*,const Ast::CloseValue*>( parentProgram, parentsBinding );
+                if (firsts_[i].first == op)
+                    return i;
             }
-            else if (prev)
-                return prev->FindProgramForIdent( ident );
-            else
-                return std::pair<Ast::Program*,const Ast::CloseValue*>( nullptr, nullptr );
+            return -1;
         }
-        
-        ParsingRecursiveFunStack
-        (   const ParsingRecursiveFunStack* p,
-            Ast::Program* parent,
-            const Ast::CloseValue* binding,
-            const std::string& progname
-//            Ast::CloseValue* upvals
-        )
-        :  prev( p ),
-           parentProgram(parent),
-           parentsBinding( binding ),
-           progname_( progname )
-        {}
-    };
 
-    static const Ast::CloseValue* getParamBindings
-    (   StreamMark& mark,
-        Ast::Program::astList_t& functionAst,
-        const Ast::CloseValue* upvalueChain
-    )
-    {
-        std::vector< std::string > params;
-        while (true)
+        static void replace( Ast::Program::astList_t& ast, read_t op, Ast::Base* with )
         {
-            try
+            *std::find( ast.begin(), ast.end(), op ) = with;
+        }
+
+    public:
+        void eliminate( Ast::Program::astList_t& ast )
+        {
+            if (ast.empty() || ast[0]->instr_ == Ast::Base::kNumSpecEntry)
+                return;
+            // a first read with no repeat, or past the registers there are,
+            // is just a read that might call something; go again until
+            // every first read is kept
+            for (;;)
             {
-                Identifier param(mark);
-                eatwhitespace(mark);
-                params.push_back( param.name() );
-                mark.accept();
+                firsts_.clear();
+                repeats_.clear();
+                asts_.clear();
+                scan( ast, 0, Path() );
+                const unsigned before = barriers_.size();
+                for (unsigned i = 0; i < firsts_.size(); ++i)
+                {
+                    if (!repeated( firsts_[i].first ) || i >= unsigned(Ast::CseRead::kRegs))
+                        barriers_.push_back( firsts_[i].first );
+                }
+                if (barriers_.size() == before)
+                    break;
             }
-            catch ( const ErrorNoMatch& ) // identifier is optional
+            if (repeats_.empty())
+                return;
+
+            for (unsigned i = 0; i < firsts_.size(); ++i)
+                replace( *firsts_[i].ast, firsts_[i].first, new Ast::CseRead( firsts_[i].first, i ) );
+            for (const Repeat& rep : repeats_)
             {
-                break; 
+                Ast::CseReuse* reuse = new Ast::CseReuse( rep.instr, regOf( rep.first ) );
+                for (read_t r : rep.since)
+                    reuse->since_.push_back( regOf( r ) );
+                replace( *rep.ast, rep.instr, reuse );
+            }
+#if LCFG_X64JIT
+            if (isolateState().jit)
+            {
+                for (Ast::Program::astList_t* walked : asts_)
+                {
+                    DropJitSegments( *walked );
+                    JitCompileAst( *walked );
+                }
             }
+#endif 
         }
+    };
+}
 
-        while (params.size() > 0)
-        {
-            auto cv = new Ast::CloseValue( upvalueChain, internstring(params.back()) );
-            functionAst.push_back( cv );
-            upvalueChain = cv;
-            params.pop_back();
+// Lets repeats of the same index read in a function body use the value
+// the first one got.
+void ReuseCommonReads( std::vector<Ast::Base*>& ast )
+{
+    CommonReads cse;
+    cse.eliminate( ast );
+}
+#endif 
+
+#if LCFG_LOCALFUN
+namespace {
+    // Escape analysis for functions bound to a name in a function body:
+    //
+    //      fun :helper x = ...;  ... helper! ... helper! ...
+    //
+    // If every use of the name is a call, and nothing after the binding
+    // could get hold of the environment it's in -- a closure made over it
+    // (rebind can swap names in one), ^bind, a lookup by name -- nobody can
+    // ever see the closure.  Then the calls go straight to the program, as
+    // ApplyFunRec with the environment the closure would have been bound
+    // to, and the closure is never made: no BoundProgram allocated and
+    // freed on every run of the body.  The name stays bound (to nothing)
+    // so upvalue numbers don't change.
+    //
+    // Calls to local functions already done this way are followed into
+    // their bodies, so a helper that only other helpers call goes too.
+    class LocalFunCalls
+    {
+        struct Call { Ast::Program::astList_t* ast; Ast::Base* instr; int k; };
+        std::vector<Call> calls_;
+        std::vector<const Ast::Program*> walked_; // bodies followed calls into, once each
+
+        static Ast::Program::astList_t& astOf( const Ast::Program* p )
+        {
+            return const_cast<Ast::Program*>( p )->astRef();
+        }
+
+        // follows everything after ast[from] that can see the binding k up;
+        // false if it might get out
+        bool scan( Ast::Program::astList_t& ast, unsigned from, int k )
+        {
+            std::vector<const Ast::ValueEater*> reads;
+            for (unsigned i = from; i < ast.size(); ++i)
+            {
+                Ast::Base* p = ast[i];
+                switch (p->instr_)
+                {
+                    case Ast::Base::kIfElse:
+                    case Ast::Base::kTCOIfElse:
+                    {
+                        const Ast::IfElse& ifelse = *reinterpret_cast<const Ast::IfElse*>(p);
+                        if (ifelse.ifBranch() && !scan( astOf( ifelse.ifBranch() ), 0, k ))
+                            return false;
+                        if (ifelse.elseBranch() && !scan( astOf( ifelse.elseBranch() ), 0, k ))
+                            return false;
+                    }
+                    break;
+
+                    case Ast::Base::kApplyProgram:
+                    case Ast::Base::kTCOApplyProgram:
+                    {
+                        const Ast::Program* prog = reinterpret_cast<const Ast::Program*>(p);
+                        if (!prog->compiled() || !scan( astOf( prog ), 0, k ))
+                            return false;
+                    }
+                    break;
+
+                    case Ast::Base::kApplyFunRec:
+                    case Ast::Base::kTCOApplyFunRec:
+                    {
+                        // bound somewhere after the binding, so it can see it
+                        const Ast::PushFunctionRec& afn = *reinterpret_cast<const Ast::PushFunctionRec*>(p);
+                        const int n = afn.bindingParent().toint();
+                        const Ast::Program* fun = afn.recFun();
+                        if (n > k || std::find( walked_.begin(), walked_.end(), fun ) != walked_.end())
+                            break;
+                        if (!fun->compiled())
+                            return false;
+                        walked_.push_back( fun );
+                        if (!scan( astOf( fun ), 0, k - n ))
+                            return false;
+                    }
+                    break;
+
+                    default:
+                        if (const Ast::PushFunctionRec* pfn = dynamic_cast<const Ast::PushFunctionRec*>(p))
+                        {
+                            if (pfn->bindingParent().toint() <= k)
+                                return false; // a closure that can see it
+                            break;
+                        }
+                        reads.clear();
+                        if (!UpvalueReads( p, reads ))
+                            return false; // closures, lookups by name, ^bind, ...
+                        for (const Ast::ValueEater* ve : reads)
+                        {
+                            if (ve->v1src_ != kSrcUpval || ve->v1uvnumber_ != NthParent( k ))
+                                continue;
+                            if (p->instr_ != Ast::Base::kApply && p->instr_ != Ast::Base::kTCOApply)
+                                return false;
+                            Call call = { &ast, p, k };
+                            calls_.push_back( call );
+                        }
+                        break;
+                }
+                k += NewBindings( p );
+            }
+            return true;
         }
-            
 
-        char c = mark.getc();
-        if (c != '=') // this seems unneccesary sometimes. therefore "as"
+        static Ast::Program* literalAt( const Ast::Program::astList_t& ast, unsigned i )
         {
-            bangerr(ParseFail) << "got '" << c << "', expecting '=' in "
-                               << mark.sayWhere() << ": function def / param list must be followed by '='"; 
+            if (ast[i]->instr_ != Ast::Base::kUnk || i + 1 >= ast.size() || ast[i + 1]->instr_ != Ast::Base::kCloseValue)
+                return nullptr;
+            return dynamic_cast<Ast::Program*>( ast[i] );
         }
 
-        return upvalueChain;            
-    }
-    
-    
-    class Defdef
-    {
-        bool postApply_;
-        Ast::Program* pDefProg_;
-        std::unique_ptr<std::string> defname_;
     public:
-        ~Defdef() { delete pDefProg_; }
-        Defdef( ParsingContext& parsectx, StreamMark& stream, const Ast::CloseValue* upvalueChain, const ParsingRecursiveFunStack* pRecParsing )
-        : postApply_(false), pDefProg_(nullptr)
+        void rewrite( Ast::Program::astList_t& ast )
         {
-            const Ast::CloseValue* const lastParentUpvalue = upvalueChain;
-            StreamMark mark(stream);
-
-            eatwhitespace(mark);
-            
-            if (!eatReservedWord( "def", mark ) && !eatReservedWord( "fun", mark ))
-                throw ErrorNoMatch();
-
-            char c = mark.getc();
-            if (c == '!')
-                postApply_ = true;
-            else
-                mark.regurg(c);
-
-            eatwhitespace(mark);
-
-            c = mark.getc();
-            if (c == ':')
+            // branches first, so a helper bound in one is done before anything
+            // outside that calls into it
+            for (Ast::Base* p : ast)
             {
-                try
+                if (p->instr_ == Ast::Base::kIfElse || p->instr_ == Ast::Base::kTCOIfElse)
                 {
-                    Identifier param(mark);
-                    eatwhitespace(mark);
-                    defname_ = std::unique_ptr<std::string>(new std::string(param.name()));
+                    const Ast::IfElse& ifelse = *reinterpret_cast<const Ast::IfElse*>(p);
+                    if (ifelse.ifBranch())
+                        rewrite( astOf( ifelse.ifBranch() ) );
+                    if (ifelse.elseBranch())
+                        rewrite( astOf( ifelse.elseBranch() ) );
                 }
-                catch ( const ErrorNoMatch& )
+                else if (p->instr_ == Ast::Base::kApplyProgram || p->instr_ == Ast::Base::kTCOApplyProgram)
                 {
-                    bangerr(ParseFail) << "in " << mark.sayWhere() << "identifier must follow \"def :\"";
+                    const Ast::Program* prog = reinterpret_cast<const Ast::Program*>(p);
+                    if (prog->compiled())
+                        rewrite( astOf( prog ) );
                 }
             }
-            else
-                mark.regurg( c );
+            // and from the last binding back, for the same reason
+            for (int i = int(ast.size()) - 1; i >= 0; --i)
+            {
+                Ast::Program* fun = literalAt( ast, i );
+                if (!fun)
+                    continue;
+                calls_.clear();
+                walked_.clear();
+                if (!scan( ast, i + 2, 0 ))
+                    continue;
+                for (const Call& call : calls_)
+                {
+                    Ast::PushFunctionRec* direct = new Ast::PushFunctionRec( fun, NthParent( call.k + 1 ) );
+                    direct->setApply();
+                    if (call.instr->instr_ == Ast::Base::kTCOApply)
+                        direct->convertToTailCall();
+                    *std::find( call.ast->begin(), call.ast->end(), call.instr ) = direct;
+                }
+                ast[i] = new Ast::Move( Value() );
+            }
+        }
+    };
+}
 
-            pDefProg_ = new Ast::Program(nullptr);
-            const Ast::CloseValue* const entryUvChain = upvalueChain;
-            upvalueChain = getParamBindings( mark, pDefProg_->astRef(), upvalueChain );
+// Calls the functions a body binds, and only ever calls, without making
+// closures for them.
+void CallLocalFunsDirectly( std::vector<Ast::Base*>& ast )
+{
+    LocalFunCalls local;
+    local.rewrite( ast );
+}
+#endif 
 
-            ParsingRecursiveFunStack recursiveStack( pRecParsing, pDefProg_, lastParentUpvalue, defname_ ? *defname_ : "" );
-            Program progdef( parsectx, mark, nullptr, upvalueChain, entryUvChain,
-                defname_ ? &recursiveStack : pRecParsing,
-                pDefProg_->astRef() );
-            
-            mark.accept();
+#if LCFG_SHARED_CLOSURES
+namespace {
+    // What a function body reaches past its own bindings for: the upvalues
+    // of its environment it reads, numbered up from the environment's
+    // innermost binding, counting the functions bound there it calls or
+    // closes over (but not itself, recursing).  walk() is false if there's
+    // no telling, as for a lookup by name, or a body not compiled yet unless
+    // compile_.
+    class EnvReads
+    {
+        const Ast::Program* fun_;
+        const bool compile_;
+        std::vector<std::pair<const Ast::Program*,int>> walked_; // functions looked into, once each per environment
+    public:
+        std::vector<int> reads_; // may repeat
+
+    private:
+        const Ast::Program::astList_t* astOf( const Ast::Program* p ) const
+        {
+            if (p->compiled())
+                return &const_cast<Ast::Program*>( p )->astRef();
+            return compile_ ? p->getAst() : nullptr;
+        }
+
+        // a call to, or closure over, a function bound n up; its body reads
+        // from its own environment, "at" up from ours (below it if negative)
+        bool funRec( const Ast::PushFunctionRec& afn, int locals, int shift )
+        {
+            if (afn.bindingParent() == kNoParent)
+                return true;
+            const Ast::Program* fun = afn.recFun();
+            const int at = afn.bindingParent().toint() - locals + shift;
+            if (at == 0 && fun == fun_)
+                return true; // recursion is fine, it gets the same environment
+            if (at >= 0)
+                reads_.push_back( at );
+            const std::pair<const Ast::Program*,int> key( fun, at );
+            if (std::find( walked_.begin(), walked_.end(), key ) != walked_.end())
+                return true;
+            const Ast::Program::astList_t* body = astOf( fun );
+            if (!body)
+                return false;
+            walked_.push_back( key );
+            return walk( *body, 0, at );
         }
 
-        bool hasPostApply() const { return postApply_; }
-        Ast::Program* stealDefProg() { auto rc = pDefProg_; pDefProg_ = nullptr; return rc; }
-        const std::string& getDefName() { return *defname_; }
-        bool hasDefName() const { return static_cast<bool>(defname_); }
-    }; // end, Defdef class
-    
-    Program* program_;
-    Ast::Program::astList_t programAst_;
-public:
-    Parser( ParsingContext& ctx, StreamMark& mark, const Ast::Program* parent )
-    {
-        program_ = new Program( ctx, mark, parent, nullptr, nullptr, nullptr, programAst_ ); // 0,0,0 = no upvalues, no recursive chain
-    }
+        bool walk( const Ast::Program* prog, int locals, int shift )
+        {
+            const Ast::Program::astList_t* ast = astOf( prog );
+            return ast && walk( *ast, locals, shift );
+        }
 
-    Parser( ParsingContext& ctx, StreamMark& mark, const Ast::CloseValue* upvalchain )
-    {
-        program_ = new Program( ctx, mark, nullptr /*parent*/, upvalchain, upvalchain, nullptr, programAst_ ); // 0,0,0 = no upvalues, no recursive chain
-    }
-    
-    const Ast::Program::astList_t& programAst()
-    {
-        return programAst_;
-    }
-};
+        // locals: bindings since the start of ast; upvalue k there is
+        // k - locals + shift up from the function's environment
+        bool walk( const Ast::Program::astList_t& ast, int locals, int shift )
+        {
+            std::vector<const Ast::ValueEater*> reads;
+            for (const Ast::Base* p : ast)
+            {
+                switch (p->instr_)
+                {
+                    case Ast::Base::kIfElse:
+                    case Ast::Base::kTCOIfElse:
+                    {
+                        const Ast::IfElse& ifelse = *reinterpret_cast<const Ast::IfElse*>(p);
+                        if (ifelse.ifBranch() && !walk( ifelse.ifBranch(), locals, shift ))
+                            return false;
+                        if (ifelse.elseBranch() && !walk( ifelse.elseBranch(), locals, shift ))
+                            return false;
+                    }
+                    break;
 
-    Ast::Base* ImportParsingContext::hitEof( const Ast::CloseValue* uvchain )
-    {
-        Parser p( parsecontext_, stream_, uvchain );
+                    case Ast::Base::kApplyProgram:
+                    case Ast::Base::kTCOApplyProgram:
+                        if (!walk( reinterpret_cast<const Ast::Program*>(p), locals, shift ))
+                            return false;
+                        break;
 
-        auto prog = new Ast::Program( parent_, p.programAst() );  //~~~todo: refactor me up
-        prog->setApply();
-        return prog;
+                    case Ast::Base::kApplyFunRec:
+                    case Ast::Base::kTCOApplyFunRec:
+                        if (!funRec( *reinterpret_cast<const Ast::PushFunctionRec*>(p), locals, shift ))
+                            return false;
+                        break;
+
+                    default:
+                        if (const Ast::PushFunctionRec* pfn = dynamic_cast<const Ast::PushFunctionRec*>(p))
+                        {
+                            if (!funRec( *pfn, locals, shift ))
+                                return false;
+                            break;
+                        }
+                        if (const Ast::Program* prog = dynamic_cast<const Ast::Program*>(p))
+                        {
+                            // a closure; what it reads past its own bindings is ours
+                            if (!walk( prog, locals, shift ))
+                                return false;
+                            break;
+                        }
+                        reads.clear();
+                        if (!UpvalueReads( p, reads ))
+                            return false;
+                        for (const Ast::ValueEater* ve : reads)
+                        {
+                            if (ve->v1src_ != kSrcUpval)
+                                continue;
+                            const int up = ve->v1uvnumber_.toint() - locals + shift;
+                            if (up >= 0)
+                                reads_.push_back( up );
+                        }
+                        break;
+                }
+                locals += NewBindings( p );
+            }
+            return true;
+        }
+
+    public:
+        EnvReads( const Ast::Program* fun, bool compile )
+        : fun_( fun ), compile_( compile )
+        {}
+        bool walk( const Ast::Program::astList_t& ast ) { return walk( ast, 0, 0 ); }
+    };
+}
+
+// A body that needs nothing from the environment it's made in gets one
+// closure, made here, that every run of the literal hands out.  ast is
+// the body, which for a lazy one isn't in ast_ yet.  The closure has no
+// environment at all: keeping whichever one it was first made in would let
+// rebind! and freeze! on one run's closure reach another run's bindings, so
+// rebind! on it reports that there is no such upvalue.
+void Ast::Program::shareIfClosed( const astList_t& ast ) const
+{
+    EnvReads body( this, false );
+    if (body.walk( ast ) && body.reads_.empty())
+        shared_ = Value( NEW_BANGFUN(BoundProgram, this, SHAREDUPVALUE()) );
+}
+#endif 
+
+// The upvalues of a closure's environment its body can read, or false if
+// there's no telling.
+static bool ReadUpvalues( const BoundProgram& bp, std::vector<Upvalue*>& uvs )
+{
+    if (!bp.upvalues_)
+        return true;
+#if LCFG_SHARED_CLOSURES
+    EnvReads body( bp.program_, true );
+    if (body.walk( *bp.program_->getAst() ))
+    {
+        for (int up : body.reads_)
+            uvs.push_back( const_cast<Upvalue*>( up ? bp.upvalues_->nthParent( NthParent( up ) ).get() : bp.upvalues_.get() ) );
+        return true;
+    }
+#endif 
+    return false;
+}
+
+// Only the upvalues the body can read get frozen; the rest of the
+// environment is none of the closure's business, and may well hold things
+// that can't be frozen (a channel) or are still being changed.
+void BoundProgram::freeze()
+{
+    this->immortalize();
+    std::vector<Upvalue*> uvs;
+    if (!ReadUpvalues( *this, uvs ))
+    {
+        FreezeUpvalues( upvalues_.get() );
+        return;
     }
-    
+    for (Upvalue* uv : uvs)
+        FreezeUpvalue( uv );
+}
+
+bool BoundProgram::shareable( std::vector<const Function*>& seen ) const
+{
+    std::vector<Upvalue*> uvs;
+    if (!ReadUpvalues( *this, uvs ))
+        return ShareableUpvalues( upvalues_.get(), seen );
+    for (const Upvalue* uv : uvs)
+        if (!Bang::shareable( uv->v_, seen ))
+            return false;
+    return true;
+}
 
 void OptimizeAst( std::vector<Ast::Base*>& ast, const Ast::CloseValue* upvalueChain, bool noTco )
 {
@@ -3704,6 +9056,21 @@ void OptimizeAst( std::vector<Ast::Base*>& ast, const Ast::CloseValue* upvalueCh
                 ast.erase( ast.begin() + i );
         }
     };
+
+#if LCFG_X64JIT
+    // an import! splices in an already optimized Ast; its native segments
+    // were compiled against instructions the passes below may still rewrite
+    ast.erase
+    (   std::remove_if( ast.begin(), ast.end(),
+            []( const Ast::Base* p ) {
+                if (p->instr_ != Ast::Base::kJitSegment)
+                    return false;
+                delete p;
+                return true;
+            } ),
+        ast.end()
+    );
+#endif 
     
     for (unsigned i = 0; i < ast.size() - 1; ++i)
     {
@@ -3715,7 +9082,7 @@ void OptimizeAst( std::vector<Ast::Base*>& ast, const Ast::CloseValue* upvalueCh
         if (pup && !pup->hasApply() && dynamic_cast<const Ast::Apply*>( second ))
         {
             pup->setApply();
-            first->where_ = second->where_;
+            isolateState().sourceMap.move( first, second );
             ast[i+1] = &noop;
             ++i; // increment i an additional time to skip the incorporated Apply
         }
@@ -4022,6 +9389,15 @@ void OptimizeAst( std::vector<Ast::Base*>& ast, const Ast::CloseValue* upvalueCh
             }
         }
     }
+
+#if LCFG_NUMEXPR
+    BuildNumExprs( ast );
+#endif 
+
+#if LCFG_X64JIT
+    if (isolateState().jit)
+        JitCompileAst( ast );
+#endif 
 }
 
 #if !defined(_WIN32)
@@ -4068,6 +9444,13 @@ namespace Primitives {
             return;
         }
 #endif 
+#if HAVE_BUILTIN_NYLON
+        if (libname == "bangnylon")
+        {
+            bang_bangnylon_open( &s, &rc );
+            return;
+        }
+#endif 
 #if HAVE_BUILTIN_MATH
         if (libname == "mathlib")
         {
@@ -4124,6 +9507,13 @@ namespace Primitives {
             return;
         }
 #endif 
+#if HAVE_BUILTIN_NYLON
+        if (libname == "bangnylon")
+        {
+            bang_bangnylon_open( &s, &rc );
+            return;
+        }
+#endif 
         
         const std::string libname_noext = libname;
 
@@ -4173,9 +9563,17 @@ namespace Primitives {
 
         try
         {
+#if LCFG_X64JIT
+            const unsigned module = gJitCache.newModule();
+            JitModuleScope jitscope( module );
+#endif 
             Parser parser( parsectx, mark, upvalchain );
 
             Ast::Program* p = new Ast::Program( nullptr /* parent */, parser.programAst() );
+#if LCFG_X64JIT
+            gJitCache.bindModule( p, module );
+            isolateState().jitModules.push_back( p );
+#endif 
             
             if (bDump)
                 p->dump( 0, std::cerr );
@@ -4241,7 +9639,7 @@ namespace Primitives {
     
     Ast::Base* setwhere( Ast::Base* ast, const RegurgeStream& s )
     {
-        ast->where_ = s.sayWhere();
+        isolateState().sourceMap.set( ast, s.location() );
         return ast;
     }
     Ast::Base* newapplywhere( const RegurgeStream& s )
@@ -4735,7 +10133,7 @@ Parser::Program::Program
                     RequireKeyword requireImport( who->tostr().c_str() );
                     delete prev;
                     // bah, really need to pass in parent's upvalue chain here
-                    auto prog = requireImport.parseToProgramWithUpvals( importContext, upvalueChain, gDumpMode ); // DUMP
+                    auto prog = requireImport.parseToProgramWithUpvals( importContext, upvalueChain, isolateState().dumpMode ); // DUMP
                     //~~~ bah, a mess
                     auto importAst = prog->getAst();
                     std::copy( importAst->begin(), importAst->end(), std::back_inserter(ast_));
@@ -4803,6 +10201,11 @@ Parser::Program::Program
                 if (rwPrimitive( "crequire",         &Primitives::crequire    ) ) continue;
                 if (rwPrimitive( "tostring",         &Primitives::tostring    ) ) continue;
                 if (rwPrimitive( "is-thread-active", &Primitives::threadIsActive    ) ) continue;
+                if (rwPrimitive( "spawn",            &Primitives::spawn    ) ) continue;
+                if (rwPrimitive( "join",             &Primitives::join    ) ) continue;
+                if (rwPrimitive( "fork",             &Primitives::fork    ) ) continue;
+                if (rwPrimitive( "channel",          &Primitives::channel    ) ) continue;
+                if (rwPrimitive( "freeze",           &Primitives::freeze    ) ) continue;
             
                 bool bFoundRecFunId = false;
 
@@ -4880,16 +10283,462 @@ Parser::Program::Program
     };
 
 
+void Parser::BodySkimmer::defdef( StreamMark& mark )
+{
+    // "def"/"fun" already consumed; mirrors Defdef + getParamBindings
+    char c = mark.getc();
+    if (c != '!')
+        mark.regurg(c);
+
+    eatwhitespace(mark);
+
+    c = mark.getc();
+    if (c == ':')
+    {
+        Identifier name( mark );
+        eatwhitespace(mark);
+    }
+    else
+        mark.regurg(c);
+
+    while (true)
+    {
+        try
+        {
+            Identifier param( mark );
+            eatwhitespace(mark);
+            mark.accept();
+        }
+        catch (const ErrorNoMatch& )
+        {
+            break;
+        }
+    }
+
+    if (mark.getc() != '=')
+        throw SkimAbort();
+    mark.accept();
+
+    program( mark );
+}
+
+bool Parser::BodySkimmer::program( StreamMark& stream )
+{
+    bool bHasOpenBracket = false;
+    bool bHasOpenIndex = false;
+    bool bHasOpenArray = false;
+
+    while (true)
+    {
+        eatwhitespace(stream);
+
+        try
+        {
+            Comment c(stream);
+            continue;
+        } catch ( const ErrorNoMatch& ) {}
+
+        try
+        {
+            ParseLiteral aLiteral(stream);
+            continue;
+        } catch ( const ErrorNoMatch& ) {}
+
+        {
+            StreamMark mark(stream);
+            if (eatReservedWord("as", mark) && eatwhitespace(mark))
+            {
+                Identifier valueName( mark );
+                mark.accept();
+                continue;
+            }
+        }
+
+        {
+            StreamMark mark(stream);
+            eatwhitespace(mark);
+            if (eatReservedWord( "def", mark ) || eatReservedWord( "fun", mark ))
+            {
+                defdef( mark );
+                mark.accept();
+                continue;
+            }
+        }
+
+        // single character operators
+        StreamMark mark(stream);
+        char c = mark.getc();
+        switch (c)
+        {
+            case ';':
+                mark.accept();
+                return true;
+            case '{':
+                mark.accept();
+                bHasOpenBracket = true;
+                continue;
+            case ':':
+                return false;
+            case '}':
+                if (bHasOpenBracket)
+                    mark.accept();
+                return bHasOpenBracket;
+            case '!':
+                mark.accept();
+                continue;
+            case ']':
+                if (!bHasOpenIndex && !bHasOpenArray)
+                    return false;
+                mark.accept();
+                continue;
+            case '[':
+                bHasOpenIndex = true;
+                mark.accept();
+                program( stream );
+                continue;
+            case '?':
+                mark.accept();
+                program( stream );
+                eatwhitespace(stream);
+                c = mark.getc();
+                if (c == ':')
+                {
+                    mark.accept();
+                    program( stream );
+                }
+                else
+                    mark.regurg(c);
+                continue;
+            case '.':
+            {
+                mark.accept();
+                Identifier methodName( mark );
+                mark.accept();
+                continue;
+            }
+        }
+#if HAVE_BUILTIN_ARRAY
+        if (c == '@')
+        {
+            const char c2 = mark.getc();
+            if (c2 == '[')
+            {
+                bHasOpenArray = true;
+                mark.accept();
+                program( stream );
+                continue;
+            }
+            mark.regurg(c2);
+        }
+#endif
+        if (bangprimforchar(c))
+        {
+            mark.accept();
+            continue;
+        }
+        mark.regurg(c);
+
+        try
+        {
+            OperatorToken op( mark );
+            const std::string& token = op.name();
+            mark.accept();
+
+            if (token == "~" || token == "/not" || token == "<~" || token == ">=" || token == ">~"
+                || token == "<=" || token == "=~" || token == "<>" || token == "/and" || token == "/or"
+                || token == "^bind" || token == "^^bind" || token == "/throw"
+#if LCFG_HAVE_TAV_SWAP
+                || token == "~-" || token == "~/"
+#endif
+               )
+            {
+                continue;
+            }
+
+            if (optoken2enum( token ) == kOpCustom)
+            {
+                eatwhitespace(mark);
+                c = mark.getc();
+                if (c != '.')
+                    mark.regurg(c);
+                else
+                {
+                    mark.accept();
+                    Identifier methodName( mark );
+                    mark.accept();
+                }
+            }
+            continue;
+        }
+        catch (const ErrorNoMatch& )
+        {
+        }
+
+        // identifiers and reserved words
+        Identifier ident( mark );
+        if (ident.name() == "import" || ident.name() == "try")
+            throw SkimAbort();
+
+        if (ident.name() == "catch")
+            return false;
+
+        if (ident.name() == "coroutine" || ident.name() == "yield-nil" || ident.name() == "yield")
+            mark.getc(); // the parser takes the next char whether or not it is the '!'
+        mark.accept();
+    }
+}
+
+    // Everything needed to parse a "fun" body later exactly as it would have
+    // been parsed at load time: the source text and where it came from, plus
+    // the binding and recursive-function chains that were in scope.
+    class LazyProgramBody
+    {
+        typedef Parser::ParsingRecursiveFunStack RecStack;
+
+        class LazyParsingContext : public ParsingContext
+        {
+        public:
+            LazyParsingContext( bool unknownSymbolsAreStrings )
+            {
+                this->unknownSymbolsAreStrings = unknownSymbolsAreStrings;
+            }
+            Ast::Base* hitEof( const Ast::CloseValue* uvchain )
+            {
+                return new Ast::BreakProg();
+            }
+        };
+
+        std::string text_;
+        SourceLocation where_;
+        bool unknownSymbolsAreStrings_;
+        const Ast::CloseValue* upvalueChain_;
+        const Ast::CloseValue* entryUvChain_;
+        const RecStack* pRecParsing_; // owned copy; the parser's chain lives on the C++ stack
+#if LCFG_X64JIT
+        unsigned jitModule_;
+#endif 
+
+        static const RecStack* copyChain( const RecStack* p )
+        {
+            return p ? new RecStack( copyChain(p->prev), p->parentProgram, p->parentsBinding, p->progname_ ) : nullptr;
+        }
+    public:
+        LazyProgramBody
+        (   const std::string& text, const SourceLocation& where, bool unknownSymbolsAreStrings,
+            const Ast::CloseValue* upvalueChain, const Ast::CloseValue* entryUvChain,
+            const RecStack* pRecParsing
+        )
+        : text_( text ), where_( where ), unknownSymbolsAreStrings_( unknownSymbolsAreStrings ),
+          upvalueChain_( upvalueChain ), entryUvChain_( entryUvChain ),
+          pRecParsing_( copyChain( pRecParsing ) )
+#if LCFG_X64JIT
+          , jitModule_( gJitModule )
+#endif 
+        {}
+
+        ~LazyProgramBody()
+        {
+            while (pRecParsing_)
+            {
+                auto prev = pRecParsing_->prev;
+                delete pRecParsing_;
+                pRecParsing_ = prev;
+            }
+        }
+
+        void compile( Ast::Program::astList_t& ast ) const
+        {
+            LazyParsingContext parsectx( unknownSymbolsAreStrings_ );
+#if LCFG_X64JIT
+            JitModuleScope jitscope( jitModule_ );
+#endif 
+            RegurgeText stream( text_, where_ );
+            StreamMark mark( stream );
+            Parser::Program body( parsectx, mark, nullptr, upvalueChain_, entryUvChain_, pRecParsing_, ast );
+        }
+    };
+
+    bool Parser::Defdef::skimLazyBody
+    (   ParsingContext& parsectx, StreamMark& stream,
+        const Ast::CloseValue* upvalueChain, const Ast::CloseValue* entryUvChain,
+        const ParsingRecursiveFunStack* pRecParsing
+    )
+    {
+        StreamMark mark( stream );
+        const SourceLocation where = mark.location();
+        std::string text;
+        try
+        {
+            BodySkimmer skim( mark );
+            const bool closed = skim.program();
+            text = skim.text();
+            // a terminator left for the enclosing program (':', ']', ...) ends
+            // the body just the same, so close it explicitly for the later parse
+            if (!closed)
+                text.push_back(';');
+        }
+        catch (const BodySkimmer::SkimAbort& )
+        {
+            return false;
+        }
+        catch (const ErrorNoMatch& )
+        {
+            return false;
+        }
+        catch (const ErrorEof& )
+        {
+            return false;
+        }
+
+        pDefProg_->setLazyBody
+        (   new LazyProgramBody
+            (   text, where, parsectx.unknownSymbolsAreStrings,
+                upvalueChain, entryUvChain, pRecParsing
+            )
+        );
+        mark.accept();
+        return true;
+    }
+
+    void Ast::Program::compileLazyBody() const
+    {
+        LATE_COMPILE_LOCK;
+        LazyProgramBody* lazy = lazy_;
+        if (!lazy) // another thread got here first
+            return;
+        // built on the side, so other threads go on seeing a lazy body until
+        // it's ready; if compiling throws it stays lazy, and the same error
+        // comes up on the next call
+        astList_t ast( ast_ );
+        lazy->compile( ast );
+#if LCFG_LOCALFUN
+        CallLocalFunsDirectly( ast );
+#endif 
+#if LCFG_NUMSPEC
+        SpecializeNumFun( ast, this );
+#endif 
+#if LCFG_CSE
+        ReuseCommonReads( ast );
+#endif 
+#if LCFG_LICM
+        HoistLoopInvariants( ast, this );
+#endif 
+#if LCFG_SHARED_CLOSURES
+        shareIfClosed( ast );
+#endif 
+        const_cast<astList_t&>( ast_ ).swap( ast );
+        lazy_ = nullptr;
+        delete lazy;
+    }
+
+    DLLEXPORT void setLazyCompile( bool lazy )
+    {
+        isolateState().lazyCompile = lazy;
+    }
+
+    DLLEXPORT void setJit( bool jit )
+    {
+#if LCFG_X64JIT
+        isolateState().jit = jit;
+#endif 
+    }
+
+    DLLEXPORT void setJitCacheLimit( size_t bytes )
+    {
+#if LCFG_X64JIT
+        gJitCache.setLimit( bytes );
+#endif 
+    }
+
+    DLLEXPORT void releaseJitCode( const Ast::Program* module )
+    {
+#if LCFG_X64JIT
+        gJitCache.releaseModule( module );
+#endif 
+    }
+
+    DLLEXPORT void dumpJitStats( std::ostream& o )
+    {
+#if LCFG_X64JIT
+        gJitCache.dump( o );
+#endif 
+    }
+
+
+#if HAVE_BUILTIN_STDLIB
+    // lib/*.bang as linked into libbang by the build, see stdlib-image.cpp
+    struct StdLibModule
+    {
+        const char* name;
+        const char* source;
+    };
+    extern const StdLibModule gStdLibImage[];
+#endif
+
+    // 'std:<name>' require! comes from the standard library image built into
+    // libbang (or lib/<name>.bang when built without one), independent of the
+    // working directory.  A module is parsed once per isolate, with its fun
+    // bodies left to be compiled lazily as they are used.
+    static const Ast::Program* requireStdModule( const std::string& name )
+    {
+        Isolate::State& iso = isolateState();
+        auto& loaded = iso.stdModules;
+
+        auto it = loaded.find( name );
+        if (it != loaded.end())
+            return it->second;
+
+        RequireParsingContext parsectx;
+        Ast::Program* prog = nullptr;
+#if HAVE_BUILTIN_STDLIB
+        for (const StdLibModule* mod = gStdLibImage; mod->name && !prog; ++mod)
+        {
+            if (name != mod->name)
+                continue;
+
+            const bool wasLazy = iso.lazyCompile;
+            iso.lazyCompile = true;
+            try
+            {
+                const std::string source( mod->source );
+                RegurgeText stream( source, SourceLocation( iso.sourceMap.fileid( "std:" + name ), 1, 0 ) );
+                prog = ParseToProgram( parsectx, stream, iso.dumpMode, nullptr );
+            }
+            catch (...)
+            {
+                iso.lazyCompile = wasLazy;
+                throw;
+            }
+            iso.lazyCompile = wasLazy;
+        }
+#endif
+        if (!prog)
+        {
+            RequireKeyword me( ("lib/" + name + ".bang").c_str() );
+            prog = me.parseToProgramNoUpvals( parsectx, iso.dumpMode );
+        }
+
+        loaded[name] = prog;
+        return prog;
+    }
+
 void Ast::Require::run( Stack& stack, const RunContext& rc ) const
 {
     const auto& v = stack.pop(); // get file name
     if (!v.isstr())
         throw std::runtime_error("no filename found for require??");
 
-    RequireKeyword me( v.tostr().c_str() );
+    const std::string filename = v.tostr();
+    if (filename.compare( 0, 4, "std:" ) == 0)
+    {
+        stack.push( NEW_BANGFUN(BoundProgram, requireStdModule( filename.substr(4) ), SHAREDUPVALUE()) );
+        return;
+    }
+
+    RequireKeyword me( filename.c_str() );
     RequireParsingContext parsectx_;
     
-    auto fun = me.parseToProgramNoUpvals( parsectx_, gDumpMode );
+    auto fun = me.parseToProgramNoUpvals( parsectx_, isolateState().dumpMode );
     SHAREDUPVALUE noUpvals;
     const auto& closure = NEW_BANGFUN(BoundProgram, fun, noUpvals );
 
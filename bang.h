@@ -13,6 +13,9 @@
 #include <iostream>
 #include <string.h>
 #include <sstream> // for bangerr
+#include <atomic>
+#include <exception>
+#include <climits>
 
 #define LCFG_STD_STRING 0
 #define LCFG_GCPTR_STD 0
@@ -26,7 +29,9 @@
 # endif 
 #endif
 
-#define LCFG_HAVE_TRY_CATCH 0
+#ifndef LCFG_HAVE_TRY_CATCH
+# define LCFG_HAVE_TRY_CATCH 0
+#endif
 
 
 static const char* const BANG_VERSION = "0.006";
@@ -41,9 +46,13 @@ static const char* const BANG_VERSION = "0.006";
 # include "atomic.h"
 #define MT_SAFEISH_INC(counter) Atomic::increment( counter )
 #define MT_SAFEISH_DEC(counter) (0 == Atomic::decrement( counter ))
+#define MT_SAFEISH_LOAD(counter) Atomic::load( counter )
+#define MT_SAFEISH_STORE(counter,v) Atomic::store( counter, v )
 #else
 #define MT_SAFEISH_INC(counter) ++counter
 #define MT_SAFEISH_DEC(counter) (0 == --counter)
+#define MT_SAFEISH_LOAD(counter) (counter)
+#define MT_SAFEISH_STORE(counter,v) (counter = v)
 #endif
 
 
@@ -141,6 +150,16 @@ namespace Bang
         static DLLEXPORT void freemem(Upvalue*thingmem);
     };
 
+#if !LCFG_GCPTR_STD
+    // the last reference to a coroutine hands it back to the pool, see ThreadPool
+    template<>
+    class GCDeleter<Thread>
+    {
+    public:
+        static DLLEXPORT void deleter( Thread* thread );
+    };
+#endif
+
 
 
 #if LCFG_GCPTR_STD
@@ -148,7 +167,13 @@ namespace Bang
     typedef std::shared_ptr<Upvalue>  gcptrupval;
 # define gcptr std::shared_ptr
     template <class T>
-    struct gcbase {};
+    struct gcbase
+    {
+        // shared_ptr counts can't be pinned; this only remembers freeze!
+        bool frozen_ = false;
+        bool immortal() const { return frozen_; }
+        void immortalize() { frozen_ = true; }
+    };
 #else
     typedef gcptr<Function> gcptrfun;
     typedef gcptr<Upvalue>  gcptrupval;
@@ -156,7 +181,7 @@ namespace Bang
 
     #include "pvec.h"
 
-typedef std::shared_ptr<Thread> bangthreadptr_t;
+typedef gcptr<Thread> bangthreadptr_t;
     
 typedef gcptrfun bangfunptr_t;
 #define BANGFUN_CREF const Bang::bangfunptr_t&
@@ -169,7 +194,7 @@ typedef gcptrfun bangfunptr_t;
 
 #define BANGFUNPTR bangfunptr_t
 
-#define NEW_BANGTHREAD  std::make_shared<Thread>
+#define NEW_BANGTHREAD  Bang::Thread::make
 #define BANGTHREAD_CREF const Bang::bangthreadptr_t&
 #define BANGTHREADPTR   bangthreadptr_t
 
@@ -250,16 +275,19 @@ typedef gcptrfun bangfunptr_t;
             {
                 delete[] str;
             }
+            bool immortal() const { return MT_SAFEISH_LOAD(refcount) >= kImmortalFloor; }
+            void immortalize() { MT_SAFEISH_STORE(refcount, kImmortalRefcount); }
             void unref()
             {
-                if (MT_SAFEISH_DEC(refcount)) // i am the winner!
+                if (!immortal() && MT_SAFEISH_DEC(refcount)) // i am the winner!
                 {
                     delete this;
                 }
             }
             void ref()
             {
-                MT_SAFEISH_INC(refcount);
+                if (!immortal())
+                    MT_SAFEISH_INC(refcount);
             }
             bool operator==( const bangstringstore& rhs ) const
             {
@@ -348,6 +376,9 @@ typedef gcptrfun bangfunptr_t;
         size_t size() const { return store_->len; }
         size_t length() const { return store_->len; }
 
+        // see freeze!; every copy shares the store, so this is for all of them
+        void immortalize() const { store_->immortalize(); }
+
         const char* c_str() const { return store_->str; }
 
         bangstring operator+( const bangstring& rhs ) const
@@ -366,6 +397,7 @@ typedef gcptrfun bangfunptr_t;
 
     class Value
     {
+        friend struct JitLayout;
         inline void copyme( const Value& rhs )
         {
             switch (rhs.type_)
@@ -376,7 +408,7 @@ typedef gcptrfun bangfunptr_t;
                 case kBool: v_.b = rhs.v_.b; return;
                 case kNum:  v_.num = rhs.v_.num; return;
                 case kFunPrimitive: v_.funprim = rhs.v_.funprim; return;
-                case kThread:  new (v_.cthread) std::shared_ptr<Thread>( rhs.tothread() ); return;
+                case kThread:  new (v_.cthread) BANGTHREADPTR( rhs.tothread() ); return;
                 default: return;
             }
         }
@@ -391,7 +423,7 @@ typedef gcptrfun bangfunptr_t;
                 case kBool: v_.b = rhs.v_.b; return;
                 case kNum:  v_.num = rhs.v_.num; return;
                 case kFunPrimitive: v_.funprim = rhs.v_.funprim; return;
-                case kThread:  new (v_.cthread) std::shared_ptr<Thread>( rhs.tothread() ); return;
+                case kThread:  new (v_.cthread) BANGTHREADPTR( rhs.tothread() ); return;
                 default: return;
             }
         }
@@ -406,7 +438,7 @@ typedef gcptrfun bangfunptr_t;
                 case kFun:
                     reinterpret_cast<gcptrfun*>(v_.cfun)->~gcptrfun();
                     return;
-                case kThread: reinterpret_cast<BANGTHREADPTR*>(v_.cthread)->~shared_ptr<Thread>(); return;
+                case kThread: reinterpret_cast<BANGTHREADPTR*>(v_.cthread)->~BANGTHREADPTR(); return;
             }
         }
     public:
@@ -533,7 +565,7 @@ typedef gcptrfun bangfunptr_t;
         Value( BANGTHREAD_CREF thread )
         : type_( kThread )
         {
-            new (v_.cthread) std::shared_ptr<Thread>(thread);
+            new (v_.cthread) BANGTHREADPTR(thread);
         }
 
         ~Value()
@@ -585,7 +617,7 @@ typedef gcptrfun bangfunptr_t;
         bool   tobool() const { return v_.b; }
         const bangstring& tostr() const { return *reinterpret_cast<const bangstring*>(v_.cstr); }
         tfn_primitive tofunprim() const { return v_.funprim; }
-        BANGTHREAD_CREF tothread() const { return *reinterpret_cast<const std::shared_ptr<Thread>* >(v_.cthread); }
+        BANGTHREAD_CREF tothread() const { return *reinterpret_cast<const BANGTHREADPTR* >(v_.cthread); }
         void tostring( std::ostream& ) const;
     
         void dump( std::ostream& o ) const;
@@ -640,6 +672,11 @@ typedef gcptrfun bangfunptr_t;
 
         const Ast::CloseValue* upvalParseChain() const { return closer_; } // needed for REPL/EofMarker::run()
 
+        // where parent_ and v_ sit, for the JIT; offsetof isn't supported
+        // on a class whose base has members too
+        static int parentOffset();
+        static int valueOffset();
+
         const Value& getUpValue( NthParent uvnumber ) const
         {
             const Upvalue* uv = this;
@@ -686,25 +723,24 @@ typedef gcptrfun bangfunptr_t;
         {
             return std::back_inserter( stack_ );
         }
+        // Everything above the bound goes onto the end of other.  Without a
+        // bound, into an empty other, that's just swapping buffers; otherwise
+        // the values are moved across, never copied.
         void giveTo( std::vector<Value>& other )
         {
             if (stack_.size() < 1)
                 return;
-            
-            if (!bound_)
-            {
-                for (auto it = stack_.begin(); it < stack_.end(); ++it )
-                    other.push_back( *it );
-                // other = stack_;
-                 stack_.clear();
-//                stack_.swap( other );
-            }
-            else
+
+            const size_t from = bound_ ? bound_->mark : 0;
+            if (!from && other.empty())
             {
-                for (auto it = stack_.begin() + bound_->mark; it < stack_.end(); ++it )
-                    other.push_back( *it );
-                stack_.erase( stack_.begin() + bound_->mark, stack_.end() );
+                stack_.swap( other );
+                return;
             }
+            other.reserve( other.size() + stack_.size() - from );
+            for (size_t i = from; i < stack_.size(); ++i)
+                other.emplace_back( std::move( stack_[i] ) );
+            stack_.resize( from );
         }
         
         void giveTo( Stack& other )
@@ -716,6 +752,19 @@ typedef gcptrfun bangfunptr_t;
         : bound_(nullptr)
         {}
 
+        void reserve( size_t n ) { stack_.reserve( n ); }
+
+        // empties it for reuse, holding on to up to keep values' worth of memory
+        void recycle( size_t keep )
+        {
+            while (bound_)
+                endBound();
+            if (stack_.capacity() > keep)
+                std::vector<Value>().swap( stack_ );
+            else
+                stack_.clear();
+        }
+
         void beginBound()
         {
             bound_ = new Bound(stack_.size(), bound_);
@@ -821,14 +870,56 @@ typedef gcptrfun bangfunptr_t;
         virtual void apply( Stack& s ) = 0; // CLOSURE_CREF runningOrMyself ) = 0;
         DLLEXPORT virtual void indexOperator( const Value& theIndex, Stack&, const RunContext& );
         DLLEXPORT virtual void customOperator( const bangstring& theOperator, Stack& s);
+        // For those whose indexOperator just looks something up: finds what
+        // it would push without running any code or changing anything, so a
+        // repeat of the same read gets the same value.  False if there's
+        // nothing to find, or no telling without running indexOperator.
+        virtual bool lookup( const Value& theIndex, Value& found ) const { return false; }
+        // For freeze!: immortalize() this, then freeze everything it holds.
+        // Called at most once, through Bang::freeze.  Objects that can't be
+        // made immutable (the default) throw instead.
+        DLLEXPORT virtual void freeze();
+        bool frozen() const { return this->immortal(); }
+        // For Bang::shareable, on something not frozen: false if it can be
+        // changed in place, otherwise whether what it holds is shareable.
+        // The default is true, for things with nothing to change or that
+        // are made to be used from several threads, like channels.
+        DLLEXPORT virtual bool shareable( std::vector<const Function*>& seen ) const;
     };
 
+    // Makes v and everything reachable from it immutable and immortal, so
+    // it can be read from any thread without touching a refcount.  Throws
+    // on anything that can't be frozen; what was reached first stays frozen.
+    DLLEXPORT void freeze( const Value& v );
+
+    // Whether v can go to several workers at once as it is: nothing
+    // reachable from it, short of what's frozen, can be changed in place.
+    // fork! and the parallel Array methods require it.  seen holds what's
+    // been looked at already.
+    DLLEXPORT bool shareable( const Value& v, std::vector<const Function*>& seen );
+    DLLEXPORT bool shareable( const Value& v );
+
     
+    // Where in the source an instruction came from.  Kept out of the Ast nodes
+    // themselves (see SourceMap in bang.cpp) and only turned into a string when
+    // an error or dump actually needs it.
+    struct SourceLocation
+    {
+        unsigned fileid_; // 0 == unknown
+        int linecol_;
+        int lineno_;
+        SourceLocation() : fileid_(0), linecol_(0), lineno_(0) {}
+        SourceLocation( unsigned fileid, int lineno, int linecol )
+        : fileid_( fileid ), linecol_( linecol ), lineno_( lineno )
+        {}
+        bool known() const { return fileid_ != 0; }
+    };
+
     namespace Ast {
         class Base
         {
         public:
-            std::string where_;
+            DLLEXPORT std::string where() const;
             virtual void dump( int, std::ostream& o ) const = 0;
             virtual void run( Stack& stack, const RunContext& ) const
             {
@@ -861,12 +952,16 @@ typedef gcptrfun bangfunptr_t;
                 kTCOIfElse,
                 kMakeCoroutine,
                 kYieldCoroutine,
+                kNumExpr,
+                kNumSpecEntry,
+                kHoistInvariant,
+                kLoopInvariant,
+                kJitSegment,
                 kEofMarker
             };
-            Base() : instr_(kUnk) {
-                where_ = "Unknown:??";
-            }
+            Base() : instr_(kUnk) {}
             Base( EAstInstr i ) : instr_( i ) {}
+            DLLEXPORT virtual ~Base(); // drops its source location
             bool isTailable() const { return instr_ != kUnk && instr_ != kBreakProg; } //  && instr_ != kApplyFun; }
             // return instr_ == kApply || instr_ == kConditionalApply || instr_ == kApplyUpval; }
 
@@ -905,7 +1000,7 @@ typedef gcptrfun bangfunptr_t;
 
     
     
-    // if RunProgram is called outside of an active thread, use pNullThread;
+    // if RunProgram is called outside of an active thread, use Thread::nullthread();
     // this should cause the C-call to RunProgram to return when kBreakProg is found.
 DLLEXPORT void RunProgram
 (   
@@ -924,6 +1019,11 @@ DLLEXPORT void RunProgram
         RunContext* prev;
         const Ast::Base* const *ppInstr;
         SHAREDUPVALUE    upvalues_;
+        // upvalues_ is kept alive by something that outlasts this frame (the
+        // caller's environment or a closure bound in it), so the frame holds
+        // it without a reference of its own
+        bool borrowed_;
+        unsigned leafDepth_; // Thread::leafCallers_ made before this frame, see UnwindLeafCalls
 #if LCFG_HAVE_TRY_CATCH        
         Ast::Program *catcher;
 #endif 
@@ -935,9 +1035,22 @@ DLLEXPORT void RunProgram
 
 
         RunContext( Thread* inthread, const Ast::Base* const *inppInstr, SHAREDUPVALUE_CREF uv );
+        RunContext( Thread* inthread, const Ast::Base* const *inppInstr, Upvalue* borrowed );
         RunContext();
+        ~RunContext() { if (borrowed_) upvalues_.release(); }
         void rebind( const Ast::Base* const * inppInstr, SHAREDUPVALUE_CREF uv );
         void rebind( const Ast::Base* const * inppInstr );
+        void rebindBorrowed( const Ast::Base* const * inppInstr, Upvalue* uv );
+        // replaces upvalues_ with an environment built on top of it
+        void close( SHAREDUPVALUE&& uv )
+        {
+            if (borrowed_)
+            {
+                upvalues_.release();
+                borrowed_ = false;
+            }
+            upvalues_ = static_cast<SHAREDUPVALUE&&>( uv );
+        }
     };
     
     class BoundProgram : public Function
@@ -952,6 +1065,8 @@ DLLEXPORT void RunProgram
         void dump( std::ostream & out );
         virtual void apply( Stack& s );
         virtual void indexOperator( const Value& theIndex, Stack& stack, const RunContext& ctx );
+        virtual void freeze();
+        virtual bool shareable( std::vector<const Function*>& seen ) const;
     };
 
 
@@ -968,10 +1083,11 @@ template <class Tp>
 struct SimplePTAllocator
 {
     typedef Tp value_type;
-    SimplePTAllocator(/*ctor args*/) : head(nullptr) {}
-    template <class T> SimplePTAllocator(const SimplePTAllocator<T>& other){}
+    SimplePTAllocator(/*ctor args*/) : head(nullptr), freeOne(0) {}
+    template <class T> SimplePTAllocator(const SimplePTAllocator<T>& other) : head(nullptr), freeOne(0) {}
     template <class U> struct rebind { typedef SimplePTAllocator<U> other; };
     FcStackHdr<Tp>* head;
+    unsigned char freeOne; // per allocator, since threads each have their own
     
     Tp* allocate(std::size_t n)
     {
@@ -993,7 +1109,6 @@ struct SimplePTAllocator
     {
         FcStackHdr<Tp>* hdr = reinterpret_cast<FcStackHdr<Tp>*>(p);
         --hdr;
-        static char freeOne;
         if ((++freeOne & 0xF) == 0)
         {
             free( hdr );
@@ -1006,6 +1121,21 @@ struct SimplePTAllocator
     }
     void construct( Tp* p, const Tp& val ) { new (p) Tp(val); }
     void destroy(Tp* p) { p->~Tp(); }
+    // gives back everything on the free list, for a thread that's going
+    // to be idle a while
+    void trim()
+    {
+        while (head)
+        {
+            FcStackHdr<Tp>* hdr = head;
+            head = hdr->prev;
+            free( hdr );
+        }
+    }
+    ~SimplePTAllocator()
+    {
+        trim();
+    }
 };
 template <class T, class U>
 bool operator==(const SimplePTAllocator<T>& a, const SimplePTAllocator<U>& b)
@@ -1018,32 +1148,147 @@ bool operator!=(const SimplePTAllocator<T>& a, const SimplePTAllocator<U>& b)
     return &a != &b;
 }
     
-    class Thread
+    // where a program running in its caller's frame goes back to, see
+    // Ast::LeafReturn
+    struct LeafCaller
+    {
+        const Ast::Base* const* ppInstr;
+        Upvalue* upvalues; // a reference unless borrowed, as with RunContext::upvalues_
+        bool borrowed;
+    };
+
+    // the last closure a program literal made, and the environment it
+    // made it in, see Ast::Program::run
+    struct CachedClosure
+    {
+        enum { kSlots = 8 };
+        const Ast::Program* program = nullptr;
+        const Upvalue* env = nullptr;
+        Value closure;
+    };
+
+    // One interpreter instance: what parsing and running keep outside the
+    // programs themselves -- interned names, source locations, the compile
+    // settings, std: modules already loaded, and the null thread.  A Thread
+    // belongs to the isolate that was current when it was made, and running
+    // it makes that isolate current on the OS thread, so isolates can run at
+    // once on different OS threads with nothing between them to lock.  The
+    // scheduler's workers and the JIT's code cache are shared, and do their
+    // own locking.  Plain values (numbers, strings, arrays) can be handed
+    // from one isolate to another; functions and coroutines shouldn't be,
+    // they compile on demand against the isolate that parsed them.
+    // Until something Enters one, an OS thread uses the process default.
+    class Isolate
+    {
+    public:
+        struct State; // see bang.cpp
+    private:
+        State* state_;
+        Isolate( const Isolate& ) = delete;
+        Isolate& operator=( const Isolate& ) = delete;
+    public:
+        DLLEXPORT Isolate();
+        DLLEXPORT ~Isolate();
+        State& state() const { return *state_; }
+
+        DLLEXPORT static Isolate& current();
+
+        // isolate is current on this OS thread for as long as this is around
+        class Enter
+        {
+            Isolate* prev_;
+        public:
+            DLLEXPORT Enter( Isolate* isolate );
+            DLLEXPORT ~Enter();
+        };
+    };
+
+    // Coroutines' Threads come from Thread::make and go back to a pool when
+    // the last reference goes (see ThreadPool in bang.cpp), stacks and all.
+    class Thread : public gcbase<Thread>
     {
+        std::unique_ptr<Bang::Stack> altstack_; // hardly anything uses it
     public:
+        Isolate* isolate_;
         Bang::Stack stack;
-        Bang::Stack altstack;
+        Bang::Stack& altstack()
+        {
+            if (!altstack_)
+                altstack_.reset( new Bang::Stack );
+            return *altstack_;
+        }
         RunContext* callframe;
         Thread* pCaller;
         BANGFUNPTR boundProg_; // probably should have distinct type, BANGBOUNDPROGPTR or something
         SimplePTAllocator<RunContext> rcAlloc_;
         Bang::Value r0_;
         bool rb0_;
+        std::unique_ptr<Bang::Value[]> cse_; // reads kept for a later repeat, see CseRead
+        std::vector<LeafCaller> leafCallers_;
+        std::unique_ptr<CachedClosure[]> closures_;
+        BANGFUNPTR recvFrom_; // a channel that was empty at /recv; tried again when resumed
+        BANGFUNPTR sendTo_; // a channel that was full at /send; sendValue_ goes to it when resumed
+        Bang::Value sendValue_;
         Thread()
         : // pInteract( nullptr ),
+        isolate_( &Isolate::current() ),
         callframe( nullptr ),
         pCaller( nullptr )
         {}
         Thread( BANGFUNPTR boundProg )
-        : callframe( nullptr ),
+        : isolate_( &Isolate::current() ),
+          callframe( nullptr ),
           pCaller( nullptr ),
           boundProg_( boundProg  )
         {}
+        explicit Thread( Isolate* isolate )
+        : isolate_( isolate ),
+          callframe( nullptr ),
+          pCaller( nullptr )
+        {}
+        DLLEXPORT ~Thread();
         static DLLEXPORT Thread* nullthread();
+        // a coroutine that will start by running boundProg
+        static DLLEXPORT bangthreadptr_t make( BANGFUNPTR boundProg );
+        DLLEXPORT void recycle(); // see ThreadPool
+        // where r0_ and rb0_ sit, for the JIT, see Upvalue::parentOffset
+        static int r0Offset();
+        static int rb0Offset();
 
         void setcallin(Thread*caller);
     };
 
+    // Work for the scheduler's pool of OS threads, see Scheduler in bang.cpp.
+    // work() runs once, on whichever worker gets to it first, in a Bang!
+    // thread of its own.  Applying a Task waits for it to finish, then pushes
+    // what work() left on that thread's stack (or rethrows what it threw).
+    // Values go between workers as they are -- refcounts are atomic -- so
+    // anything mutable, like an Array, mustn't be changed while shared.
+    class Task : public Function
+    {
+        std::atomic<bool> done_;
+        std::exception_ptr error_;
+        std::vector<Value> results_;
+    protected:
+        Thread thread_;
+        virtual void work() = 0;
+        // on the worker, once done() is true; for telling someone who isn't joining
+        virtual void finished() {}
+        // runs fun, a bound program or a Function, on thread_
+        DLLEXPORT void call( const Value& fun );
+    public:
+        Task() : done_( false ) {}
+        bool done() const { return done_; }
+        DLLEXPORT void run();
+        // runs other tasks while it waits, rather than blocking a worker
+        DLLEXPORT void join( Stack& s );
+        virtual void apply( Stack& s ) { join( s ); }
+    };
+
+    // Queues task for the pool, which keeps a reference until it has run.
+    // Without threads (LCFG_MT_SAFEISH=0) it just runs it.
+    DLLEXPORT void spawn( Task* task );
+
     class InteractiveEnvironment
     {
         static void norepl_prompt() {}
@@ -1066,7 +1311,8 @@ bool operator!=(const SimplePTAllocator<T>& a, const SimplePTAllocator<U>& b)
         : interact( env ),
           unknownSymbolsAreStrings( in_unknownSymbolsAreStrings )
         {}
-        ParsingContext() 
+        ParsingContext()
+        : unknownSymbolsAreStrings( false )
         {}
         DLLEXPORT virtual Ast::Base* hitEof( const Ast::CloseValue* uvchain ) = 0;
     };
@@ -1079,6 +1325,7 @@ bool operator!=(const SimplePTAllocator<T>& a, const SimplePTAllocator<U>& b)
         virtual void accept() = 0;
         virtual void regurg( char ) = 0;
         virtual std::string sayWhere() const { return "(unsure where)"; }
+        virtual SourceLocation location() const { return SourceLocation(); }
         virtual ~RegurgeStream() {}
     };
 
@@ -1121,6 +1368,33 @@ bool operator!=(const SimplePTAllocator<T>& a, const SimplePTAllocator<U>& b)
     
     DLLEXPORT void dumpProfilingStats();
 
+    // Only find the extent of "fun" bodies when parsing; each body is parsed
+    // and optimized the first time it is applied.  This and setJit are
+    // settings of the current isolate.
+    DLLEXPORT void setLazyCompile( bool lazy );
+
+    // Translate straight-line stretches of each optimized program to native
+    // code where the platform supports it (x86-64 Linux); a no-op elsewhere.
+    DLLEXPORT void setJit( bool jit );
+
+    // Generated code is capped at this many mapped bytes in total (0 for no
+    // limit); past that, the least recently used code is dropped and its
+    // programs go back to being interpreted, until code that stays hot gets
+    // compiled again (a few times at most).
+    DLLEXPORT void setJitCacheLimit( size_t bytes );
+    // Drops the generated code for everything parsed along with module, as
+    // returned from ParseToProgram / RequireKeyword.  It still runs, interpreted.
+    // Otherwise code stays until the cache limit pushes it out, or the
+    // Isolate the module was parsed in goes away.
+    DLLEXPORT void releaseJitCode( const Ast::Program* module );
+    DLLEXPORT void dumpJitStats( std::ostream& o );
+
+    // How many OS threads run spawn!ed functions; 0, the default, for one
+    // per core.  Only counts before the first spawn.
+    DLLEXPORT void setWorkers( unsigned n );
+    // ...and how many there are (starting them if need be); 1 without threads
+    DLLEXPORT unsigned workers();
+
     template <class E = std::runtime_error>
     class ebuild
     {
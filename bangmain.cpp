@@ -1,11 +1,17 @@
 #include <iostream>
 #include <numeric> // for std::accumulate
+#include <chrono>
 #include <stdio.h>
 
 #ifdef _WIN32
 # include <windows.h>
+# include <psapi.h>
+# ifdef _MSC_VER
+#  pragma comment( lib, "psapi.lib" )
+# endif 
 #else
 # include <pthread.h>
+# include <sys/resource.h>
 static volatile void* xyz = (void*)&pthread_create;
 #endif 
 
@@ -22,6 +28,20 @@ namespace {
 }
 
 
+// -runstats: wall time since start, and the most memory we had at once
+void dumpRunStats( std::chrono::steady_clock::time_point start )
+{
+    const double secs = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    const long peakKb = GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof(pmc) ) ? long(pmc.PeakWorkingSetSize / 1024) : 0;
+#else
+    rusage ru;
+    const long peakKb = getrusage( RUSAGE_SELF, &ru ) == 0 ? ru.ru_maxrss : 0; // KB on Linux
+#endif 
+    std::cerr << "ran " << secs << "s, peak RSS " << peakKb << " KB" << std::endl;
+}
+
 void repl_prompt()
 {
     std::cout << "Bang! " << std::flush;
@@ -206,6 +226,9 @@ DLLEXPORT int bangmain( int argc, char* argv[] )
     bool bDump = false;
     bool bInteractive = false;
     bool bCmdLineAfterProgram = false;
+    bool bJitStats = false;
+    bool bRunStats = false;
+    const auto start = std::chrono::steady_clock::now();
 
     Bang::InteractiveEnvironment interact;
 
@@ -218,6 +241,36 @@ DLLEXPORT int bangmain( int argc, char* argv[] )
             bDump = true;
             argv[n] = nullptr;
         }
+        else if (arg == "-lazy")
+        {
+            Bang::setLazyCompile( true );
+            argv[n] = nullptr;
+        }
+        else if (arg == "-jit")
+        {
+            Bang::setJit( true );
+            argv[n] = nullptr;
+        }
+        else if (arg.substr(0,10) == "-jitcache=")
+        {
+            Bang::setJitCacheLimit( size_t(atol( arg.c_str() + 10 )) * 1024 );
+            argv[n] = nullptr;
+        }
+        else if (arg.substr(0,9) == "-workers=")
+        {
+            Bang::setWorkers( unsigned(atoi( arg.c_str() + 9 )) );
+            argv[n] = nullptr;
+        }
+        else if (arg == "-jitstats")
+        {
+            bJitStats = true;
+            argv[n] = nullptr;
+        }
+        else if (arg == "-runstats")
+        {
+            bRunStats = true;
+            argv[n] = nullptr;
+        }
         else if (arg == "-v")
         {
             std::cerr << "Bang! v" << BANG_VERSION << " - Welcome!" << std::endl;
@@ -351,6 +404,10 @@ DLLEXPORT int bangmain( int argc, char* argv[] )
     while (bInteractive);
 
     Bang::dumpProfilingStats();
+    if (bJitStats)
+        Bang::dumpJitStats( std::cerr );
+    if (bRunStats)
+        dumpRunStats( start );
 //    std::cerr << "toodaloo!" << std::endl;
 
     return 0;
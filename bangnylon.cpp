@@ -0,0 +1,836 @@
+#include "bang.h"
+#include "bangnylon.h"
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+
+extern char** environ; // for posix_spawn
+
+// Everything here but the finished-job queue belongs to the thread running
+// nylon.runloop!; cords are coroutines, so they only ever run there too.
+// Streams are watched on the same epoll as the loop's wakeup eventfd.
+
+namespace Nylon
+{
+    using namespace Bang;
+
+    // One-shot timers on a hierarchical wheel of 1ms ticks.  Level 0 has a
+    // slot per tick for the next 256; each level above has 64 slots, each
+    // spanning a whole turn of the level below.  Adding is a push onto one
+    // slot.  When level 0 comes round to slot 0, the next slot of level 1 is
+    // redistributed into it (and so on up), so every timer is touched once
+    // per level at most, and expiring is taking the list off the current
+    // slot.  Slots are FIFO, so timers due the same tick fire in the order
+    // they were added.
+    class TimerWheel
+    {
+    public:
+        struct Timer
+        {
+            Timer* next;
+            uint64_t due;
+            Value fun;
+        };
+    private:
+        enum { kLevels = 4, kBits0 = 8, kBitsN = 6 };
+        enum { kSpan = 1 << (kBits0 + (kLevels - 1) * kBitsN) }; // ~18.6 hours
+        struct Slot
+        {
+            Timer* head;
+            Timer** tail;
+            Slot() : head( nullptr ), tail( &head ) {}
+            void append( Timer* t ) { t->next = nullptr; *tail = t; tail = &t->next; }
+            Timer* take() { Timer* all = head; head = nullptr; tail = &head; return all; }
+        };
+        Slot slots_[kLevels][1 << kBits0];
+        uint64_t now_;   // every tick up to here has been run
+        size_t count_;   // timers anywhere on the wheel
+        size_t count0_;  // ...on level 0
+        Timer* free_;
+
+        static unsigned shift( int level ) { return level ? kBits0 + (level - 1) * kBitsN : 0; }
+        static unsigned mask( int level ) { return level ? (1 << kBitsN) - 1 : (1 << kBits0) - 1; }
+
+        void place( Timer* t )
+        {
+            // farther out than the wheel reaches: park it as far as it does,
+            // it gets placed again when that comes round
+            const uint64_t due = std::min<uint64_t>( t->due, now_ + kSpan - 1 );
+            const uint64_t delta = due - now_;
+            int level = 0;
+            while (level < kLevels - 1 && delta >= (uint64_t(1) << shift( level + 1 )))
+                ++level;
+            if (level == 0)
+                ++count0_;
+            slots_[level][(due >> shift( level )) & mask( level )].append( t );
+        }
+
+        void cascade( int level )
+        {
+            const unsigned ndx = (now_ >> shift( level )) & mask( level );
+            if (ndx == 0 && level < kLevels - 1)
+                cascade( level + 1 );
+            for (Timer* t = slots_[level][ndx].take(); t; )
+            {
+                Timer* next = t->next;
+                place( t );
+                t = next;
+            }
+        }
+
+    public:
+        TimerWheel() : now_( 0 ), count_( 0 ), count0_( 0 ), free_( nullptr ) {}
+        ~TimerWheel()
+        {
+            for (auto& level : slots_)
+                for (auto& slot : level)
+                    for (Timer* t = slot.take(); t; )
+                    {
+                        Timer* next = t->next;
+                        delete t;
+                        t = next;
+                    }
+            while (free_)
+            {
+                Timer* next = free_->next;
+                delete free_;
+                free_ = next;
+            }
+        }
+
+        bool empty() const { return count_ == 0; }
+
+        // anything due by now, a tick that has already run, goes off on the next one
+        void add( uint64_t due, const Value& fun )
+        {
+            Timer* t;
+            if (free_)
+            {
+                t = free_;
+                free_ = t->next;
+            }
+            else
+                t = new Timer;
+            t->due = std::max( due, now_ + 1 );
+            t->fun = fun;
+            ++count_;
+            place( t );
+        }
+
+        // moves time up to tick now, pushing the funs of timers now due onto
+        // expired; returns false if there were none
+        bool advance( uint64_t now, std::vector<Value>& expired )
+        {
+            const size_t before = expired.size();
+            while (now_ < now)
+            {
+                if (count_ == 0)
+                {
+                    now_ = now;
+                    break;
+                }
+                // nothing on level 0, skip to where the next cascade is
+                if (count0_ == 0)
+                {
+                    const uint64_t turn = (now_ | mask( 0 )) + 1;
+                    if (turn > now)
+                    {
+                        now_ = now;
+                        break;
+                    }
+                    now_ = turn - 1;
+                }
+                ++now_;
+                if ((now_ & mask( 0 )) == 0)
+                    cascade( 1 );
+                for (Timer* t = slots_[0][now_ & mask( 0 )].take(); t; )
+                {
+                    Timer* next = t->next;
+                    --count0_;
+                    if (t->due > now_)
+                        place( t ); // was parked
+                    else
+                    {
+                        expired.push_back( std::move( t->fun ) );
+                        t->fun = Value();
+                        t->next = free_;
+                        free_ = t;
+                        --count_;
+                    }
+                    t = next;
+                }
+            }
+            return expired.size() > before;
+        }
+
+        // ticks from now until something might be due; for how long to sleep
+        uint64_t untilNext() const
+        {
+            if (count0_ > 0)
+            {
+                for (uint64_t tick = now_ + 1; ; ++tick)
+                {
+                    if (slots_[0][tick & mask( 0 )].head)
+                        return tick - now_;
+                }
+            }
+            return ((now_ | mask( 0 )) + 1) - now_;
+        }
+    };
+
+    class RunLoop;
+
+    // A file, a pipe to or from a command, or one of the standard streams.
+    // /read and /write each make one system call and never wait; a cord
+    // waits for the stream first with wait-readable! or wait-writable!, so
+    // only it is held up (see read and write in lib/nylon.bang).
+    class Stream : public Function
+    {
+        int fd_;
+        bool owned_;     // false for stdin and co, which stay open and blocking
+        pid_t pid_;      // the command at the other end of a pipe, or 0
+        RunLoop* loop_;  // watching fd_; the last reference may go on any OS thread, see close()
+    public:
+        Stream( int fd, bool owned, pid_t pid, RunLoop* loop )
+        : fd_( fd ), owned_( owned ), pid_( pid ), loop_( loop )
+        {
+        }
+        ~Stream()
+        {
+            this->close();
+        }
+
+        int fd() const
+        {
+            if (fd_ < 0)
+                throw std::runtime_error( "nylon stream is closed" );
+            return fd_;
+        }
+
+        void close();
+
+        virtual void apply( Stack& s )
+        {
+        }
+
+        // pushes what could be read just now and true, '' and true at the
+        // end, or just false if there was nothing yet
+        void read( Stack& s )
+        {
+            char buffer[65536];
+            const ssize_t n = ::read( this->fd(), buffer, sizeof(buffer) );
+            if (n >= 0)
+            {
+                s.push_bs( bangstring( buffer, int(n) ) );
+                s.push( true );
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+                s.push( false );
+            else
+                throw std::runtime_error( std::string("nylon read: ") + strerror( errno ) );
+        }
+
+        // str stream/write -- pushes what's left of str and true, or just
+        // false once it's all written.  A blocking standard stream only
+        // gets a pipe's worth, which fits once it is writable.
+        void write( Stack& s )
+        {
+            const Value& v = s.pop();
+            if (!v.isstr())
+                throw std::runtime_error( "nylon write requires a string" );
+            const bangstring& str = v.tostr();
+            const size_t len = str.size();
+            ssize_t n = ::write( this->fd(), str.c_str(), owned_ ? len : std::min<size_t>( len, PIPE_BUF ) );
+            if (n < 0)
+            {
+                if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                    throw std::runtime_error( std::string("nylon write: ") + strerror( errno ) );
+                n = 0;
+            }
+            if (size_t(n) < len)
+            {
+                s.push_bs( bangstring( str.c_str() + n, int(len - n) ) );
+                s.push( true );
+            }
+            else
+                s.push( false );
+        }
+
+        void customOperator( const bangstring& str, Stack& s )
+        {
+            const static Bang::bangstring opRead("/read");
+            const static Bang::bangstring opWrite("/write");
+            const static Bang::bangstring opClose("/close");
+
+            if (str == opRead)
+                this->read( s );
+            else if (str == opWrite)
+                this->write( s );
+            else if (str == opClose)
+                this->close();
+            else
+                Function::customOperator( str, s );
+        }
+    };
+
+    // a function given to asthread!, and the cord to give what it leaves
+    class Job : public Task
+    {
+        Value fun_;
+        RunLoop* loop_; // finished() is on a worker, so not RunLoop::get()
+    public:
+        Value cord_;
+        Job( const Value& fun, const Value& cord, RunLoop* loop ) : fun_( fun ), loop_( loop ), cord_( cord ) {}
+        virtual void work()
+        {
+            call( fun_ );
+            fun_ = Value();
+        }
+        virtual void finished();
+    };
+
+    class RunLoop
+    {
+        typedef std::chrono::steady_clock clock;
+
+        const clock::time_point start_;
+        int epoll_;
+        int wakefd_;      // eventfd, poked when a job finishes
+        std::deque<Value> ready_;
+        std::unordered_set<const Thread*> cords_;
+        TimerWheel timers_;
+        std::vector<Value> expired_;
+        Thread callbacks_; // where timer funs run
+        int running_;      // jobs out on workers
+
+        // cords waiting on streams, by fd.  Each fd is watched one-shot for
+        // whatever its waiters want, and rearmed while any are left.
+        struct IoWait
+        {
+            Value reader;
+            Value writer;
+            bool added;
+            IoWait() : added( false ) {}
+        };
+        std::unordered_map<int, IoWait> io_;
+        int waiting_;                // cords in io_
+        std::vector<pid_t> children_; // closed pipes' commands, not yet exited
+
+        // a stream whose last reference went on another OS thread; only
+        // this loop's own thread may touch io_, so it closes them
+        struct Orphan
+        {
+            int fd;
+            bool owned;
+            pid_t pid;
+        };
+
+        std::mutex lock_;
+        std::vector< gcptr<Job> > finished_;
+        std::vector<Orphan> orphans_;
+
+        static RunLoop*& mine()
+        {
+            static thread_local RunLoop* loop = nullptr;
+            return loop;
+        }
+
+        void poke()
+        {
+            const uint64_t one = 1;
+            if (write( wakefd_, &one, sizeof(one) ) < 0)
+                { /* already poked, it'll look */ }
+        }
+
+        uint64_t tick() const
+        {
+            return std::chrono::duration_cast<std::chrono::milliseconds>( clock::now() - start_ ).count();
+        }
+
+        void callback( const Value& fun )
+        {
+            if (fun.isboundfun())
+            {
+                const BoundProgram* bprog = reinterpret_cast<const BoundProgram*>( fun.tofun().get() );
+                RunProgram( &callbacks_, bprog->program_, bprog->upvalues_ );
+            }
+            else if (fun.isfun())
+                fun.tofun()->apply( callbacks_.stack );
+            else
+                throw std::runtime_error( "nylon timer callback is not a function" );
+            while (callbacks_.stack.size() > 0) // whatever it left, nobody's looking
+                callbacks_.stack.pop_back();
+        }
+
+        // finished jobs' results go on their cords' stacks, for when they resume
+        void collectJobs()
+        {
+            std::vector< gcptr<Job> > done;
+            {
+                std::lock_guard<std::mutex> g( lock_ );
+                done.swap( finished_ );
+            }
+            for (auto& job : done)
+            {
+                --running_;
+                job->join( job->cord_.tothread()->stack );
+                ready_.push_back( job->cord_ );
+            }
+        }
+
+        void collectOrphans()
+        {
+            std::vector<Orphan> orphans;
+            {
+                std::lock_guard<std::mutex> g( lock_ );
+                orphans.swap( orphans_ );
+            }
+            for (const Orphan& o : orphans)
+                closeStream( o.fd, o.owned, o.pid );
+        }
+
+        void runTimers()
+        {
+            if (timers_.advance( tick(), expired_ ))
+            {
+                for (const Value& fun : expired_)
+                    callback( fun );
+                expired_.clear();
+            }
+        }
+
+        // false if fd can't be polled, which regular files can't
+        bool arm( int fd, IoWait& w )
+        {
+            epoll_event ev = {};
+            ev.events = EPOLLONESHOT | (w.reader.isthread() ? EPOLLIN : 0) | (w.writer.isthread() ? EPOLLOUT : 0);
+            ev.data.fd = fd;
+            if (epoll_ctl( epoll_, w.added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev ) == 0)
+            {
+                w.added = true;
+                return true;
+            }
+            if (errno == EPERM)
+                return false;
+            throw std::runtime_error( std::string("nylon could not watch a stream: ") + strerror( errno ) );
+        }
+
+        void wake( Value& waiter )
+        {
+            ready_.push_back( waiter );
+            waiter = Value();
+            --waiting_;
+        }
+
+        void ioReady( int fd, uint32_t events )
+        {
+            auto it = io_.find( fd );
+            if (it == io_.end())
+                return;
+            IoWait& w = it->second;
+            const bool hup = (events & (EPOLLHUP | EPOLLERR)) != 0;
+            if (w.reader.isthread() && (hup || (events & EPOLLIN)))
+                wake( w.reader );
+            if (w.writer.isthread() && (hup || (events & EPOLLOUT)))
+                wake( w.writer );
+            if (w.reader.isthread() || w.writer.isthread())
+                arm( fd, w );
+        }
+
+        void reapChildren()
+        {
+            for (size_t i = 0; i < children_.size(); )
+            {
+                if (waitpid( children_[i], nullptr, WNOHANG ) != 0)
+                {
+                    children_[i] = children_.back();
+                    children_.pop_back();
+                }
+                else
+                    ++i;
+            }
+        }
+
+        // until a job finishes, a stream is ready, or a timer might be due
+        void sleep()
+        {
+            int timeout = -1;
+            if (!timers_.empty())
+                timeout = int( timers_.untilNext() ); // ms
+            epoll_event events[64];
+            const int n = epoll_wait( epoll_, events, 64, timeout );
+            for (int i = 0; i < n; ++i)
+            {
+                if (events[i].data.fd == wakefd_)
+                {
+                    uint64_t pokes;
+                    if (read( wakefd_, &pokes, sizeof(pokes) ) < 0)
+                        { /* drained already */ }
+                }
+                else
+                    ioReady( events[i].data.fd, events[i].events );
+            }
+        }
+
+    public:
+        RunLoop()
+        : start_( clock::now() ),
+          epoll_( epoll_create1( EPOLL_CLOEXEC ) ),
+          wakefd_( eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC ) ),
+          running_( 0 ),
+          waiting_( 0 )
+        {
+            if (epoll_ < 0 || wakefd_ < 0)
+                throw std::runtime_error( "bangnylon could not create its run loop" );
+            epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.fd = wakefd_;
+            epoll_ctl( epoll_, EPOLL_CTL_ADD, wakefd_, &ev );
+        }
+
+        // one per OS thread, so isolates (see bang.h) each get their own
+        static RunLoop& get()
+        {
+            RunLoop*& loop = mine();
+            if (!loop)
+                loop = new RunLoop; // workers may still be finishing jobs at exit
+            return *loop;
+        }
+
+        double uptime() const
+        {
+            return std::chrono::duration<double>( clock::now() - start_ ).count();
+        }
+
+        void registerCord( const Value& coro ) { cords_.insert( coro.tothread().get() ); }
+        void unregisterCord( const Value& coro ) { cords_.erase( coro.tothread().get() ); }
+
+        void schedule( const Value& coro ) { ready_.push_back( coro ); }
+
+        void addOneShot( const Value& fun, double seconds )
+        {
+            timers_.add( tick() + uint64_t( std::max( 0.0, seconds * 1000.0 ) + 0.999 ), fun );
+        }
+
+        void asthread( const Value& fun, const Value& cord )
+        {
+            auto job = NEW_BANGFUN( Job, fun, cord, this );
+            ++running_;
+            Bang::spawn( job.get() );
+        }
+
+        // has cord scheduled once fd can be read (or written) without
+        // waiting.  Regular files can't be polled and are never slow to
+        // wait for, so their cords are scheduled straight away.
+        void waitFor( int fd, bool write, const Value& cord )
+        {
+            IoWait& w = io_[fd];
+            Value& waiter = write ? w.writer : w.reader;
+            if (waiter.isthread())
+                throw std::runtime_error( "nylon: another cord is already waiting on this stream" );
+            waiter = cord;
+            ++waiting_;
+            if (!arm( fd, w ))
+            {
+                wake( waiter );
+                io_.erase( fd );
+            }
+        }
+
+        // fd is about to be closed; whoever was waiting on it is woken, to
+        // find it closed
+        void forget( int fd )
+        {
+            auto it = io_.find( fd );
+            if (it == io_.end())
+                return;
+            if (it->second.reader.isthread())
+                wake( it->second.reader );
+            if (it->second.writer.isthread())
+                wake( it->second.writer );
+            if (it->second.added)
+                epoll_ctl( epoll_, EPOLL_CTL_DEL, fd, nullptr );
+            io_.erase( it );
+        }
+
+        // done with a stream's fd: closes it if owned and reaps the command
+        // at the other end once it exits.  From another OS thread that waits
+        // until this loop next looks for a cord, so the fd isn't reused
+        // while io_ still has it.
+        void closeStream( int fd, bool owned, pid_t pid )
+        {
+            if (mine() != this)
+            {
+                {
+                    std::lock_guard<std::mutex> g( lock_ );
+                    orphans_.push_back( Orphan{ fd, owned, pid } );
+                }
+                poke();
+                return;
+            }
+            forget( fd );
+            if (owned)
+                ::close( fd );
+            if (pid && waitpid( pid, nullptr, WNOHANG ) == 0)
+                children_.push_back( pid );
+        }
+
+        void jobFinished( Job* job )
+        {
+            {
+                std::lock_guard<std::mutex> g( lock_ );
+                finished_.push_back( gcptr<Job>( job ) );
+            }
+            poke();
+        }
+
+        // while there's a cord left that anything could still wake
+        bool haveThreads() const
+        {
+            return !cords_.empty() && (!ready_.empty() || !timers_.empty() || running_ > 0 || waiting_ > 0);
+        }
+
+        // the next cord to resume, waiting for one if need be
+        Value next()
+        {
+            for (;;)
+            {
+                if (!ready_.empty())
+                {
+                    Value v = ready_.front();
+                    ready_.pop_front();
+                    return v;
+                }
+                collectJobs();
+                collectOrphans();
+                runTimers();
+                reapChildren();
+                if (ready_.empty())
+                {
+                    if (timers_.empty() && running_ == 0 && waiting_ == 0)
+                        throw std::runtime_error( "nylon waitforthread: nothing left that could wake a cord" );
+                    sleep();
+                }
+            }
+        }
+    };
+
+    void Job::finished()
+    {
+        loop_->jobFinished( this );
+    }
+
+    void Stream::close()
+    {
+        if (fd_ < 0)
+            return;
+        loop_->closeStream( fd_, owned_, pid_ );
+        fd_ = -1;
+        pid_ = 0;
+    }
+
+    Value popcoro( Stack& s, const char* who )
+    {
+        const Value& v = s.pop();
+        if (!v.isthread())
+            throw std::runtime_error( std::string("nylon ") + who + " requires a coroutine" );
+        return v;
+    }
+
+    Stream* tostream( const Value& v, const char* who )
+    {
+        Stream* stream = v.isfun() ? dynamic_cast<Stream*>( v.tofun().get() ) : nullptr;
+        if (!stream)
+            throw std::runtime_error( std::string("nylon ") + who + " requires a stream" );
+        return stream;
+    }
+
+    int popmode( Stack& s, const char* who )
+    {
+        const Value& mode = s.pop();
+        if (mode.isstr())
+        {
+            if (mode.tostr() == "r")
+                return O_RDONLY;
+            if (mode.tostr() == "w")
+                return O_WRONLY | O_CREAT | O_TRUNC;
+            if (mode.tostr() == "a")
+                return O_WRONLY | O_CREAT | O_APPEND;
+        }
+        throw std::runtime_error( std::string("nylon ") + who + " mode must be 'r', 'w' or 'a'" );
+    }
+
+    void pushStream( Stack& s, int fd, bool owned, pid_t pid )
+    {
+        const auto& stream = NEW_BANGFUN( Stream, fd, owned, pid, &RunLoop::get() );
+        s.push( STATIC_CAST_TO_BANGFUN(stream) );
+    }
+
+    // path mode open! -- mode is 'r', 'w' or 'a'
+    void open( Stack& s, const RunContext& )
+    {
+        const int flags = popmode( s, "open" );
+        const Value& path = s.pop();
+        if (!path.isstr())
+            throw std::runtime_error( "nylon open requires a path" );
+        const int fd = ::open( path.tostr().c_str(), flags | O_NONBLOCK | O_CLOEXEC, 0666 );
+        if (fd < 0)
+            throw std::runtime_error( "nylon open " + std::string(path.tostr()) + ": " + strerror( errno ) );
+        pushStream( s, fd, true, 0 );
+    }
+
+    // command mode popen! -- runs command with /bin/sh; 'r' reads what it
+    // prints, 'w' writes what it reads
+    void popen( Stack& s, const RunContext& )
+    {
+        const bool reading = (popmode( s, "popen" ) == O_RDONLY);
+        const Value& command = s.pop();
+        if (!command.isstr())
+            throw std::runtime_error( "nylon popen requires a command" );
+        int fds[2];
+        if (pipe2( fds, O_CLOEXEC ) != 0)
+            throw std::runtime_error( std::string("nylon popen: ") + strerror( errno ) );
+        const int mine = reading ? fds[0] : fds[1];
+        const int theirs = reading ? fds[1] : fds[0];
+
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init( &actions );
+        posix_spawn_file_actions_adddup2( &actions, theirs, reading ? 1 : 0 );
+        const std::string cmd = command.tostr();
+        char* argv[] = { const_cast<char*>("sh"), const_cast<char*>("-c"), const_cast<char*>(cmd.c_str()), nullptr };
+        pid_t pid;
+        const int rc = posix_spawn( &pid, "/bin/sh", &actions, nullptr, argv, environ );
+        posix_spawn_file_actions_destroy( &actions );
+        ::close( theirs );
+        if (rc != 0)
+        {
+            ::close( mine );
+            throw std::runtime_error( "nylon popen " + cmd + ": " + strerror( rc ) );
+        }
+        fcntl( mine, F_SETFL, fcntl( mine, F_GETFL ) | O_NONBLOCK );
+        pushStream( s, mine, true, pid );
+    }
+
+    void stdinStream( Stack& s, const RunContext& )  { pushStream( s, 0, false, 0 ); }
+    void stdoutStream( Stack& s, const RunContext& ) { pushStream( s, 1, false, 0 ); }
+    void stderrStream( Stack& s, const RunContext& ) { pushStream( s, 2, false, 0 ); }
+
+    // stream coro wait-readable! -- schedules coro once stream has
+    // something to read; the coroutine should yield meanwhile
+    void waitReadable( Stack& s, const RunContext& )
+    {
+        const Value& coro = popcoro( s, "wait-readable" );
+        const Value& stream = s.pop();
+        RunLoop::get().waitFor( tostream( stream, "wait-readable" )->fd(), false, coro );
+    }
+
+    void waitWritable( Stack& s, const RunContext& )
+    {
+        const Value& coro = popcoro( s, "wait-writable" );
+        const Value& stream = s.pop();
+        RunLoop::get().waitFor( tostream( stream, "wait-writable" )->fd(), true, coro );
+    }
+
+    void uptime( Stack& s, const RunContext& )
+    {
+        s.push( RunLoop::get().uptime() );
+    }
+
+    void registerThread( Stack& s, const RunContext& )
+    {
+        RunLoop::get().registerCord( popcoro( s, "register-thread" ) );
+    }
+
+    void unregisterThread( Stack& s, const RunContext& )
+    {
+        RunLoop::get().unregisterCord( popcoro( s, "unregister-thread" ) );
+    }
+
+    void schedule( Stack& s, const RunContext& )
+    {
+        RunLoop::get().schedule( s.pop() );
+    }
+
+    // fun seconds addOneShot!
+    void addOneShot( Stack& s, const RunContext& )
+    {
+        const Value& seconds = s.pop();
+        if (!seconds.isnum())
+            throw std::runtime_error( "nylon addOneShot requires a number of seconds" );
+        const Value& fun = s.pop();
+        RunLoop::get().addOneShot( fun, seconds.tonum() );
+    }
+
+    // fun coro asthread!
+    void asthread( Stack& s, const RunContext& )
+    {
+        const Value& coro = popcoro( s, "asthread" );
+        const Value& fun = s.pop();
+        if (!fun.isboundfun() && !fun.isfun())
+            throw std::runtime_error( "nylon asthread requires a function" );
+        RunLoop::get().asthread( fun, coro );
+    }
+
+    void waitforthread( Stack& s, const RunContext& )
+    {
+        s.push( RunLoop::get().next() );
+    }
+
+    void haveThreads( Stack& s, const RunContext& )
+    {
+        s.push( RunLoop::get().haveThreads() );
+    }
+
+    void lookup( Bang::Stack& s, const Bang::RunContext& ctx )
+    {
+        const Bang::Value& v = s.pop();
+        if (!v.isstr())
+            throw std::runtime_error("Nylon library . operator expects string");
+        const auto& str = v.tostr();
+
+        const Bang::tfn_primitive p =
+            (  str == "uptime"            ? &uptime
+            :  str == "register-thread"   ? &registerThread
+            :  str == "unregister-thread" ? &unregisterThread
+            :  str == "schedule"          ? &schedule
+            :  str == "addOneShot"        ? &addOneShot
+            :  str == "asthread"          ? &asthread
+            :  str == "waitforthread"     ? &waitforthread
+            :  str == "have-threads"      ? &haveThreads
+            :  str == "open"              ? &open
+            :  str == "popen"             ? &popen
+            :  str == "stdin"             ? &stdinStream
+            :  str == "stdout"            ? &stdoutStream
+            :  str == "stderr"            ? &stderrStream
+            :  str == "wait-readable"     ? &waitReadable
+            :  str == "wait-writable"     ? &waitWritable
+            :  nullptr
+            );
+
+        if (p)
+            s.push( p );
+        else
+            throw std::runtime_error("Nylon library does not implement: " + std::string(str));
+    }
+} // end namespace Nylon
+
+
+extern "C" DLLEXPORT
+void bang_bangnylon_open( Bang::Stack* stack, const Bang::RunContext* )
+{
+    stack->push( &Nylon::lookup );
+}
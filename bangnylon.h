@@ -0,0 +1,16 @@
+/******************************************************************************
+ *
+ *    Description:  System side of lib/nylon.bang: the run loop that cords
+ *                  are scheduled on, one-shot timers, and running a function
+ *                  on a worker thread on a cord's behalf.
+ *
+ ******************************************************************************/
+#ifndef BANGNYLON_H__
+#define BANGNYLON_H__
+
+
+extern "C" DLLEXPORT
+void bang_bangnylon_open( Bang::Stack* stack, const Bang::RunContext* );
+
+
+#endif /* ifndef BANGNYLON_H__ */
@@ -42,6 +42,13 @@ public:
     };
 
 
+    // A refcount up here means the object was made immortal (see freeze! in
+    // bang.cpp): ref and unref stop touching it, so any number of threads can
+    // share it without atomic traffic, and it is never freed.  A ref racing
+    // the switch may still nudge it, hence the floor well below.
+    const long kImmortalRefcount = LONG_MAX / 2;
+    const long kImmortalFloor = LONG_MAX / 4;
+
     template <class T>
     class gcbase : private Uncopyable
     {
@@ -65,17 +72,20 @@ public:
         : refcount_(0),
           deleter_( &GCDeleter<T>::deleter )
         {}
-        long refcount() const { return refcount_; }
+        long refcount() const { return MT_SAFEISH_LOAD( refcount_ ); }
+        bool immortal() const { return refcount() >= kImmortalFloor; }
+        void immortalize() { MT_SAFEISH_STORE( refcount_, kImmortalRefcount ); }
         void ref()
         {
 //            ++refcount_;
 //            std::cerr << "gcbase=" << this << " ref=" << refcount_ << "\n";
-            MT_SAFEISH_INC( refcount_ );
+            if (!immortal())
+                MT_SAFEISH_INC( refcount_ );
         }
         void unref()
         {
 //            std::cerr << "gcbase=" << this << " UNREF=" << refcount_ << "\n";
-            if (MT_SAFEISH_DEC( refcount_ ))
+            if (!immortal() && MT_SAFEISH_DEC( refcount_ ))
             {
                 deleter_(static_cast<T*>(this));
             }
@@ -149,6 +159,20 @@ public:
         {
             gcptr().swap( *this );
         }
+
+        // hand the pointer over, or take one on, without touching its
+        // refcount; for holders that know someone else keeps it alive
+        T* release()
+        {
+            T* ptr = ptr_;
+            ptr_ = nullptr;
+            return ptr;
+        }
+        void adopt( T* ptr )
+        {
+            reset();
+            ptr_ = ptr;
+        }
         
         void swap(gcptr & other)
         {
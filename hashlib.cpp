@@ -109,6 +109,35 @@ namespace Hashlib
         }
     }
     
+    bool BangHash::lookup( const Bang::Value& msg, Bang::Value& found ) const
+    {
+        if (!msg.isstr())
+            return false;
+        auto loc = const_cast<BangHash*>(this)->find( msg.tostr() );
+        if (loc == hash_.end())
+            return false;
+        found = loc->second;
+        return true;
+    }
+    
+    void BangHash::freeze()
+    {
+        this->immortalize();
+        for (auto hashel = hash_.begin(); hashel != hash_.end(); ++hashel)
+        {
+#if !LCFG_STD_STRING
+            hashel->first.immortalize();
+#endif 
+            Bang::freeze( hashel->second );
+        }
+    }
+
+    // only once it's frozen, see Bang::shareable
+    bool BangHash::shareable( std::vector<const Bang::Function*>& seen ) const
+    {
+        return false;
+    }
+
     DLLEXPORT void BangHash::apply( Stack& s ) // , CLOSURE_CREF running )
     {
         const Bang::Value& msg = s.pop();
@@ -122,7 +151,12 @@ namespace Hashlib
         const static Bang::bangstring opKeys("/keys");
         const static Bang::bangstring opSet("/set");
 
-        if (theOperator == opSet)
+        if (this->frozen() &&
+            (theOperator == opSet || (theOperator[0] == '>' && theOperator[1] == '>')))
+        {
+            throw std::runtime_error("Hash " + std::string(theOperator) + " on a frozen hash");
+        }
+        else if (theOperator == opSet)
         {
             this->set(s);
         }
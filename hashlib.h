@@ -40,6 +40,9 @@ namespace Hashlib
         void keys( Bang::Stack& s );
         virtual void customOperator( const Bang::bangstring& theOperator, Bang::Stack& s);
         virtual void indexOperator( const Bang::Value& theIndex, Bang::Stack&, const Bang::RunContext& );
+        virtual bool lookup( const Bang::Value& theIndex, Bang::Value& found ) const;
+        virtual void freeze();
+        virtual bool shareable( std::vector<const Bang::Function*>& seen ) const;
         
     public:
         DLLEXPORT BangHash();
@@ -0,0 +1,137 @@
+// Runs the same scripts on several OS threads at once, each in an
+// Isolate of its own, and checks every one gets the answer it would get
+// alone.  Half of them have -jit on, so the shared code cache and the
+// worker pool get hit from several isolates together; once they're all
+// gone, none of their code should still be cached.
+//
+//   make isolatetest && ./isolatetest
+//
+// Exits non-zero, after saying which, if any run came out wrong.
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+
+#include "bang.h"
+
+using namespace Bang;
+
+namespace {
+    class RegurgeString : public RegurgeIo
+    {
+        std::string str_;
+        size_t at_;
+        bool atEof_;
+    public:
+        RegurgeString( const std::string& str )
+        : str_( str ), at_( 0 ), atEof_( false )
+        {}
+        char getc()
+        {
+            int icud = RegurgeIo::getcud();
+            if (icud != EOF)
+                return icud;
+            if (atEof_)
+                throw ErrorEof();
+            if (at_ >= str_.size())
+            {
+                atEof_ = true;
+                return 0x0a;
+            }
+            return str_[at_++];
+        }
+    };
+
+    class TestParsingContext : public ParsingContext
+    {
+    public:
+        TestParsingContext( InteractiveEnvironment& i ) : ParsingContext( i ) {}
+        Ast::Base* hitEof( const Ast::CloseValue* ) { return new Ast::BreakProg(); }
+    };
+
+    struct Script
+    {
+        const char* source;
+        double expected;
+    };
+
+    const Script scripts[] = {
+        { "fun :fib n = { n 2 < ? n : n 1 - fib! n 2 - fib! + }\n"
+          "20 fib!\n", 6765 },
+        { "fun :loop i acc = { i 100000 < ? i 1 + acc i + loop! : acc }\n"
+          "0 0 loop!\n", 4999950000.0 },
+        { "'std:iterate' require! .range as range\n"
+          "0 fun = +; 1 100 range!\n", 5050 },
+        { "fun :fib n = { n 2 < ? n : n 1 - fib! n 2 - fib! + }\n"
+          "fun = 12 fib!; spawn! as b\n"
+          "fun = 11 fib!; spawn! as c\n"
+          "b! c! +\n", 233 },
+    };
+
+    std::atomic<int> gFailures( 0 );
+
+    void runIsolate( int which, int rounds )
+    {
+        Isolate iso;
+        Isolate::Enter entered( &iso );
+        setJit( which % 2 == 1 );
+        for (int round = 0; round < rounds; ++round)
+        {
+            for (const Script& script : scripts)
+            {
+                std::ostringstream what;
+                what << "isolate " << which << " round " << round << ": ";
+                try
+                {
+                    InteractiveEnvironment interact;
+                    TestParsingContext parsectx( interact );
+                    RegurgeString stream( script.source );
+                    Ast::Program* prog = ParseToProgram( parsectx, stream, false, nullptr );
+                    Thread thread;
+                    RunProgram( &thread, prog, SHAREDUPVALUE() );
+                    if (thread.stack.size() < 1 || !thread.stack.loc_top().isnum()
+                        || thread.stack.loc_top().tonum() != script.expected)
+                    {
+                        std::cerr << what.str() << "expected " << script.expected << " from\n" << script.source;
+                        ++gFailures;
+                    }
+                }
+                catch (const std::exception& e)
+                {
+                    std::cerr << what.str() << e.what() << " from\n" << script.source;
+                    ++gFailures;
+                }
+            }
+        }
+    }
+}
+
+int main()
+{
+    const int nIsolates = 6;
+    const int rounds = 4;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < nIsolates; ++i)
+        threads.emplace_back( runIsolate, i, rounds );
+    for (auto& t : threads)
+        t.join();
+
+    std::ostringstream stats;
+    dumpJitStats( stats );
+    if (!stats.str().empty() && stats.str().find( "jit: 0 live" ) != 0) // empty without the jit
+    {
+        std::cerr << "code left cached after its isolates went: " << stats.str();
+        ++gFailures;
+    }
+
+    if (gFailures)
+    {
+        std::cerr << gFailures << " runs failed\n";
+        return 1;
+    }
+    std::cout << nIsolates << " isolates ok\n";
+    return 0;
+}
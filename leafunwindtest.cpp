@@ -0,0 +1,118 @@
+// Throws out of leaf calls and checks the frames they ran in get put back:
+// a caught exception must leave nothing on Thread::leafCallers_.  try/catch
+// is off in normal builds, so make compiles bang.cpp again with it on.
+//
+//   make leafunwindtest && ./leafunwindtest
+//
+// Exits non-zero, after saying which, if any script came out wrong.
+
+#include <iostream>
+#include <string>
+
+#include "bang.h"
+
+using namespace Bang;
+
+namespace {
+    class RegurgeString : public RegurgeIo
+    {
+        std::string str_;
+        size_t at_;
+        bool atEof_;
+    public:
+        RegurgeString( const std::string& str )
+        : str_( str ), at_( 0 ), atEof_( false )
+        {}
+        char getc()
+        {
+            int icud = RegurgeIo::getcud();
+            if (icud != EOF)
+                return icud;
+            if (atEof_)
+                throw ErrorEof();
+            if (at_ >= str_.size())
+            {
+                atEof_ = true;
+                return 0x0a;
+            }
+            return str_[at_++];
+        }
+    };
+
+    class TestParsingContext : public ParsingContext
+    {
+    public:
+        TestParsingContext( InteractiveEnvironment& i ) : ParsingContext( i ) {}
+        Ast::Base* hitEof( const Ast::CloseValue* ) { return new Ast::BreakProg(); }
+    };
+
+    struct Script
+    {
+        const char* what;
+        const char* source;
+    };
+
+    // each leaves 'caught' on top of the stack; a leaf is any body without
+    // a tail call, so the calls into them below aren't in tail position
+    const Script scripts[] = {
+        { "a primitive failing in a leaf",
+          "fun :leaf x = { x /nosuch }\n"
+          "fun :outer x = { x leaf! 2 * }\n"
+          "try 4 outer! ; catch 'caught';\n" },
+        { "a leaf calling a leaf",
+          "fun :inner x = { x /nosuch }\n"
+          "fun :leaf x = { x inner! 1 + }\n"
+          "fun :outer x = { x leaf! 2 * }\n"
+          "try 5 outer! ; catch 'caught';\n" },
+        { "a leaf running in the try block's own frame",
+          "fun :leaf x = { x /nosuch }\n"
+          "try 6 leaf! 1 + ; catch 'caught';\n" },
+        { "leaves under a frame the throw tears down",
+          "fun :inner x = { x /nosuch }\n"
+          "fun :leaf x = { x inner! 1 + }\n"
+          "fun :outer x = { x leaf! 2 * }\n"
+          "fun :top x = { x 1 + outer! }\n"
+          "try 7 top! 1 + ; catch 'caught';\n" },
+    };
+}
+
+int main()
+{
+    int failures = 0;
+    for (const Script& script : scripts)
+    {
+        try
+        {
+            InteractiveEnvironment interact;
+            TestParsingContext parsectx( interact );
+            RegurgeString stream( script.source );
+            Ast::Program* prog = ParseToProgram( parsectx, stream, false, nullptr );
+            Thread thread;
+            RunProgram( &thread, prog, SHAREDUPVALUE() );
+            if (thread.stack.size() < 1 || !thread.stack.loc_top().isstr()
+                || std::string( thread.stack.loc_top().tostr() ) != "caught")
+            {
+                std::cerr << script.what << ": the catch block didn't run\n";
+                ++failures;
+            }
+            if (!thread.leafCallers_.empty())
+            {
+                std::cerr << script.what << ": " << thread.leafCallers_.size() << " leaf callers left behind\n";
+                ++failures;
+            }
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << script.what << ": " << e.what() << "\n";
+            ++failures;
+        }
+    }
+
+    if (failures)
+    {
+        std::cerr << failures << " failures\n";
+        return 1;
+    }
+    std::cout << "leaf calls unwound\n";
+    return 0;
+}
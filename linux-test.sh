@@ -1,3 +1,14 @@
 #!/bin/bash
+# any arguments are passed along to bang, e.g., ./linux-test.sh -jit
 
-for i in `ls -1 test/*.bang`; do bn=`basename $i`;./bang $i > /tmp/out1x; echo $i; diff /tmp/out1x ./test-ref/$bn.out; done
+for i in `ls -1 test/*.bang`; do bn=`basename $i`;./bang "$@" $i > /tmp/out1x; echo $i; diff /tmp/out1x ./test-ref/$bn.out; done
+
+# again with generated code capped at two pages, so the JIT evicts code that's
+# still in use and those programs go on interpreted; the output mustn't change
+for i in `ls -1 test/*.bang`; do bn=`basename $i`;./bang -jit -jitcache=8 $i > /tmp/out1x; echo "$i (-jitcache=8)"; diff /tmp/out1x ./test-ref/$bn.out; done
+
+# several isolates at once, if it's been built (make isolatetest)
+if [ -x ./isolatetest ]; then echo isolatetest; ./isolatetest > /dev/null || echo "isolatetest failed"; fi
+
+# throwing out of leaf calls, if it's been built (make leafunwindtest)
+if [ -x ./leafunwindtest ]; then echo leafunwindtest; ./leafunwindtest > /dev/null || echo "leafunwindtest failed"; fi
@@ -0,0 +1,14 @@
+local N = 1000000
+
+local function run1( i )
+   local co = coroutine.create( function() coroutine.yield( i ) return i + 1 end )
+   local _, a = coroutine.resume( co )
+   local _, b = coroutine.resume( co )
+   return a + b
+end
+
+local total = 0
+for i = 0, N - 1 do
+   total = total + run1( i )
+end
+print( total )
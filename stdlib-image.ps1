@@ -0,0 +1,17 @@
+# Writes stdlib-image.cpp from lib/*.bang, as the Makefile's rule for it
+# does; bangall.vcxproj runs it before each build.
+
+$out = Join-Path $PSScriptRoot 'stdlib-image.cpp'
+
+$lines = @(
+    '// generated by stdlib-image.ps1 from lib/*.bang; do not edit',
+    'namespace Bang { struct StdLibModule { const char* name; const char* source; };',
+    'extern const StdLibModule gStdLibImage[] = {'
+)
+Get-ChildItem (Join-Path $PSScriptRoot 'lib') -Filter *.bang | Sort-Object Name | ForEach-Object {
+    $source = [IO.File]::ReadAllText( $_.FullName )
+    $lines += '{ "' + $_.BaseName + '", R"BANGLIB(' + $source + ')BANGLIB" },'
+}
+$lines += '{ nullptr, nullptr } }; }'
+
+[IO.File]::WriteAllLines( $out, $lines )
@@ -0,0 +1,159 @@
+/******************************************************************************
+ *
+ *    Description:  Minimal x86-64 machine code emitter; just the handful of
+ *                  instructions the baseline JIT in bang.cpp needs.  No
+ *                  dependencies beyond mmap.
+ *
+ ******************************************************************************/
+#ifndef X64EMIT_H__
+#define X64EMIT_H__
+
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace X64
+{
+    enum Reg { rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi, r8, r9, r10, r11, r12, r13, r14, r15 };
+    enum Xmm { xmm0, xmm1, xmm2, xmm3, xmm4, xmm5, xmm6, xmm7,
+               xmm8, xmm9, xmm10, xmm11, xmm12, xmm13, xmm14, xmm15 };
+
+    // condition codes, as used by jcc / setcc
+    enum Cond { kO = 0, kB = 2, kAE = 3, kE = 4, kNE = 5, kBE = 6, kA = 7, kP = 0xA, kNP = 0xB };
+
+    class Label
+    {
+        friend class Emitter;
+        int pos_;
+        std::vector<int> fixups_; // locations of rel32 fields that want our address
+    public:
+        Label() : pos_(-1) {}
+    };
+
+    class Emitter
+    {
+        std::vector<uint8_t> code_;
+
+        void b( uint8_t byte ) { code_.push_back( byte ); }
+        void d32( int32_t v )
+        {
+            for (int i = 0; i < 4; ++i)
+                b( uint8_t(v >> (i*8)) );
+        }
+        void d64( uint64_t v )
+        {
+            for (int i = 0; i < 8; ++i)
+                b( uint8_t(v >> (i*8)) );
+        }
+        void rex( bool w, int reg, int base, bool force = false )
+        {
+            const uint8_t r = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+            if (r != 0x40 || force)
+                b( r );
+        }
+        // always mod=10 (disp32); rsp/r12 as base need a SIB byte
+        void mem( int reg, int base, int32_t disp )
+        {
+            b( 0x80 | ((reg & 7) << 3) | (base & 7) );
+            if ((base & 7) == rsp)
+                b( 0x24 );
+            d32( disp );
+        }
+        void direct( int reg, int rm )
+        {
+            b( 0xC0 | ((reg & 7) << 3) | (rm & 7) );
+        }
+        void rel32( Label& l )
+        {
+            if (l.pos_ >= 0)
+                d32( l.pos_ - int(code_.size() + 4) );
+            else
+            {
+                l.fixups_.push_back( code_.size() );
+                d32( 0 );
+            }
+        }
+    public:
+        size_t size() const { return code_.size(); }
+
+        void bind( Label& l )
+        {
+            l.pos_ = code_.size();
+            for (int at : l.fixups_)
+            {
+                const int32_t rel = l.pos_ - (at + 4);
+                memcpy( &code_[at], &rel, 4 );
+            }
+            l.fixups_.clear();
+        }
+
+        void push( Reg r ) { rex( false, 0, r ); b( 0x50 | (r & 7) ); }
+        void pop( Reg r )  { rex( false, 0, r ); b( 0x58 | (r & 7) ); }
+        void ret()         { b( 0xC3 ); }
+        void subRsp( int32_t n ) { b( 0x48 ); b( 0x81 ); direct( 5, rsp ); d32( n ); }
+        void addRsp( int32_t n ) { b( 0x48 ); b( 0x81 ); direct( 0, rsp ); d32( n ); }
+
+        // 64 bit moves
+        void mov( Reg dst, Reg src )                  { rex( true, src, dst ); b( 0x89 ); direct( src, dst ); }
+        void load( Reg dst, Reg base, int32_t disp )  { rex( true, dst, base ); b( 0x8B ); mem( dst, base, disp ); }
+        void store( Reg base, int32_t disp, Reg src ) { rex( true, src, base ); b( 0x89 ); mem( src, base, disp ); }
+        void movImm( Reg dst, uint64_t imm )          { rex( true, 0, dst ); b( 0xB8 | (dst & 7) ); d64( imm ); }
+
+        // 32 bit moves
+        void movImm32( Reg dst, int32_t imm )             { rex( false, 0, dst ); b( 0xB8 | (dst & 7) ); d32( imm ); }
+        void load32( Reg dst, Reg base, int32_t disp )    { rex( false, dst, base ); b( 0x8B ); mem( dst, base, disp ); }
+        void store32( Reg base, int32_t disp, Reg src )   { rex( false, src, base ); b( 0x89 ); mem( src, base, disp ); }
+        void store32Imm( Reg base, int32_t disp, int32_t imm ) { rex( false, 0, base ); b( 0xC7 ); mem( 0, base, disp ); d32( imm ); }
+        void cmp32Imm( Reg base, int32_t disp, int8_t imm )    { rex( false, 0, base ); b( 0x83 ); mem( 7, base, disp ); b( imm ); }
+        void test32( Reg a, Reg c )                       { rex( false, c, a ); b( 0x85 ); direct( c, a ); }
+        void and32( Reg dst, Reg src )                    { rex( false, src, dst ); b( 0x21 ); direct( src, dst ); }
+        void or32( Reg dst, Reg src )                     { rex( false, src, dst ); b( 0x09 ); direct( src, dst ); }
+
+        // 8 bit; only use rax/rcx/rdx/rbx as byte registers
+        void store8( Reg base, int32_t disp, Reg src )     { rex( false, src, base ); b( 0x88 ); mem( src, base, disp ); }
+        void store8Imm( Reg base, int32_t disp, int8_t imm ) { rex( false, 0, base ); b( 0xC6 ); mem( 0, base, disp ); b( imm ); }
+        void loadZx8( Reg dst, Reg base, int32_t disp )    { rex( false, dst, base ); b( 0x0F ); b( 0xB6 ); mem( dst, base, disp ); }
+        void setcc( Cond cc, Reg dst )                     { b( 0x0F ); b( 0x90 | cc ); direct( 0, dst ); }
+        void and8( Reg dst, Reg src )                      { b( 0x20 ); direct( src, dst ); }
+
+        // scalar double
+        void movsdLoad( Xmm dst, Reg base, int32_t disp )  { b( 0xF2 ); rex( false, dst, base ); b( 0x0F ); b( 0x10 ); mem( dst, base, disp ); }
+        void movsdStore( Reg base, int32_t disp, Xmm src ) { b( 0xF2 ); rex( false, src, base ); b( 0x0F ); b( 0x11 ); mem( src, base, disp ); }
+        void movq( Xmm dst, Reg src )                      { b( 0x66 ); rex( true, dst, src ); b( 0x0F ); b( 0x6E ); direct( dst, src ); }
+        void movsd( Xmm dst, Xmm src )                     { b( 0xF2 ); rex( false, dst, src ); b( 0x0F ); b( 0x10 ); direct( dst, src ); }
+        void addsd( Xmm dst, Xmm src )                     { b( 0xF2 ); rex( false, dst, src ); b( 0x0F ); b( 0x58 ); direct( dst, src ); }
+        void mulsd( Xmm dst, Xmm src )                     { b( 0xF2 ); rex( false, dst, src ); b( 0x0F ); b( 0x59 ); direct( dst, src ); }
+        void subsd( Xmm dst, Xmm src )                     { b( 0xF2 ); rex( false, dst, src ); b( 0x0F ); b( 0x5C ); direct( dst, src ); }
+        void divsd( Xmm dst, Xmm src )                     { b( 0xF2 ); rex( false, dst, src ); b( 0x0F ); b( 0x5E ); direct( dst, src ); }
+        void ucomisd( Xmm a, Xmm c )                       { b( 0x66 ); rex( false, a, c ); b( 0x0F ); b( 0x2E ); direct( a, c ); }
+
+        // control flow
+        void jmp( Label& l )           { b( 0xE9 ); rel32( l ); }
+        void jcc( Cond cc, Label& l )  { b( 0x0F ); b( 0x80 | cc ); rel32( l ); }
+        void call( const void* fn )    { movImm( rax, reinterpret_cast<uint64_t>(fn) ); b( 0xFF ); direct( 2, rax ); }
+
+        // Copies the code into its own pages and flips them to read+execute.
+        // Returns nullptr if the OS won't give us executable memory.
+        void* finalize( size_t* pmapped = nullptr ) const
+        {
+            const size_t page = sysconf( _SC_PAGESIZE );
+            const size_t len = (code_.size() + page - 1) & ~(page - 1);
+            void* mem = mmap( nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+            if (mem == MAP_FAILED)
+                return nullptr;
+            memcpy( mem, &code_[0], code_.size() );
+            if (mprotect( mem, len, PROT_READ | PROT_EXEC ) != 0)
+            {
+                munmap( mem, len );
+                return nullptr;
+            }
+            if (pmapped)
+                *pmapped = len;
+            return mem;
+        }
+    };
+} // end, namespace X64
+
+#endif /* ifndef X64EMIT_H__ */